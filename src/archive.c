@@ -0,0 +1,183 @@
+/*! \file archive.c
+ *  \brief Assets decoded ahead of time into a single memory-mapped file, independent from Allegro.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "archive.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+#define ARCHIVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static bool Map(struct Archive* archive, const char* filename) {
+	// Nothing gets read up front; the payloads are paged in by the kernel
+	// the first time they're touched, and shared with the page cache.
+#ifdef ARCHIVE_MMAP
+	struct stat st;
+	void* data;
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	if (fstat(fd, &st) || st.st_size <= 0) {
+		close(fd);
+		return false;
+	}
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return false;
+	}
+	archive->data = data;
+	archive->size = st.st_size;
+	archive->mapped = true;
+	return true;
+#else
+	(void)archive;
+	(void)filename;
+	return false;
+#endif
+}
+
+static bool Read(struct Archive* archive, const char* filename) {
+	// Where there's no mmap, the whole file gets read at once instead.
+	FILE* file = fopen(filename, "rb");
+	uint8_t* data;
+	long size;
+	if (!file) {
+		return false;
+	}
+	if (fseek(file, 0, SEEK_END) || (size = ftell(file)) <= 0 || fseek(file, 0, SEEK_SET)) {
+		fclose(file);
+		return false;
+	}
+	data = malloc(size);
+	if (fread(data, 1, size, file) != (size_t)size) {
+		free(data);
+		fclose(file);
+		return false;
+	}
+	fclose(file);
+	archive->data = data;
+	archive->size = size;
+	archive->mapped = false;
+	return true;
+}
+
+static bool Validate(const struct Archive* archive) {
+	uint32_t i;
+	if (archive->size < sizeof(struct ArchiveHeader)) {
+		return false;
+	}
+	if (memcmp(archive->header->magic, ARCHIVE_MAGIC, 4) || archive->header->version != ARCHIVE_VERSION) {
+		return false;
+	}
+	if (archive->header->count > (archive->size - sizeof(struct ArchiveHeader)) / sizeof(struct ArchiveEntry)) {
+		return false;
+	}
+	for (i = 0; i < archive->header->count; i++) {
+		const struct ArchiveEntry* entry = &archive->entries[i];
+		if (entry->offset % ARCHIVE_ALIGNMENT || entry->offset > archive->size || entry->size > archive->size - entry->offset) {
+			return false;
+		}
+		if (memchr(entry->name, 0, ARCHIVE_NAME_LENGTH) == NULL) {
+			return false;
+		}
+	}
+	return true;
+}
+
+struct Archive* OpenArchive(const char* filename) {
+	// Returns NULL when there's no archive or it's unusable, in which case
+	// the assets are simply decoded from their original files.
+	struct Archive* archive = calloc(1, sizeof(struct Archive));
+	if (!Map(archive, filename) && !Read(archive, filename)) {
+		free(archive);
+		return NULL;
+	}
+	archive->header = (const struct ArchiveHeader*)archive->data;
+	archive->entries = (const struct ArchiveEntry*)(archive->data + sizeof(struct ArchiveHeader));
+	if (!Validate(archive)) {
+		CloseArchive(archive);
+		return NULL;
+	}
+	return archive;
+}
+
+void CloseArchive(struct Archive* archive) {
+	// Everything created from its data in place has to be destroyed first.
+	if (!archive) {
+		return;
+	}
+#ifdef ARCHIVE_MMAP
+	if (archive->mapped) {
+		munmap((void*)archive->data, archive->size);
+	}
+#endif
+	if (!archive->mapped) {
+		free((void*)archive->data);
+	}
+	free(archive);
+}
+
+static bool IsSeparator(char c) {
+	return c == '/' || c == '\\';
+}
+
+static bool MatchesName(const char* filename, const char* name) {
+	// The filename can be a full path, as long as it ends with the name.
+	size_t length = strlen(filename), nameLength = strlen(name), i;
+	if (length < nameLength) {
+		return false;
+	}
+	filename += length - nameLength;
+	if (length > nameLength && !IsSeparator(filename[-1])) {
+		return false;
+	}
+	for (i = 0; i < nameLength; i++) {
+		if (filename[i] != name[i] && !(IsSeparator(filename[i]) && IsSeparator(name[i]))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+const struct ArchiveEntry* FindArchiveEntry(const struct Archive* archive, const char* filename, enum ArchiveType type, int fontSize) {
+	uint32_t i;
+	if (!archive || !filename) {
+		return NULL;
+	}
+	for (i = 0; i < archive->header->count; i++) {
+		const struct ArchiveEntry* entry = &archive->entries[i];
+		if (entry->type == (uint32_t)type && (type != ARCHIVE_FONT || entry->fontSize == (uint32_t)fontSize) && MatchesName(filename, entry->name)) {
+			return entry;
+		}
+	}
+	return NULL;
+}
+
+const void* GetArchiveData(const struct Archive* archive, const struct ArchiveEntry* entry) {
+	return archive->data + entry->offset;
+}
@@ -0,0 +1,71 @@
+/*! \file archive.h
+ *  \brief Assets decoded ahead of time into a single memory-mapped file, independent from Allegro.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZJEDZTRAWKE2_ARCHIVE_H
+#define ZJEDZTRAWKE2_ARCHIVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARCHIVE_MAGIC "ZT2P"
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_ALIGNMENT 64 // of every payload, so it can be used in place
+#define ARCHIVE_NAME_LENGTH 64
+
+enum ArchiveType {
+	ARCHIVE_BITMAP, // premultiplied RGBA, 8 bits per channel
+	ARCHIVE_SAMPLE, // interleaved signed 16 bit PCM
+	ARCHIVE_FONT, // glyph atlas laid out for al_grab_font_from_bitmap, as a bitmap
+};
+
+/* File layout: the header, then a table of entries, then their payloads.
+ * All integers are in the byte order of the machine it was packed on. */
+
+struct ArchiveHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t count;
+	uint32_t reserved;
+};
+
+struct ArchiveEntry {
+	char name[ARCHIVE_NAME_LENGTH]; // path relative to the data directory
+	uint32_t type;
+	uint32_t offset, size; // of the payload, from the start of the file
+	uint32_t width, height; // bitmaps and fonts
+	uint32_t rate, channels, length; // samples, length in frames
+	uint32_t fontSize, first, last; // fonts: pixel size and range of code points
+};
+
+struct Archive {
+	const uint8_t* data;
+	size_t size;
+	bool mapped; // otherwise read into memory
+	const struct ArchiveHeader* header;
+	const struct ArchiveEntry* entries;
+};
+
+struct Archive* OpenArchive(const char* filename);
+void CloseArchive(struct Archive* archive);
+const struct ArchiveEntry* FindArchiveEntry(const struct Archive* archive, const char* filename, enum ArchiveType type, int fontSize);
+const void* GetArchiveData(const struct Archive* archive, const struct ArchiveEntry* entry);
+
+#endif
@@ -0,0 +1,478 @@
+/*! \file assets.c
+ *  \brief Reference counted cache of bitmaps, samples and fonts shared by gamestates.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "assets.h"
+#include "archive.h"
+#include <allegro5/allegro_ttf.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BUILTIN_FONT_SIZE 8192 // rough size of its glyph sheet
+#define KEY_FLAGS(flags) ((flags) & ~(ALLEGRO_MEMORY_BITMAP | ALLEGRO_CONVERT_BITMAP))
+
+enum AssetType {
+	ASSET_BITMAP,
+	ASSET_SAMPLE,
+	ASSET_FONT,
+};
+
+enum AssetState {
+	ASSET_QUEUED, // prefetched, waiting for a worker
+	ASSET_LOADING,
+	ASSET_READY,
+	ASSET_FAILED,
+};
+
+struct Asset {
+	enum AssetType type;
+	enum AssetState state;
+	enum AssetPriority priority;
+	char* filename; // NULL for the builtin font
+	int flags; // new bitmap flags the bitmap was requested with, or size of the font
+	void* data;
+	size_t size;
+	int references;
+	uint64_t used; // when it was last released, for eviction
+	bool upload; // decoded by a worker into a memory bitmap
+	bool pinned; // prefetched and not acquired yet, so not evicted
+};
+
+struct AssetCache {
+	// Assets are keyed by their path, and stay loaded after the last
+	// gamestate using them releases them, so switching back and forth
+	// between gamestates doesn't decode anything again. Unused ones get
+	// evicted, least recently used first, once the budget is exceeded.
+	//
+	// Prefetched assets are decoded by a pool of workers, most important
+	// first, while whoever asked for them goes on with something else.
+	// Workers have no display, so their bitmaps end up in memory until
+	// they're uploaded from the main thread. They aren't evicted before
+	// being acquired for the first time, as that's what they're decoded for.
+	//
+	// Whatever the archive has already decoded is taken from it instead of
+	// the original files.
+	struct Archive* archive;
+	struct Asset** assets;
+	int count, capacity;
+	size_t bytes, budget;
+	uint64_t clock;
+	ALLEGRO_MUTEX* mutex;
+	ALLEGRO_COND* cond; // an asset got queued or finished
+	ALLEGRO_THREAD* workers[ASSET_MAX_WORKERS];
+	int workerCount;
+	bool stop;
+};
+
+static void DestroyAssetData(struct Asset* asset) {
+	if (asset->data) {
+		switch (asset->type) {
+			case ASSET_BITMAP:
+				al_destroy_bitmap(asset->data);
+				break;
+			case ASSET_SAMPLE:
+				al_destroy_sample(asset->data);
+				break;
+			case ASSET_FONT:
+				al_destroy_font(asset->data);
+				break;
+		}
+	}
+	free(asset->filename);
+	free(asset);
+}
+
+static void RemoveAsset(struct AssetCache* cache, int i) {
+	cache->bytes -= cache->assets[i]->size;
+	DestroyAssetData(cache->assets[i]);
+	cache->assets[i] = cache->assets[--cache->count];
+}
+
+static bool IsEvictable(struct Asset* asset, bool display) {
+	// Textures and fonts can only be destroyed where the display is, so
+	// workers and loading threads leave them for the main thread.
+	if (asset->references || asset->pinned || asset->state != ASSET_READY) {
+		return false;
+	}
+	switch (asset->type) {
+		case ASSET_BITMAP:
+			return display || (al_get_bitmap_flags(asset->data) & ALLEGRO_MEMORY_BITMAP);
+		case ASSET_FONT:
+			return display;
+		case ASSET_SAMPLE:
+		default:
+			return true;
+	}
+}
+
+static void Evict(struct AssetCache* cache) {
+	bool display = al_get_current_display() != NULL;
+	while (cache->budget && cache->bytes > cache->budget) {
+		int i, oldest = -1;
+		for (i = 0; i < cache->count; i++) {
+			struct Asset* asset = cache->assets[i];
+			if (IsEvictable(asset, display) && (oldest < 0 || asset->used < cache->assets[oldest]->used)) {
+				oldest = i;
+			}
+		}
+		if (oldest < 0) {
+			return; // everything left is in use
+		}
+		RemoveAsset(cache, oldest);
+	}
+}
+
+static struct Asset* FindAsset(struct AssetCache* cache, enum AssetType type, const char* filename, int flags) {
+	int i;
+	for (i = 0; i < cache->count; i++) {
+		struct Asset* asset = cache->assets[i];
+		if (asset->type == type && asset->flags == flags && ((!asset->filename && !filename) || (asset->filename && filename && !strcmp(asset->filename, filename)))) {
+			return asset;
+		}
+	}
+	return NULL;
+}
+
+static struct Asset* AddAsset(struct AssetCache* cache, enum AssetType type, const char* filename, int flags) {
+	if (cache->count == cache->capacity) {
+		cache->capacity = cache->capacity ? cache->capacity * 2 : 16;
+		cache->assets = realloc(cache->assets, cache->capacity * sizeof(struct Asset*));
+	}
+	struct Asset* asset = calloc(1, sizeof(struct Asset));
+	asset->type = type;
+	asset->filename = filename ? strdup(filename) : NULL;
+	asset->flags = flags;
+	cache->assets[cache->count++] = asset;
+	return asset;
+}
+
+static size_t GetAssetSize(enum AssetType type, void* data) {
+	switch (type) {
+		case ASSET_BITMAP:
+			return (size_t)al_get_bitmap_width(data) * al_get_bitmap_height(data) * 4;
+		case ASSET_SAMPLE:
+			return (size_t)al_get_sample_length(data) * al_get_channel_count(al_get_sample_channels(data)) * al_get_audio_depth_size(al_get_sample_depth(data));
+		case ASSET_FONT:
+		default:
+			return BUILTIN_FONT_SIZE;
+	}
+}
+
+static void* CreateArchivedBitmap(const struct ArchiveEntry* entry, const uint8_t* pixels) {
+	ALLEGRO_BITMAP* bitmap = al_create_bitmap(entry->width, entry->height);
+	ALLEGRO_LOCKED_REGION* region;
+	uint32_t y;
+	if (!bitmap) {
+		return NULL;
+	}
+	region = al_lock_bitmap(bitmap, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_WRITEONLY);
+	if (!region) {
+		al_destroy_bitmap(bitmap);
+		return NULL;
+	}
+	for (y = 0; y < entry->height; y++) {
+		memcpy((uint8_t*)region->data + (ptrdiff_t)y * region->pitch, pixels + (size_t)y * entry->width * 4, (size_t)entry->width * 4);
+	}
+	al_unlock_bitmap(bitmap);
+	return bitmap;
+}
+
+static void* DecodeArchived(const struct Archive* archive, enum AssetType type, const char* filename, int flags) {
+	// Samples are played straight from the archive's memory, without a copy.
+	const struct ArchiveEntry* entry;
+	void* data = NULL;
+	int previous = al_get_new_bitmap_flags();
+	switch (type) {
+		case ASSET_BITMAP:
+			if ((entry = FindArchiveEntry(archive, filename, ARCHIVE_BITMAP, 0))) {
+				al_set_new_bitmap_flags(flags);
+				data = CreateArchivedBitmap(entry, GetArchiveData(archive, entry));
+				al_set_new_bitmap_flags(previous);
+			}
+			return data;
+		case ASSET_SAMPLE:
+			if ((entry = FindArchiveEntry(archive, filename, ARCHIVE_SAMPLE, 0)) && entry->channels <= 2) {
+				data = al_create_sample((void*)GetArchiveData(archive, entry), entry->length, entry->rate, ALLEGRO_AUDIO_DEPTH_INT16,
+					(entry->channels == 1) ? ALLEGRO_CHANNEL_CONF_1 : ALLEGRO_CHANNEL_CONF_2, false);
+			}
+			return data;
+		case ASSET_FONT:
+		default:
+			if ((entry = FindArchiveEntry(archive, filename, ARCHIVE_FONT, flags))) {
+				int ranges[] = {entry->first, entry->last};
+				ALLEGRO_BITMAP* atlas;
+				al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
+				atlas = CreateArchivedBitmap(entry, GetArchiveData(archive, entry));
+				al_set_new_bitmap_flags(previous);
+				if (atlas) {
+					data = al_grab_font_from_bitmap(atlas, 1, ranges);
+					al_destroy_bitmap(atlas);
+				}
+			}
+			return data;
+	}
+}
+
+static void* Decode(struct AssetCache* cache, enum AssetType type, const char* filename, int flags) {
+	// Called without holding the lock.
+	void* data;
+	int previous;
+	if (cache->archive && filename && (data = DecodeArchived(cache->archive, type, filename, flags))) {
+		return data;
+	}
+	switch (type) {
+		case ASSET_BITMAP:
+			previous = al_get_new_bitmap_flags();
+			al_set_new_bitmap_flags(flags);
+			data = al_load_bitmap(filename);
+			al_set_new_bitmap_flags(previous);
+			return data;
+		case ASSET_SAMPLE:
+			return al_load_sample(filename);
+		case ASSET_FONT:
+		default:
+			return filename ? al_load_ttf_font(filename, flags, 0) : al_create_builtin_font();
+	}
+}
+
+static void FinishAsset(struct AssetCache* cache, struct Asset* asset, void* data, bool upload) {
+	asset->data = data;
+	asset->state = data ? ASSET_READY : ASSET_FAILED;
+	asset->size = data ? GetAssetSize(asset->type, data) : 0;
+	asset->upload = data && upload && asset->type == ASSET_BITMAP;
+	cache->bytes += asset->size;
+	al_broadcast_cond(cache->cond);
+}
+
+static void UploadAsset(struct Asset* asset) {
+	// Has to be called with a display, in the main thread.
+	int previous = al_get_new_bitmap_flags();
+	al_set_new_bitmap_flags(asset->flags & ~ALLEGRO_MEMORY_BITMAP);
+	al_convert_bitmap(asset->data);
+	al_set_new_bitmap_flags(previous);
+	asset->upload = false;
+}
+
+static struct Asset* NextQueued(struct AssetCache* cache) {
+	struct Asset* next = NULL;
+	int i;
+	for (i = 0; i < cache->count; i++) {
+		struct Asset* asset = cache->assets[i];
+		if (asset->state == ASSET_QUEUED && (!next || asset->priority > next->priority)) {
+			next = asset;
+		}
+	}
+	return next;
+}
+
+static void* AssetWorker(ALLEGRO_THREAD* thread, void* arg) {
+	struct AssetCache* cache = arg;
+	al_lock_mutex(cache->mutex);
+	while (true) {
+		struct Asset* asset = NextQueued(cache);
+		while (!asset && !cache->stop) {
+			al_wait_cond(cache->cond, cache->mutex);
+			asset = NextQueued(cache);
+		}
+		if (cache->stop) {
+			break;
+		}
+		asset->state = ASSET_LOADING;
+		al_unlock_mutex(cache->mutex);
+		void* data = Decode(cache, asset->type, asset->filename, (asset->type == ASSET_BITMAP) ? (asset->flags | ALLEGRO_MEMORY_BITMAP) : asset->flags);
+		al_lock_mutex(cache->mutex);
+		FinishAsset(cache, asset, data, true);
+		Evict(cache);
+	}
+	al_unlock_mutex(cache->mutex);
+	return NULL;
+}
+
+static void* Acquire(struct AssetCache* cache, enum AssetType type, const char* filename, int size) {
+	// Waits for the asset if a worker is decoding it already, or decodes it
+	// right away otherwise.
+	int flags = (type == ASSET_BITMAP) ? al_get_new_bitmap_flags() : size;
+	int key = (type == ASSET_BITMAP) ? KEY_FLAGS(flags) : flags;
+	struct Asset* asset;
+	void* data;
+
+	al_lock_mutex(cache->mutex);
+	asset = FindAsset(cache, type, filename, key);
+	if (!asset) {
+		asset = AddAsset(cache, type, filename, key);
+		asset->state = ASSET_QUEUED;
+	}
+	asset->references++;
+	asset->pinned = false;
+	while (asset->state == ASSET_LOADING) {
+		al_wait_cond(cache->cond, cache->mutex);
+	}
+	if (asset->state == ASSET_QUEUED || asset->state == ASSET_FAILED) {
+		asset->state = ASSET_LOADING;
+		al_unlock_mutex(cache->mutex);
+		data = Decode(cache, type, filename, flags);
+		al_lock_mutex(cache->mutex);
+		FinishAsset(cache, asset, data, false);
+	}
+	if (asset->upload && al_get_current_display()) {
+		UploadAsset(asset);
+	}
+	data = asset->data;
+	if (!data) {
+		asset->references--;
+	}
+	Evict(cache);
+	al_unlock_mutex(cache->mutex);
+	return data;
+}
+
+static void Prefetch(struct AssetCache* cache, enum AssetType type, const char* filename, enum AssetPriority priority) {
+	// Without any workers, the asset simply gets decoded once acquired.
+	int flags = (type == ASSET_BITMAP) ? KEY_FLAGS(al_get_new_bitmap_flags()) : 0;
+	al_lock_mutex(cache->mutex);
+	struct Asset* asset = FindAsset(cache, type, filename, flags);
+	if (!asset) {
+		asset = AddAsset(cache, type, filename, flags);
+		asset->state = ASSET_QUEUED;
+		asset->priority = priority;
+		asset->pinned = true;
+		al_broadcast_cond(cache->cond);
+	} else if (asset->state == ASSET_QUEUED && priority > asset->priority) {
+		asset->priority = priority;
+	}
+	al_unlock_mutex(cache->mutex);
+}
+
+struct AssetCache* CreateAssetCache(size_t budget, struct Archive* archive) {
+	// The archive is optional, and has to outlive the cache.
+	struct AssetCache* cache = calloc(1, sizeof(struct AssetCache));
+	int cores = al_get_cpu_count(), i;
+	cache->budget = budget;
+	cache->archive = archive;
+	cache->mutex = al_create_mutex();
+	cache->cond = al_create_cond();
+	// one core is left for the thread that's waiting for the assets
+	cache->workerCount = (cores > 2) ? cores - 1 : 1;
+	if (cache->workerCount > ASSET_MAX_WORKERS) {
+		cache->workerCount = ASSET_MAX_WORKERS;
+	}
+	for (i = 0; i < cache->workerCount; i++) {
+		cache->workers[i] = al_create_thread(AssetWorker, cache);
+		if (cache->workers[i]) {
+			al_start_thread(cache->workers[i]);
+		}
+	}
+	return cache;
+}
+
+void DestroyAssetCache(struct AssetCache* cache) {
+	int i;
+	al_lock_mutex(cache->mutex);
+	cache->stop = true;
+	al_broadcast_cond(cache->cond);
+	al_unlock_mutex(cache->mutex);
+	for (i = 0; i < cache->workerCount; i++) {
+		if (cache->workers[i]) {
+			al_destroy_thread(cache->workers[i]);
+		}
+	}
+	while (cache->count) {
+		RemoveAsset(cache, cache->count - 1);
+	}
+	al_destroy_cond(cache->cond);
+	al_destroy_mutex(cache->mutex);
+	free(cache->assets);
+	free(cache);
+}
+
+void PrefetchBitmap(struct AssetCache* cache, const char* filename, enum AssetPriority priority) {
+	// To be acquired with the same new bitmap flags later.
+	Prefetch(cache, ASSET_BITMAP, filename, priority);
+}
+
+void PrefetchSample(struct AssetCache* cache, const char* filename, enum AssetPriority priority) {
+	Prefetch(cache, ASSET_SAMPLE, filename, priority);
+}
+
+ALLEGRO_BITMAP* AcquireBitmap(struct AssetCache* cache, const char* filename) {
+	// Bitmaps loaded with different flags are cached separately. Ones that
+	// have been decoded by a worker stay in memory until uploaded, unless
+	// acquired from the main thread.
+	return Acquire(cache, ASSET_BITMAP, filename, 0);
+}
+
+ALLEGRO_SAMPLE* AcquireSample(struct AssetCache* cache, const char* filename) {
+	return Acquire(cache, ASSET_SAMPLE, filename, 0);
+}
+
+ALLEGRO_FONT* AcquireFont(struct AssetCache* cache, const char* filename, int size) {
+	// TTF fonts of different sizes are cached separately.
+	return Acquire(cache, ASSET_FONT, filename, size);
+}
+
+ALLEGRO_FONT* AcquireBuiltinFont(struct AssetCache* cache) {
+	return Acquire(cache, ASSET_FONT, NULL, 0);
+}
+
+void ReleaseAsset(struct AssetCache* cache, const void* data) {
+	// Every acquired asset has to be released once instead of destroyed.
+	int i;
+	if (!data) {
+		return;
+	}
+	al_lock_mutex(cache->mutex);
+	for (i = 0; i < cache->count; i++) {
+		struct Asset* asset = cache->assets[i];
+		if (asset->data == data && asset->references) {
+			asset->references--;
+			asset->used = ++cache->clock;
+			break;
+		}
+	}
+	Evict(cache);
+	al_unlock_mutex(cache->mutex);
+}
+
+void UploadAssets(struct AssetCache* cache) {
+	// Turns the bitmaps decoded by workers into textures, all at once. Has
+	// to be called from the main thread, e.g. in Gamestate_PostLoad.
+	int i;
+	al_lock_mutex(cache->mutex);
+	for (i = 0; i < cache->count; i++) {
+		if (cache->assets[i]->upload && cache->assets[i]->state == ASSET_READY) {
+			UploadAsset(cache->assets[i]);
+		}
+	}
+	Evict(cache);
+	al_unlock_mutex(cache->mutex);
+}
+
+void GetAssetStats(struct AssetCache* cache, struct AssetStats* stats) {
+	int i;
+	al_lock_mutex(cache->mutex);
+	stats->count = cache->count;
+	stats->used = 0;
+	for (i = 0; i < cache->count; i++) {
+		stats->used += cache->assets[i]->references > 0;
+	}
+	stats->bytes = cache->bytes;
+	stats->budget = cache->budget;
+	al_unlock_mutex(cache->mutex);
+}
@@ -0,0 +1,61 @@
+/*! \file assets.h
+ *  \brief Reference counted cache of bitmaps, samples and fonts shared by gamestates.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZJEDZTRAWKE2_ASSETS_H
+#define ZJEDZTRAWKE2_ASSETS_H
+
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_audio.h>
+#include <allegro5/allegro_font.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define ASSET_MAX_WORKERS 8
+
+enum AssetPriority {
+	// order in which prefetched assets get decoded
+	ASSET_PRIORITY_LOW,
+	ASSET_PRIORITY_NORMAL,
+	ASSET_PRIORITY_HIGH,
+};
+
+struct Archive;
+struct AssetCache;
+
+struct AssetStats {
+	int count; // assets in the cache
+	int used; // of them, acquired by someone
+	size_t bytes; // estimated size of the decoded data
+	size_t budget; // 0 when there's none
+};
+
+struct AssetCache* CreateAssetCache(size_t budget, struct Archive* archive);
+void DestroyAssetCache(struct AssetCache* cache);
+void PrefetchBitmap(struct AssetCache* cache, const char* filename, enum AssetPriority priority);
+void PrefetchSample(struct AssetCache* cache, const char* filename, enum AssetPriority priority);
+ALLEGRO_BITMAP* AcquireBitmap(struct AssetCache* cache, const char* filename);
+ALLEGRO_SAMPLE* AcquireSample(struct AssetCache* cache, const char* filename);
+ALLEGRO_FONT* AcquireFont(struct AssetCache* cache, const char* filename, int size);
+ALLEGRO_FONT* AcquireBuiltinFont(struct AssetCache* cache);
+void ReleaseAsset(struct AssetCache* cache, const void* asset);
+void UploadAssets(struct AssetCache* cache);
+void GetAssetStats(struct AssetCache* cache, struct AssetStats* stats);
+
+#endif
@@ -0,0 +1,506 @@
+/*! \file bench.c
+ *  \brief Benchmarks of the game's hot paths.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bot.h"
+#include "distance.h"
+#include "match.h"
+#include "maze.h"
+#include "stretch.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef BENCH_DRAWING
+#include <allegro5/allegro.h>
+#endif
+
+#define BENCH_MIN_TIME 0.005 // seconds per repetition, used to pick the iteration count
+
+/* Every benchmark is run in batches of iterations sized to take at least
+ * BENCH_MIN_TIME each: first `warmup` batches that aren't measured, then
+ * `repetitions` measured ones. The per-iteration time of each batch is one
+ * sample of the reported statistics. */
+
+struct Options {
+	int warmup, repetitions;
+	const char* filter;
+	bool verbose;
+};
+
+struct Benchmark {
+	const char* name;
+	int size;
+	void* (*setup)(int size);
+	void (*run)(void* state, int iterations);
+	void (*teardown)(void* state);
+};
+
+static double Now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Current resident set size in bytes; falls back to the peak where /proc isn't available. */
+static long ResidentSetSize(void) {
+	long pages = 0;
+	FILE* file = fopen("/proc/self/statm", "r");
+	if (file) {
+		if (fscanf(file, "%*s %ld", &pages) != 1) {
+			pages = 0;
+		}
+		fclose(file);
+	}
+	if (pages) {
+		return pages * sysconf(_SC_PAGESIZE);
+	}
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss * 1024L;
+}
+
+/* Maze generation and validation */
+
+static void* SetupSize(int size) {
+	int* state = malloc(sizeof(int));
+	*state = size;
+	return state;
+}
+
+static void RunGeneration(void* state, int iterations) {
+	int i, size = *(int*)state;
+	for (i = 0; i < iterations; i++) {
+		DestroyMaze(CreateMaze(size, size, i));
+	}
+}
+
+static void* SetupMaze(int size) {
+	return CreateMaze(size, size, 1);
+}
+
+static void TeardownMaze(void* state) {
+	DestroyMaze(state);
+}
+
+static void RunSolvable(void* state, int iterations) {
+	int i;
+	volatile bool solvable;
+	for (i = 0; i < iterations; i++) {
+		solvable = IsMazeSolvable(state);
+	}
+	(void)solvable;
+}
+
+static void RunDistance(void* state, int iterations) {
+	struct Maze* maze = state;
+	int i;
+	for (i = 0; i < iterations; i++) {
+		DestroyDistanceField(CreateDistanceField(maze, maze->xGrass, maze->yGrass));
+	}
+}
+
+/* Beat timeline */
+
+struct MatchBench {
+	struct Maze* maze;
+	struct MatchSession session;
+	int64_t clocks[MATCH_MAX_PLAYERS];
+	struct MatchSession snapshots[8];
+};
+
+static void* SetupMatch(int size) {
+	struct MatchBench* bench = calloc(1, sizeof(struct MatchBench));
+	int i;
+	bench->maze = CreateMaze(size, size, 1);
+	InitMatch(&bench->session, bench->maze, 2, MATCH_SAMPLE_RATE);
+	for (i = 0; i < 8; i++) {
+		bench->snapshots[i] = bench->session;
+	}
+	return bench;
+}
+
+static void TeardownMatch(void* state) {
+	struct MatchBench* bench = state;
+	DestroyMaze(bench->maze);
+	free(bench);
+}
+
+static void RunBeats(void* state, int iterations) {
+	// One logic frame at 60 FPS per iteration; beats are missed, penalized
+	// and recycled along the way.
+	struct MatchBench* bench = state;
+	int i, p;
+	for (i = 0; i < iterations; i++) {
+		for (p = 0; p < bench->session.players; p++) {
+			bench->clocks[p] += MATCH_SAMPLE_RATE / 60;
+		}
+		StepMatch(&bench->session, NULL, 0, bench->clocks, NULL);
+	}
+}
+
+static void RunJudgement(void* state, int iterations) {
+	// Presses against the wall right on the next beat, so the player stays
+	// in place and every press goes through the whole judgement.
+	struct MatchBench* bench = state;
+	struct MatchCues cues;
+	int i;
+	for (i = 0; i < iterations; i++) {
+		struct BeatQueue* queue = &bench->session.beats[0];
+		unsigned int slot = BeatSlot(queue, 0), j;
+		for (j = 0; j < queue->count; j++) {
+			slot = BeatSlot(queue, j);
+			if (queue->status[slot] == -1) {
+				break;
+			}
+		}
+		struct MatchInput input = {.player = 0, .direction = up};
+		input.clock = (int64_t)queue->beat[slot] * MATCH_SAMPLE_RATE * BEATS_PER_SECOND_DEN / BEATS_PER_SECOND_NUM + 1;
+		bench->clocks[0] = bench->clocks[1] = input.clock;
+		StepMatch(&bench->session, &input, 1, bench->clocks, &cues);
+	}
+}
+
+static void RunSnapshot(void* state, int iterations) {
+	// What a rollback costs apart from simulating again: the state of a
+	// frame gets saved, and an older one restored.
+	struct MatchBench* bench = state;
+	int i;
+	for (i = 0; i < iterations; i++) {
+		bench->snapshots[i & 7] = bench->session;
+		bench->session = bench->snapshots[(i + 1) & 7];
+	}
+}
+
+/* Bots */
+
+struct BotBench {
+	struct Maze* maze;
+	struct MatchSession session;
+	struct Bot bots[MATCH_MAX_PLAYERS];
+	int64_t clocks[MATCH_MAX_PLAYERS];
+};
+
+static void RestartBots(struct BotBench* bench) {
+	struct BotConfig config = {.jitter = 0.08f, .mistakes = 0.05f};
+	int p;
+	InitMatch(&bench->session, bench->maze, 2, MATCH_SAMPLE_RATE);
+	for (p = 0; p < bench->session.players; p++) {
+		InitBot(&bench->bots[p], p, &config, p + 1);
+		bench->clocks[p] = 0;
+	}
+}
+
+static void* SetupBots(int size) {
+	struct BotBench* bench = calloc(1, sizeof(struct BotBench));
+	bench->maze = CreateMaze(size, size, 1);
+	bench->maze->distance = CreateDistanceField(bench->maze, bench->maze->xGrass, bench->maze->yGrass);
+	RestartBots(bench);
+	return bench;
+}
+
+static void TeardownBots(void* state) {
+	struct BotBench* bench = state;
+	DestroyMaze(bench->maze);
+	free(bench);
+}
+
+static void RunBots(void* state, int iterations) {
+	// One logic frame at 60 FPS of a match between two bots, including their
+	// presses getting judged; the match starts over once someone wins.
+	struct BotBench* bench = state;
+	struct MatchInput input;
+	int i, p;
+	for (i = 0; i < iterations; i++) {
+		if (bench->session.ended) {
+			RestartBots(bench);
+		}
+		for (p = 0; p < bench->session.players; p++) {
+			bench->clocks[p] += MATCH_SAMPLE_RATE / 60;
+			while (RunBot(&bench->bots[p], &bench->session, bench->clocks[p], &input)) {
+				StepMatch(&bench->session, &input, 1, NULL, NULL);
+			}
+		}
+		StepMatch(&bench->session, NULL, 0, bench->clocks, NULL);
+	}
+}
+
+/* Music tempo */
+
+#define STRETCH_BENCH_RATE 44100 // of the music
+#define STRETCH_BENCH_LENGTH (STRETCH_BENCH_RATE * 4)
+
+struct StretchBench {
+	int16_t source[STRETCH_BENCH_LENGTH];
+	struct Stretch tracks[MATCH_MAX_PLAYERS];
+	float output[STRETCH_BENCH_RATE];
+	int count;
+};
+
+static void ReadStretchSource(void* user, size_t start, int16_t* frames, int count) {
+	const int16_t* source = user;
+	while (count > 0) {
+		int run = STRETCH_BENCH_LENGTH - start;
+		run = (run < count) ? run : count;
+		memcpy(frames, source + start, run * sizeof(int16_t));
+		frames += run;
+		count -= run;
+		start = 0;
+	}
+}
+
+static void* SetupStretch(int players) {
+	// A chord that isn't periodic within the search window, sped up the way
+	// a match well under way does it.
+	struct StretchBench* bench = calloc(1, sizeof(struct StretchBench));
+	int i;
+	for (i = 0; i < STRETCH_BENCH_LENGTH; i++) {
+		double t = i / (double)STRETCH_BENCH_RATE;
+		bench->source[i] = 8000 * (sin(2 * M_PI * 220 * t) + sin(2 * M_PI * 277.2 * t) + sin(2 * M_PI * 329.6 * t));
+	}
+	bench->count = players;
+	for (i = 0; i < players; i++) {
+		InitStretch(&bench->tracks[i], ReadStretchSource, bench->source, STRETCH_BENCH_LENGTH, 1);
+		SetStretchSpeed(&bench->tracks[i], 1.2 + 0.1 * i);
+	}
+	return bench;
+}
+
+static void RunStretch(void* state, int iterations) {
+	// One iteration is a second of audio for every player.
+	struct StretchBench* bench = state;
+	int i, j;
+	for (i = 0; i < iterations; i++) {
+		for (j = 0; j < bench->count; j++) {
+			RenderStretch(&bench->tracks[j], bench->output, STRETCH_BENCH_RATE);
+		}
+	}
+}
+
+#ifdef BENCH_DRAWING
+/* Drawing into memory bitmaps, with the same calls as DrawMap and
+ * DrawAllPulse in the game gamestate use. */
+
+struct DrawBench {
+	ALLEGRO_BITMAP *target, *atlas, *tile, *grass, *pulse, *layer;
+	struct Maze* maze;
+};
+
+static void* SetupDrawing(int size) {
+	struct DrawBench* bench = calloc(1, sizeof(struct DrawBench));
+	int x, y;
+	al_init();
+	al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
+	bench->target = al_create_bitmap(320, 180);
+	bench->atlas = al_create_bitmap(64, 68);
+	bench->tile = al_create_sub_bitmap(bench->atlas, 0, 0, 16, 16);
+	bench->grass = al_create_sub_bitmap(bench->atlas, 16, 0, 16, 16);
+	bench->pulse = al_create_sub_bitmap(bench->atlas, 0, 48, 20, 20);
+	bench->maze = CreateMaze(size, size, 1);
+	bench->layer = al_create_bitmap(size * 16, size * 16);
+	al_set_target_bitmap(bench->layer);
+	for (y = 0; y < size; y++) {
+		for (x = 0; x < size; x++) {
+			if (!IsMazeWall(bench->maze, x, y)) {
+				al_draw_bitmap(bench->tile, x * 16, y * 16, 0);
+			}
+		}
+	}
+	al_set_target_bitmap(bench->target);
+	return bench;
+}
+
+static void TeardownDrawing(void* state) {
+	struct DrawBench* bench = state;
+	al_destroy_bitmap(bench->layer);
+	al_destroy_bitmap(bench->pulse);
+	al_destroy_bitmap(bench->grass);
+	al_destroy_bitmap(bench->tile);
+	al_destroy_bitmap(bench->atlas);
+	al_destroy_bitmap(bench->target);
+	DestroyMaze(bench->maze);
+	free(bench);
+}
+
+static void RunMapTiles(void* state, int iterations) {
+	struct DrawBench* bench = state;
+	int i, x, y;
+	for (i = 0; i < iterations; i++) {
+		int px = 1 + i % (bench->maze->width - 2), py = 1 + (i / 7) % (bench->maze->height - 2);
+		al_hold_bitmap_drawing(true);
+		for (x = -3; x < 3; x++) {
+			for (y = -3; y < 3; y++) {
+				if (!IsInMaze(bench->maze, px + x, py + y)) {
+					continue;
+				}
+				if (!IsMazeWall(bench->maze, px + x, py + y)) {
+					al_draw_bitmap_region(bench->tile, 0, 0, 16, 16, 80 + x * 16, 60 + y * 16, 0);
+				}
+				if (px + x == bench->maze->xGrass && py + y == bench->maze->yGrass) {
+					al_draw_bitmap_region(bench->grass, 0, 0, 16, 16, 80 + x * 16, 60 + y * 16, 0);
+				}
+			}
+		}
+		al_hold_bitmap_drawing(false);
+	}
+}
+
+static void RunMapLayer(void* state, int iterations) {
+	struct DrawBench* bench = state;
+	int i;
+	for (i = 0; i < iterations; i++) {
+		int px = 3 + i % (bench->maze->width - 6), py = 3 + (i / 7) % (bench->maze->height - 6);
+		al_draw_bitmap_region(bench->layer, (px - 3) * 16, (py - 3) * 16, 96, 96, 32, 12, 0);
+	}
+}
+
+static void RunPulses(void* state, int iterations) {
+	struct DrawBench* bench = state;
+	int i, j;
+	for (i = 0; i < iterations; i++) {
+		al_hold_bitmap_drawing(true);
+		for (j = 0; j < BEAT_QUEUE_SIZE; j++) {
+			al_draw_bitmap_region(bench->pulse, 0, 0, 20, 20, 135, 80 + (j - (i % 60) / 60.0) * 40, 0);
+		}
+		al_hold_bitmap_drawing(false);
+	}
+}
+#endif
+
+static const struct Benchmark benchmarks[] = {
+	{"maze_generate", 20, SetupSize, RunGeneration, free},
+	{"maze_generate", 64, SetupSize, RunGeneration, free},
+	{"maze_generate", 512, SetupSize, RunGeneration, free},
+	{"maze_generate", 4096, SetupSize, RunGeneration, free},
+	{"maze_solvable", 64, SetupMaze, RunSolvable, TeardownMaze},
+	{"maze_solvable", 512, SetupMaze, RunSolvable, TeardownMaze},
+	{"distance_field", 64, SetupMaze, RunDistance, TeardownMaze},
+	{"distance_field", 512, SetupMaze, RunDistance, TeardownMaze},
+	{"beat_update", MAZE_WIDTH, SetupMatch, RunBeats, TeardownMatch},
+	{"judgement", MAZE_WIDTH, SetupMatch, RunJudgement, TeardownMatch},
+	{"match_snapshot", MAZE_WIDTH, SetupMatch, RunSnapshot, TeardownMatch},
+	{"bot_frame", MAZE_WIDTH, SetupBots, RunBots, TeardownBots},
+	{"music_stretch_second", 1, SetupStretch, RunStretch, free},
+	{"music_stretch_second", 2, SetupStretch, RunStretch, free},
+	{"music_stretch_second", 4, SetupStretch, RunStretch, free},
+#ifdef BENCH_DRAWING
+	{"draw_map_tiles", MAZE_WIDTH, SetupDrawing, RunMapTiles, TeardownDrawing},
+	{"draw_map_layer", MAZE_WIDTH, SetupDrawing, RunMapLayer, TeardownDrawing},
+	{"draw_pulses", MAZE_WIDTH, SetupDrawing, RunPulses, TeardownDrawing},
+#endif
+};
+
+static int CompareDoubles(const void* a, const void* b) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static void RunBenchmark(const struct Benchmark* benchmark, const struct Options* options, bool first) {
+	long memory = ResidentSetSize();
+	void* state = benchmark->setup(benchmark->size);
+	double* samples = malloc(options->repetitions * sizeof(double));
+	double start, elapsed = 0, mean = 0, variance = 0;
+	int iterations = 1, i;
+
+	// find the batch size
+	while (true) {
+		start = Now();
+		benchmark->run(state, iterations);
+		elapsed = Now() - start;
+		if (elapsed >= BENCH_MIN_TIME || iterations >= (1 << 24)) {
+			break;
+		}
+		iterations *= 2;
+	}
+	for (i = 0; i < options->warmup; i++) {
+		benchmark->run(state, iterations);
+	}
+	for (i = 0; i < options->repetitions; i++) {
+		start = Now();
+		benchmark->run(state, iterations);
+		samples[i] = (Now() - start) * 1e9 / iterations;
+		mean += samples[i];
+	}
+	mean /= options->repetitions;
+	for (i = 0; i < options->repetitions; i++) {
+		variance += (samples[i] - mean) * (samples[i] - mean);
+	}
+	variance /= (options->repetitions > 1) ? options->repetitions - 1 : 1;
+	memory = ResidentSetSize() - memory;
+	qsort(samples, options->repetitions, sizeof(double), CompareDoubles);
+
+	printf("%s\n    {\"name\": \"%s\", \"size\": %d, \"iterations\": %d, \"mean_ns\": %.1f, \"variance_ns2\": %.1f, "
+				 "\"stddev_ns\": %.1f, \"min_ns\": %.1f, \"median_ns\": %.1f, \"max_ns\": %.1f, \"rss_delta_bytes\": %ld}",
+		first ? "" : ",", benchmark->name, benchmark->size, iterations, mean, variance, sqrt(variance),
+		samples[0], samples[options->repetitions / 2], samples[options->repetitions - 1], memory);
+	fflush(stdout);
+	if (options->verbose) {
+		fprintf(stderr, "%-16s %5d  %12.1f ns  +-%5.1f%%\n", benchmark->name, benchmark->size, mean, mean > 0 ? sqrt(variance) / mean * 100 : 0);
+	}
+
+	benchmark->teardown(state);
+	free(samples);
+}
+
+static void Usage(const char* name) {
+	fprintf(stderr, "Usage: %s [-w warmup] [-r repetitions] [-f filter] [-v]\n", name);
+	fprintf(stderr, "  -w  unmeasured batches before each benchmark (default 3)\n");
+	fprintf(stderr, "  -r  measured batches of each benchmark (default 20)\n");
+	fprintf(stderr, "  -f  only run benchmarks whose name contains given text\n");
+	fprintf(stderr, "  -v  print a summary to stderr as well\n");
+}
+
+int main(int argc, char** argv) {
+	struct Options options = {.warmup = 3, .repetitions = 20};
+	int i;
+	bool first = true;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-v")) {
+			options.verbose = true;
+		} else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+			options.warmup = strtol(argv[++i], NULL, 10);
+		} else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+			options.repetitions = strtol(argv[++i], NULL, 10);
+		} else if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+			options.filter = argv[++i];
+		} else {
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+	if (options.repetitions < 1) {
+		options.repetitions = 1;
+	}
+
+	// Results are written as JSON to stdout, to be compared between builds.
+	printf("{\n  \"warmup\": %d,\n  \"repetitions\": %d,\n  \"min_time_s\": %g,\n  \"benchmarks\": [", options.warmup, options.repetitions, BENCH_MIN_TIME);
+	for (i = 0; i < (int)(sizeof(benchmarks) / sizeof(benchmarks[0])); i++) {
+		if (options.filter && !strstr(benchmarks[i].name, options.filter)) {
+			continue;
+		}
+		RunBenchmark(&benchmarks[i], &options, first);
+		first = false;
+	}
+	printf("\n  ]\n}\n");
+	return 0;
+}
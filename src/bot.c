@@ -0,0 +1,128 @@
+/*! \file bot.c
+ *  \brief Computer-controlled player, independent from Allegro.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bot.h"
+#include "distance.h"
+#include <math.h>
+
+static enum direction TurnRight(enum direction direction) {
+	static const enum direction turns[] = {[up] = right, [right] = down, [down] = left, [left] = up};
+	return turns[direction];
+}
+
+static enum direction TurnLeft(enum direction direction) {
+	static const enum direction turns[] = {[up] = left, [left] = down, [down] = right, [right] = up};
+	return turns[direction];
+}
+
+static bool IsOpen(const struct Maze* maze, int x, int y, enum direction direction) {
+	switch (direction) {
+		case up:
+			y--;
+			break;
+		case down:
+			y++;
+			break;
+		case left:
+			x--;
+			break;
+		case right:
+			x++;
+			break;
+	}
+	return !IsMazeWall(maze, x, y);
+}
+
+enum direction FollowWall(enum direction* heading, const struct Maze* maze, int x, int y) {
+	// right hand rule; the heading only changes when the move succeeds
+	enum direction candidates[] = {TurnRight(*heading), *heading, TurnLeft(*heading), TurnRight(TurnRight(*heading))};
+	int i;
+	for (i = 0; i < 4; i++) {
+		if (IsOpen(maze, x, y, candidates[i])) {
+			*heading = candidates[i];
+			return candidates[i];
+		}
+	}
+	return *heading;
+}
+
+static float RandomGaussian(struct Rng* rng) {
+	// Box-Muller, only one of the pair is used
+	float u = RandomFloat(rng), v = RandomFloat(rng);
+	if (u < 1e-7f) {
+		u = 1e-7f;
+	}
+	return sqrtf(-2.0f * logf(u)) * cosf(2.0f * (float)M_PI * v);
+}
+
+static enum direction ChooseDirection(struct Bot* bot, const struct MatchSession* session) {
+	const struct Maze* maze = session->maze;
+	int x = session->x[bot->player], y = session->y[bot->player];
+	enum direction direction;
+	int dx = 0, dy = 0;
+	if (maze->distance && GetBestMove(maze->distance, x, y, &dx, &dy)) {
+		direction = (dx > 0) ? right : (dx < 0) ? left : (dy > 0) ? down : up;
+	} else {
+		direction = FollowWall(&bot->heading, maze, x, y);
+	}
+	if (bot->config.mistakes > 0 && RandomFloat(&bot->rng) < bot->config.mistakes) {
+		direction = (direction + 1 + RandomBelow(&bot->rng, 3)) % 4;
+	}
+	return direction;
+}
+
+void InitBot(struct Bot* bot, int player, const struct BotConfig* config, uint32_t seed) {
+	bot->player = player;
+	bot->config = *config;
+	SeedRandom(&bot->rng, seed);
+	bot->beat = -1;
+	bot->pressed = -1;
+	bot->offset = 0;
+	bot->heading = down;
+}
+
+bool RunBot(struct Bot* bot, const struct MatchSession* session, int64_t clock, struct MatchInput* input) {
+	// Looks for the next beat that hasn't been judged yet, picks a timing
+	// error for it and presses once its clock gets there. The press is
+	// timestamped with the planned clock, so the outcome doesn't depend on
+	// how often the bot gets to run.
+	const struct BeatQueue* queue = &session->beats[bot->player];
+	unsigned int i;
+	for (i = 0; i < queue->count; i++) {
+		unsigned int slot = BeatSlot(queue, i);
+		float offset = GetBeatOffset(session, queue->beat[slot], clock);
+		if (queue->status[slot] != -1 || offset <= -0.25f || queue->id[slot] == bot->pressed) {
+			continue;
+		}
+		if (queue->id[slot] != bot->beat) {
+			bot->beat = queue->id[slot];
+			bot->offset = bot->config.bias + bot->config.jitter * RandomGaussian(&bot->rng);
+		}
+		if (offset > -bot->offset) {
+			return false;
+		}
+		bot->pressed = bot->beat;
+		input->player = bot->player;
+		input->clock = GetBeatClock(session, queue->beat[slot], bot->offset);
+		input->direction = ChooseDirection(bot, session);
+		return true;
+	}
+	return false;
+}
@@ -0,0 +1,50 @@
+/*! \file bot.h
+ *  \brief Computer-controlled player, independent from Allegro.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZJEDZTRAWKE2_BOT_H
+#define ZJEDZTRAWKE2_BOT_H
+
+#include "match.h"
+#include "rng.h"
+
+struct BotConfig {
+	float bias; // average timing error in beats, positive is late
+	float jitter; // standard deviation of the timing error in beats
+	float mistakes; // chance of pressing a wrong direction
+};
+
+struct Bot {
+	// Follows the distance field to the grass, or the right hand wall when
+	// there's none. Deciding costs a scan of the beat queue and a lookup of
+	// four neighbours, so it's cheap enough to run every frame.
+	int player;
+	struct BotConfig config;
+	struct Rng rng;
+	int beat; // id of the beat the current offset was planned for
+	float offset;
+	int pressed; // id of the last beat pressed for, judged or not
+	enum direction heading;
+};
+
+void InitBot(struct Bot* bot, int player, const struct BotConfig* config, uint32_t seed);
+bool RunBot(struct Bot* bot, const struct MatchSession* session, int64_t clock, struct MatchInput* input);
+enum direction FollowWall(enum direction* heading, const struct Maze* maze, int x, int y);
+
+#endif
@@ -19,23 +19,45 @@
  */
 
 #include "common.h"
+#include "archive.h"
+#include "assets.h"
+#include "match.h"
+#include "mazepool.h"
+#include "profiler.h"
+#include "speech.h"
 #include <libsuperderpy.h>
 
+#ifndef SAMPLERATE_DEFAULT
+#define SAMPLERATE_DEFAULT "48000"
+#endif
+
 void Speak(struct Game* game, char* text) {
 	if (!game->config.voice) {
 		return;
 	}
-#ifndef ALLEGRO_UNIX
-	return;
-#else
-	char* buffer = malloc(255 * sizeof(char));
-	snprintf(buffer, 255, "espeak \"%s\"&", text);
-	system(buffer);
-	free(buffer);
-#endif
+	Say(game->data->speech, text);
+}
+
+void PrerenderSpeak(struct Game* game, char** texts, int count) {
+	// Nothing is rendered while the voices are off; call again once they
+	// get turned on.
+	if (!game->config.voice) {
+		return;
+	}
+	PrerenderSpeech(game->data->speech, texts, count);
+}
+
+void GlobalPostLogic(struct Game* game, double delta) {
+	// speech gets said from here when it has no thread of its own
+	if (game->data) {
+		UpdateSpeech(game->data->speech);
+	}
+	ProfilerPostLogic(game, delta);
 }
 
 bool GlobalEventHandler(struct Game* game, ALLEGRO_EVENT* ev) {
+	ProfileEvent(game);
+
 	if ((ev->type == ALLEGRO_EVENT_KEY_DOWN) && (ev->keyboard.keycode == ALLEGRO_KEY_M)) {
 		ToggleMute(game);
 		al_set_mixer_gain(game->data->audio.mixer, game->config.mute ? 0.0 : 1.0);
@@ -45,6 +67,10 @@ bool GlobalEventHandler(struct Game* game, ALLEGRO_EVENT* ev) {
 		ToggleFullscreen(game);
 	}
 
+	if ((ev->type == ALLEGRO_EVENT_KEY_DOWN) && (ev->keyboard.keycode == ALLEGRO_KEY_F3) && game->data) {
+		ToggleProfiler(game->data->profiler);
+	}
+
 	if (ev->type == ALLEGRO_EVENT_TOUCH_BEGIN) {
 		game->data->touch = true;
 	}
@@ -57,10 +83,52 @@ bool GlobalEventHandler(struct Game* game, ALLEGRO_EVENT* ev) {
 	return false;
 }
 
+static int ClampMazeSize(int size) {
+	if (size < MAZE_MIN_SIZE) {
+		return MAZE_MIN_SIZE;
+	}
+	if (size > MAZE_MAX_SIZE) {
+		return MAZE_MAX_SIZE;
+	}
+	return size;
+}
+
+static int GetMazePoolSize(int width, int height) {
+	// Pooled mazes wait with their distance fields, two bytes a cell, so
+	// large ones are kept fewer of. One is always prepared in advance.
+	int size = MAZE_POOL_BUDGET / ((size_t)width * height * sizeof(uint16_t));
+	return (size < 1) ? 1 : (size > MAZE_POOL_SIZE) ? MAZE_POOL_SIZE : size;
+}
+
+static struct Archive* OpenAssetArchive(struct Game* game) {
+	// Installed next to the assets it was packed from, or still in the
+	// build tree; only there if the build packed it at all.
+	ALLEGRO_PATH* path = al_create_path(GetDataFilePath(game, "button.flac"));
+	struct Archive* archive;
+	al_set_path_filename(path, "assets.pak");
+	archive = OpenArchive(al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP));
+	al_destroy_path(path);
+#ifdef ASSET_ARCHIVE_BUILD_PATH
+	if (!archive) {
+		archive = OpenArchive(ASSET_ARCHIVE_BUILD_PATH);
+	}
+#endif
+	if (archive) {
+		PrintConsole(game, "Using packed assets (%d).", archive->header->count);
+	}
+	return archive;
+}
+
 struct CommonResources* CreateGameData(struct Game* game) {
 	struct CommonResources* data = calloc(1, sizeof(struct CommonResources));
+	data->profiler = CreateProfiler(game);
+	data->archive = OpenAssetArchive(game);
+	// budget for assets no gamestate uses at the moment, in megabytes
+	data->assets = CreateAssetCache(strtol(GetConfigOptionDefault(game, "ZjedzTrawke2", "assetbudget", "64"), NULL, 10) * 1024 * 1024, data->archive);
 
-	int samplerate = strtol(GetConfigOptionDefault(game, "SuperDerpy", "samplerate", "48000"), NULL, 10);
+	// The default comes from ZJEDZTRAWKE2_SAMPLERATE in CMake, which the
+	// packed sounds are resampled to as well.
+	int samplerate = strtol(GetConfigOptionDefault(game, "SuperDerpy", "samplerate", SAMPLERATE_DEFAULT), NULL, 10);
 	data->audio.v = al_create_voice(samplerate, al_get_voice_depth(game->audio.v), ALLEGRO_CHANNEL_CONF_2);
 	ALLEGRO_VOICE* voice = data->audio.v ? data->audio.v : game->audio.v;
 	data->audio.mixer = al_create_mixer(samplerate, ALLEGRO_AUDIO_DEPTH_FLOAT32, ALLEGRO_CHANNEL_CONF_2);
@@ -76,22 +144,67 @@ struct CommonResources* CreateGameData(struct Game* game) {
 	al_set_mixer_gain(data->audio.voice, game->config.voice / 10.0);
 	al_set_mixer_gain(data->audio.mixer, game->config.mute ? 0.0 : 1.0);
 
-	data->button_sample = al_load_sample(GetDataFilePath(game, "button.flac"));
+	data->speech = CreateSpeech(game, data->audio.voice);
+
+	data->button_sample = AcquireSample(data->assets, GetDataFilePath(game, "button.flac"));
 	data->button = al_create_sample_instance(data->button_sample);
 	al_attach_sample_instance_to_mixer(data->button, game->audio.fx);
 
 	data->pan = strtol(GetConfigOptionDefault(game, "ZjedzTrawke2", "pan", "1"), NULL, 10);
 
+	// maze size can be given either as "N" or "WxH"
+	char* end;
+	data->mazeWidth = strtol(GetConfigOptionDefault(game, "ZjedzTrawke2", "size", "20"), &end, 10);
+	data->mazeHeight = (*end == 'x') ? strtol(end + 1, NULL, 10) : data->mazeWidth;
+	data->mazeWidth = ClampMazeSize(data->mazeWidth);
+	data->mazeHeight = ClampMazeSize(data->mazeHeight);
+	data->players = strtol(GetConfigOptionDefault(game, "ZjedzTrawke2", "players", "2"), NULL, 10);
+	if (data->players < 1 || data->players > MATCH_MAX_PLAYERS) {
+		data->players = 2;
+	}
+	data->mazes = CreateMazePool(GetMazePoolSize(data->mazeWidth, data->mazeHeight), data->mazeWidth, data->mazeHeight, time(NULL));
+
 	return data;
 }
 
+void PrefetchGamestates(struct Game* game) {
+	// Gets the assets of the menu and the game decoded while the intros
+	// play, so loading them is down to uploading what's already there.
+	// Has to match what they acquire, bitmap flags included.
+	int flags = al_get_new_bitmap_flags();
+	struct AssetCache* assets = game->data->assets;
+
+	al_set_new_bitmap_flags(flags ^ ALLEGRO_MAG_LINEAR);
+	PrefetchBitmap(assets, GetDataFilePath(game, "logo.png"), ASSET_PRIORITY_HIGH);
+	PrefetchSample(assets, GetDataFilePath(game, "menu.flac"), ASSET_PRIORITY_HIGH);
+
+	al_set_new_bitmap_flags(flags & ~ALLEGRO_MAG_LINEAR);
+	PrefetchBitmap(assets, GetDataFilePath(game, "Sprites/tile.png"), ASSET_PRIORITY_NORMAL);
+	PrefetchBitmap(assets, GetDataFilePath(game, "Sprites/grass.png"), ASSET_PRIORITY_NORMAL);
+	PrefetchBitmap(assets, GetDataFilePath(game, "Sprites/swinka_kolor.png"), ASSET_PRIORITY_NORMAL);
+	PrefetchBitmap(assets, GetDataFilePath(game, "Sprites/swinka_czb.png"), ASSET_PRIORITY_NORMAL);
+	PrefetchBitmap(assets, GetDataFilePath(game, "Sprites/rythmPulse.png"), ASSET_PRIORITY_NORMAL);
+	PrefetchBitmap(assets, GetDataFilePath(game, "Sprites/line.png"), ASSET_PRIORITY_NORMAL);
+	PrefetchSample(assets, GetDataFilePath(game, "ding.flac"), ASSET_PRIORITY_NORMAL);
+	PrefetchSample(assets, GetDataFilePath(game, "efekt.flac"), ASSET_PRIORITY_NORMAL);
+	PrefetchSample(assets, GetDataFilePath(game, "tada.flac"), ASSET_PRIORITY_LOW);
+	PrefetchSample(assets, GetDataFilePath(game, "no.flac"), ASSET_PRIORITY_LOW);
+
+	al_set_new_bitmap_flags(flags);
+}
+
 void DestroyGameData(struct Game* game) {
+	DestroyMazePool(game->data->mazes);
+	DestroyProfiler(game->data->profiler);
 	al_destroy_sample_instance(game->data->button);
-	al_destroy_sample(game->data->button_sample);
+	ReleaseAsset(game->data->assets, game->data->button_sample);
+	DestroySpeech(game->data->speech);
 	al_destroy_mixer(game->data->audio.fx);
 	al_destroy_mixer(game->data->audio.music);
 	al_destroy_mixer(game->data->audio.voice);
 	al_destroy_mixer(game->data->audio.mixer);
 	al_destroy_voice(game->data->audio.v);
+	DestroyAssetCache(game->data->assets);
+	CloseArchive(game->data->archive);
 	free(game->data);
 }
@@ -18,6 +18,12 @@
 #define LIBSUPERDERPY_DATA_TYPE struct CommonResources
 #include <libsuperderpy.h>
 
+struct Archive;
+struct AssetCache;
+struct MazePool;
+struct Profiler;
+struct Speech;
+
 struct CommonResources {
 	// Fill in with common data accessible from all gamestates.
 	struct {
@@ -28,9 +34,20 @@ struct CommonResources {
 	ALLEGRO_SAMPLE* button_sample;
 	ALLEGRO_SAMPLE_INSTANCE* button;
 	bool pan;
+	struct MazePool* mazes;
+	int mazeWidth, mazeHeight;
+	bool endless;
+	int players;
+	struct Profiler* profiler;
+	struct AssetCache* assets;
+	struct Archive* archive;
+	struct Speech* speech;
 };
 
 void Speak(struct Game* game, char* text);
+void PrerenderSpeak(struct Game* game, char** texts, int count);
 struct CommonResources* CreateGameData(struct Game* game);
 void DestroyGameData(struct Game* game);
+void PrefetchGamestates(struct Game* game);
 bool GlobalEventHandler(struct Game* game, ALLEGRO_EVENT* ev);
+void GlobalPostLogic(struct Game* game, double delta);
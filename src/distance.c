@@ -0,0 +1,166 @@
+/*! \file distance.c
+ *  \brief Distance to the goal for every cell of a maze.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "distance.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const int dx[] = {0, 0, -1, 1}, dy[] = {-1, 1, 0, 0};
+
+struct Queue {
+	// growable ring buffer of packed cell coordinates
+	uint32_t* cells;
+	unsigned int capacity, head, count;
+};
+
+static void Push(struct Queue* queue, int x, int y) {
+	if (queue->count == queue->capacity) {
+		unsigned int i;
+		uint32_t* cells = malloc(queue->capacity * 2 * sizeof(uint32_t));
+		for (i = 0; i < queue->count; i++) {
+			cells[i] = queue->cells[(queue->head + i) & (queue->capacity - 1)];
+		}
+		free(queue->cells);
+		queue->cells = cells;
+		queue->capacity *= 2;
+		queue->head = 0;
+	}
+	queue->cells[(queue->head + queue->count++) & (queue->capacity - 1)] = ((uint32_t)y << 16) | (uint32_t)x;
+}
+
+static void Pop(struct Queue* queue, int* x, int* y) {
+	uint32_t cell = queue->cells[queue->head];
+	queue->head = (queue->head + 1) & (queue->capacity - 1);
+	queue->count--;
+	*x = cell & 0xffff;
+	*y = cell >> 16;
+}
+
+static uint16_t* GetCell(struct DistanceField* field, int x, int y) {
+	return &field->cells[((y / MAZE_BLOCK) * field->blocksPerRow + x / MAZE_BLOCK) * MAZE_BLOCK * MAZE_BLOCK + (y % MAZE_BLOCK) * MAZE_BLOCK + x % MAZE_BLOCK];
+}
+
+/* Breadth-first search from the cells already in the queue, lowering the
+ * distance of every cell it can improve. */
+static void Propagate(struct DistanceField* field, const struct Maze* maze, struct Queue* queue) {
+	while (queue->count) {
+		int x, y, i;
+		Pop(queue, &x, &y);
+		uint16_t next = *GetCell(field, x, y);
+		next += (next < DISTANCE_FAR) ? 1 : 0;
+		for (i = 0; i < 4; i++) {
+			int nx = x + dx[i], ny = y + dy[i];
+			if (IsMazeWall(maze, nx, ny)) {
+				continue;
+			}
+			uint16_t* cell = GetCell(field, nx, ny);
+			if (*cell > next) {
+				*cell = next;
+				Push(queue, nx, ny);
+			}
+		}
+	}
+}
+
+static void InitQueue(struct Queue* queue) {
+	queue->capacity = 1024; // must be a power of two
+	queue->cells = malloc(queue->capacity * sizeof(uint32_t));
+	queue->head = 0;
+	queue->count = 0;
+}
+
+struct DistanceField* CreateDistanceField(const struct Maze* maze, int xGoal, int yGoal) {
+	struct DistanceField* field = calloc(1, sizeof(struct DistanceField));
+	field->width = maze->width;
+	field->height = maze->height;
+	field->blocksPerRow = maze->blocksPerRow;
+	field->cells = malloc((size_t)maze->blocksPerRow * maze->blockRows * MAZE_BLOCK * MAZE_BLOCK * sizeof(uint16_t));
+	SetDistanceGoal(field, maze, xGoal, yGoal);
+	return field;
+}
+
+void DestroyDistanceField(struct DistanceField* field) {
+	free(field->cells);
+	free(field);
+}
+
+/* Recompute the whole field for a new goal. */
+void SetDistanceGoal(struct DistanceField* field, const struct Maze* maze, int xGoal, int yGoal) {
+	struct Queue queue;
+	field->xGoal = xGoal;
+	field->yGoal = yGoal;
+	memset(field->cells, 0xff, (size_t)field->blocksPerRow * maze->blockRows * MAZE_BLOCK * MAZE_BLOCK * sizeof(uint16_t));
+	if (IsMazeWall(maze, xGoal, yGoal)) {
+		return;
+	}
+	InitQueue(&queue);
+	*GetCell(field, xGoal, yGoal) = 0;
+	Push(&queue, xGoal, yGoal);
+	Propagate(field, maze, &queue);
+	free(queue.cells);
+}
+
+/* Update the field after the cell at x, y has changed. Opening a cell only
+ * needs the distances it shortens to be pushed outwards from it; closing
+ * one may lengthen paths anywhere behind it, so that falls back to a full
+ * recomputation. */
+void UpdateDistanceField(struct DistanceField* field, const struct Maze* maze, int x, int y) {
+	struct Queue queue;
+	int i;
+	if (IsMazeWall(maze, x, y)) {
+		if (*GetCell(field, x, y) != UINT16_MAX) {
+			SetDistanceGoal(field, maze, field->xGoal, field->yGoal);
+		}
+		return;
+	}
+	uint16_t* cell = GetCell(field, x, y);
+	for (i = 0; i < 4; i++) {
+		uint32_t distance = GetDistance(field, x + dx[i], y + dy[i]);
+		if (distance < DISTANCE_FAR && distance + 1 < *cell) {
+			*cell = distance + 1;
+		} else if (distance == DISTANCE_FAR && *cell == UINT16_MAX) {
+			*cell = DISTANCE_FAR;
+		}
+	}
+	if (*cell == UINT16_MAX) {
+		return;
+	}
+	InitQueue(&queue);
+	Push(&queue, x, y);
+	Propagate(field, maze, &queue);
+	free(queue.cells);
+}
+
+/* Direction of the neighbour closest to the goal. */
+bool GetBestMove(const struct DistanceField* field, int x, int y, int* mx, int* my) {
+	uint32_t best = GetDistance(field, x, y);
+	int i;
+	bool found = false;
+	for (i = 0; i < 4; i++) {
+		uint32_t distance = GetDistance(field, x + dx[i], y + dy[i]);
+		if (distance < best) {
+			best = distance;
+			*mx = dx[i];
+			*my = dy[i];
+			found = true;
+		}
+	}
+	return found;
+}
@@ -0,0 +1,55 @@
+/*! \file distance.h
+ *  \brief Distance to the goal for every cell of a maze.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZJEDZTRAWKE2_DISTANCE_H
+#define ZJEDZTRAWKE2_DISTANCE_H
+
+#include "maze.h"
+
+#define DISTANCE_UNREACHABLE UINT32_MAX
+// Distances are stored in 16 bits, saturating at DISTANCE_FAR. Cells that
+// far away from the goal all look the same, so moves are only found once
+// within that range.
+#define DISTANCE_FAR (UINT16_MAX - 1)
+
+struct DistanceField {
+	int width, height;
+	int xGoal, yGoal;
+	// Stored in the same 8x8 blocks as the maze walls, so neighbouring cells
+	// mostly share cache lines during the search and the lookups.
+	uint16_t* cells; // UINT16_MAX when unreachable
+	int blocksPerRow;
+};
+
+struct DistanceField* CreateDistanceField(const struct Maze* maze, int xGoal, int yGoal);
+void DestroyDistanceField(struct DistanceField* field);
+void SetDistanceGoal(struct DistanceField* field, const struct Maze* maze, int xGoal, int yGoal);
+void UpdateDistanceField(struct DistanceField* field, const struct Maze* maze, int x, int y);
+bool GetBestMove(const struct DistanceField* field, int x, int y, int* dx, int* dy);
+
+static inline uint32_t GetDistance(const struct DistanceField* field, int x, int y) {
+	if (x < 0 || y < 0 || x >= field->width || y >= field->height) {
+		return DISTANCE_UNREACHABLE;
+	}
+	uint16_t distance = field->cells[((y / MAZE_BLOCK) * field->blocksPerRow + x / MAZE_BLOCK) * MAZE_BLOCK * MAZE_BLOCK + (y % MAZE_BLOCK) * MAZE_BLOCK + x % MAZE_BLOCK];
+	return (distance == UINT16_MAX) ? DISTANCE_UNREACHABLE : distance;
+}
+
+#endif
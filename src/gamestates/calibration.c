@@ -0,0 +1,259 @@
+/*! \file calibration.c
+ *  \brief Input and audio latency calibration.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../common.h"
+#include "../assets.h"
+#include "../match.h"
+#include "../profiler.h"
+#include <allegro5/allegro_primitives.h>
+#include <libsuperderpy.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define CALIBRATION_WARMUP 4 // taps ignored while getting into the rhythm
+#define CALIBRATION_TAPS 24
+#define HISTOGRAM_BINS 50
+#define HISTOGRAM_BIN_MS 10 // covers -250 .. +250 ms
+
+struct GamestateResources {
+	// Players tap along to a metronome and the offset of each tap from the
+	// nearest tick is measured. The metronome is a single looping sample with
+	// a ding followed by silence, so the ticks are as accurate as the mixer
+	// and can be timed the same way the game times the music.
+	ALLEGRO_FONT* font;
+	ALLEGRO_SAMPLE *ding_sample, *metronome_sample;
+	ALLEGRO_SAMPLE_INSTANCE* metronome;
+	unsigned int period; // in samples
+	int rate;
+
+	unsigned int position;
+	int64_t samples;
+	double anchor;
+
+	int taps;
+	double offsets[CALIBRATION_TAPS];
+	int histogram[HISTOGRAM_BINS];
+	double mean, jitter; // in seconds
+	bool done;
+};
+
+int Gamestate_ProgressCount = 1; // number of loading steps as reported by Gamestate_Load
+
+static ALLEGRO_SAMPLE* CreateMetronome(ALLEGRO_SAMPLE* ding, unsigned int period) {
+	// ding padded with silence up to the length of one beat
+	size_t frame = al_get_channel_count(al_get_sample_channels(ding)) * al_get_audio_depth_size(al_get_sample_depth(ding));
+	unsigned int length = al_get_sample_length(ding);
+	char* buffer = al_calloc(period, frame);
+	if (length > period) {
+		length = period;
+	}
+	memcpy(buffer, al_get_sample_data(ding), length * frame);
+	return al_create_sample(buffer, period, al_get_sample_frequency(ding), al_get_sample_depth(ding), al_get_sample_channels(ding), true);
+}
+
+static void UpdateClock(struct GamestateResources* data) {
+	unsigned int position = al_get_sample_instance_position(data->metronome);
+	if (position == data->position) {
+		return;
+	}
+	if (position < data->position) {
+		data->samples += data->period - data->position + position;
+	} else {
+		data->samples += position - data->position;
+	}
+	data->position = position;
+	data->anchor = al_get_time();
+}
+
+static double GetTickOffset(struct GamestateResources* data, double timestamp) {
+	// seconds from the nearest tick, negative when early
+	int64_t clock = data->samples + (int64_t)((timestamp - data->anchor) * data->rate);
+	int64_t offset = clock % data->period;
+	if (offset > data->period / 2) {
+		offset -= data->period;
+	}
+	if (offset < -(int64_t)data->period / 2) {
+		offset += data->period;
+	}
+	return offset / (double)data->rate;
+}
+
+static void ExportHistogram(struct Game* game, struct GamestateResources* data) {
+	ALLEGRO_PATH* path = al_get_standard_path(ALLEGRO_USER_DATA_PATH);
+	al_make_directory(al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP));
+	al_set_path_filename(path, "latency.csv");
+	ALLEGRO_FILE* file = al_fopen(al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP), "w");
+	if (file) {
+		int i;
+		al_fprintf(file, "# mean %.1f ms, jitter %.1f ms, %d taps\n", data->mean * 1000, data->jitter * 1000, CALIBRATION_TAPS);
+		al_fprintf(file, "offset_ms,count\n");
+		for (i = 0; i < HISTOGRAM_BINS; i++) {
+			al_fprintf(file, "%d,%d\n", (i - HISTOGRAM_BINS / 2) * HISTOGRAM_BIN_MS, data->histogram[i]);
+		}
+		al_fclose(file);
+		PrintConsole(game, "Latency histogram saved to %s", al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP));
+	}
+	al_destroy_path(path);
+}
+
+static void Finish(struct Game* game, struct GamestateResources* data) {
+	char text[16];
+	int i;
+	data->mean = 0;
+	for (i = 0; i < CALIBRATION_TAPS; i++) {
+		data->mean += data->offsets[i];
+	}
+	data->mean /= CALIBRATION_TAPS;
+	data->jitter = 0;
+	for (i = 0; i < CALIBRATION_TAPS; i++) {
+		data->jitter += (data->offsets[i] - data->mean) * (data->offsets[i] - data->mean);
+	}
+	data->jitter = sqrt(data->jitter / CALIBRATION_TAPS);
+	data->done = true;
+	al_stop_sample_instance(data->metronome);
+
+	snprintf(text, 16, "%.1f", data->mean * 1000);
+	SetConfigOption(game, "ZjedzTrawke2", "latency", text);
+	PrintConsole(game, "Latency: %.1f ms, jitter: %.1f ms", data->mean * 1000, data->jitter * 1000);
+	ExportHistogram(game, data);
+}
+
+static void Tap(struct Game* game, struct GamestateResources* data, double timestamp) {
+	if (data->done) {
+		return;
+	}
+	double offset = GetTickOffset(data, timestamp);
+	if (data->taps >= CALIBRATION_WARMUP) {
+		int bin = (int)floor(offset * 1000 / HISTOGRAM_BIN_MS) + HISTOGRAM_BINS / 2;
+		if (bin < 0) {
+			bin = 0;
+		}
+		if (bin >= HISTOGRAM_BINS) {
+			bin = HISTOGRAM_BINS - 1;
+		}
+		data->histogram[bin]++;
+		data->offsets[data->taps - CALIBRATION_WARMUP] = offset;
+	}
+	data->taps++;
+	if (data->taps == CALIBRATION_WARMUP + CALIBRATION_TAPS) {
+		Finish(game, data);
+	}
+}
+
+void Gamestate_Logic(struct Game* game, struct GamestateResources* data, double delta) {
+	if (!data->done) {
+		UpdateClock(data);
+	}
+}
+
+void Gamestate_Tick(struct Game* game, struct GamestateResources* data) {}
+
+void Gamestate_Draw(struct Game* game, struct GamestateResources* data) {
+	int i, max = 1;
+	float x = (320 - HISTOGRAM_BINS * 5) / 2.0;
+
+	al_clear_to_color(al_map_rgb(0, 0, 0));
+	DrawTextWithShadow(data->font, al_map_rgb(255, 255, 255), 320 / 2.0, 20, ALLEGRO_ALIGN_CENTER, "Tap any key along to the beat");
+	if (data->done) {
+		DrawTextWithShadow(data->font, al_map_rgb(255, 255, 255), 320 / 2.0, 40, ALLEGRO_ALIGN_CENTER, "Done!");
+	} else if (data->taps < CALIBRATION_WARMUP) {
+		DrawTextWithShadow(data->font, al_map_rgb(255, 255, 255), 320 / 2.0, 40, ALLEGRO_ALIGN_CENTER, "Get ready...");
+	} else {
+		char text[16];
+		snprintf(text, 16, "%d / %d", data->taps - CALIBRATION_WARMUP, CALIBRATION_TAPS);
+		DrawTextWithShadow(data->font, al_map_rgb(255, 255, 255), 320 / 2.0, 40, ALLEGRO_ALIGN_CENTER, text);
+	}
+
+	for (i = 0; i < HISTOGRAM_BINS; i++) {
+		if (data->histogram[i] > max) {
+			max = data->histogram[i];
+		}
+	}
+	for (i = 0; i < HISTOGRAM_BINS; i++) {
+		float height = data->histogram[i] * 80.0 / max;
+		al_draw_filled_rectangle(x + i * 5, 150 - height, x + i * 5 + 4, 150, al_map_rgb(160, 160, 0));
+	}
+	al_draw_line(320 / 2.0, 65, 320 / 2.0, 152, al_map_rgba(255, 255, 255, 128), 1);
+
+	if (data->done) {
+		char text[64];
+		snprintf(text, 64, "Offset: %+.0f ms  Jitter: %.0f ms", data->mean * 1000, data->jitter * 1000);
+		DrawTextWithShadow(data->font, al_map_rgb(255, 255, 255), 320 / 2.0, 160, ALLEGRO_ALIGN_CENTER, text);
+	}
+}
+
+void Gamestate_ProcessEvent(struct Game* game, struct GamestateResources* data, ALLEGRO_EVENT* ev) {
+	if ((ev->type == ALLEGRO_EVENT_KEY_DOWN) && ((ev->keyboard.keycode == ALLEGRO_KEY_ESCAPE) || (ev->keyboard.keycode == ALLEGRO_KEY_BACK))) {
+		SwitchCurrentGamestate(game, "menu");
+		return;
+	}
+	if (ev->type == ALLEGRO_EVENT_KEY_DOWN) {
+		Tap(game, data, ev->any.timestamp);
+	}
+	if ((ev->type == ALLEGRO_EVENT_TOUCH_BEGIN) && ev->touch.primary) {
+		Tap(game, data, ev->any.timestamp);
+	}
+}
+
+void* Gamestate_Load(struct Game* game, void (*progress)(struct Game*)) {
+	struct GamestateResources* data = calloc(1, sizeof(struct GamestateResources));
+	data->font = AcquireBuiltinFont(game->data->assets);
+
+	data->ding_sample = AcquireSample(game->data->assets, GetDataFilePath(game, "ding.flac"));
+	data->rate = al_get_sample_frequency(data->ding_sample);
+	// ticks at the speed a match starts at
+	data->period = data->rate / SPEED;
+	data->metronome_sample = CreateMetronome(data->ding_sample, data->period);
+	data->metronome = al_create_sample_instance(data->metronome_sample);
+	al_attach_sample_instance_to_mixer(data->metronome, game->audio.fx);
+	al_set_sample_instance_playmode(data->metronome, ALLEGRO_PLAYMODE_LOOP);
+	progress(game);
+
+	return data;
+}
+
+void Gamestate_Unload(struct Game* game, struct GamestateResources* data) {
+	ReleaseAsset(game->data->assets, data->font);
+	al_destroy_sample_instance(data->metronome);
+	al_destroy_sample(data->metronome_sample);
+	ReleaseAsset(game->data->assets, data->ding_sample);
+	free(data);
+}
+
+void Gamestate_Start(struct Game* game, struct GamestateResources* data) {
+	SetProfilerScope(game, "calibration");
+	memset(data->histogram, 0, sizeof(data->histogram));
+	data->taps = 0;
+	data->done = false;
+	al_set_sample_instance_position(data->metronome, 0);
+	al_play_sample_instance(data->metronome);
+	data->position = 0;
+	data->samples = 0;
+	data->anchor = al_get_time();
+}
+
+void Gamestate_Stop(struct Game* game, struct GamestateResources* data) {
+	al_stop_sample_instance(data->metronome);
+}
+
+void Gamestate_Reload(struct Game* game, struct GamestateResources* data) {}
+void Gamestate_Pause(struct Game* game, struct GamestateResources* data) {}
+void Gamestate_Resume(struct Game* game, struct GamestateResources* data) {}
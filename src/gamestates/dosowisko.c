@@ -19,6 +19,8 @@
  */
 
 #include "../common.h"
+#include "../assets.h"
+#include "../profiler.h"
 #include <libsuperderpy.h>
 #include <math.h>
 
@@ -30,6 +32,7 @@ struct GamestateResources {
 	ALLEGRO_SAMPLE *sample, *kbd_sample, *key_sample;
 	ALLEGRO_SAMPLE_INSTANCE *sound, *kbd, *key;
 	ALLEGRO_BITMAP *bitmap, *checkerboard, *pixelator;
+	bool generated; // checkerboard wasn't packed
 	int pos;
 	double fade, tan;
 	char text[255];
@@ -135,6 +138,7 @@ void Gamestate_Draw(struct Game* game, struct GamestateResources* data) {
 }
 
 void Gamestate_Start(struct Game* game, struct GamestateResources* data) {
+	SetProfilerScope(game, "dosowisko");
 	data->pos = 1;
 	data->fade = 0;
 	data->tan = 64;
@@ -170,26 +174,30 @@ void* Gamestate_Load(struct Game* game, void (*progress)(struct Game*)) {
 	data->timeline = TM_Init(game, data, "main");
 	data->bitmap = CreateNotPreservedBitmap(320, 180);
 	data->pixelator = CreateNotPreservedBitmap(320, 180);
-	data->checkerboard = al_create_bitmap(320, 180);
+	data->checkerboard = AcquireBitmap(game->data->assets, "@checkerboard");
+	data->generated = !data->checkerboard;
+	if (data->generated) {
+		data->checkerboard = al_create_bitmap(320, 180);
+	}
 	(*progress)(game);
 
-	data->font = al_load_ttf_font(GetDataFilePath(game, "fonts/DejaVuSansMono.ttf"),
-		(int)(180 * 0.1666 / 8) * 8, 0);
+	data->font = AcquireFont(game->data->assets, GetDataFilePath(game, "fonts/DejaVuSansMono.ttf"),
+		(int)(180 * 0.1666 / 8) * 8);
 	(*progress)(game);
 
-	data->sample = al_load_sample(GetDataFilePath(game, "dosowisko.flac"));
+	data->sample = AcquireSample(game->data->assets, GetDataFilePath(game, "dosowisko.flac"));
 	data->sound = al_create_sample_instance(data->sample);
 	al_attach_sample_instance_to_mixer(data->sound, game->audio.music);
 	al_set_sample_instance_playmode(data->sound, ALLEGRO_PLAYMODE_ONCE);
 	(*progress)(game);
 
-	data->kbd_sample = al_load_sample(GetDataFilePath(game, "kbd.flac"));
+	data->kbd_sample = AcquireSample(game->data->assets, GetDataFilePath(game, "kbd.flac"));
 	data->kbd = al_create_sample_instance(data->kbd_sample);
 	al_attach_sample_instance_to_mixer(data->kbd, game->audio.fx);
 	al_set_sample_instance_playmode(data->kbd, ALLEGRO_PLAYMODE_ONCE);
 	(*progress)(game);
 
-	data->key_sample = al_load_sample(GetDataFilePath(game, "key.flac"));
+	data->key_sample = AcquireSample(game->data->assets, GetDataFilePath(game, "key.flac"));
 	data->key = al_create_sample_instance(data->key_sample);
 	al_attach_sample_instance_to_mixer(data->key, game->audio.fx);
 	al_set_sample_instance_playmode(data->key, ALLEGRO_PLAYMODE_ONCE);
@@ -201,6 +209,9 @@ void* Gamestate_Load(struct Game* game, void (*progress)(struct Game*)) {
 }
 
 void Gamestate_PostLoad(struct Game* game, struct GamestateResources* data) {
+	if (!data->generated) {
+		return;
+	}
 	al_set_target_bitmap(data->checkerboard);
 	al_lock_bitmap(data->checkerboard, ALLEGRO_PIXEL_FORMAT_ANY, ALLEGRO_LOCK_WRITEONLY);
 	int x, y;
@@ -223,15 +234,19 @@ void Gamestate_Stop(struct Game* game, struct GamestateResources* data) {
 }
 
 void Gamestate_Unload(struct Game* game, struct GamestateResources* data) {
-	al_destroy_font(data->font);
+	ReleaseAsset(game->data->assets, data->font);
 	al_destroy_sample_instance(data->sound);
-	al_destroy_sample(data->sample);
+	ReleaseAsset(game->data->assets, data->sample);
 	al_destroy_sample_instance(data->kbd);
-	al_destroy_sample(data->kbd_sample);
+	ReleaseAsset(game->data->assets, data->kbd_sample);
 	al_destroy_sample_instance(data->key);
-	al_destroy_sample(data->key_sample);
+	ReleaseAsset(game->data->assets, data->key_sample);
 	al_destroy_bitmap(data->bitmap);
-	al_destroy_bitmap(data->checkerboard);
+	if (data->generated) {
+		al_destroy_bitmap(data->checkerboard);
+	} else {
+		ReleaseAsset(game->data->assets, data->checkerboard);
+	}
 	al_destroy_bitmap(data->pixelator);
 	TM_Destroy(data->timeline);
 	free(data);
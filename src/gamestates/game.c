@@ -19,24 +19,53 @@
  */
 
 #include "../common.h"
+#include "../assets.h"
+#include "../bot.h"
+#include "../distance.h"
+#include "../match.h"
+#include "../mazepool.h"
+#include "../netplay.h"
+#include "../profiler.h"
+#include "../replay.h"
+#include "../source.h"
+#include "../track.h"
 #include <libsuperderpy.h>
-
-#define SPEED 1.1
-#define MAZE_WIDTH 20
-#define MAZE_HEIGHT 20
-
-enum direction {
-	up,
-	down,
-	left,
-	right
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#define MAZE_LAYER_MAX_SIZE 4096
+#define MAZE_WINDOW_SIZE 96 // in pixels, the most of the maze a player gets to see
+#define BEAT_LANE_WIDTH 25
+
+struct View {
+	// Player's cell of the split screen, in viewport pixels.
+	float x, y, w, h;
+	float mapX, mapY, mapW, mapH; // visible window of the maze
+	float pigX, pigY; // the player's tile, within the window
+	float laneX, laneY; // beat pointer
+	float laneSpacing; // distance between beats on the lane
+	float textX, textY;
 };
 
-struct RhythmPulse {
-	float timer;
-	int status;
-	struct RhythmPulse* next;
+struct Player {
 	int id;
+	int pig; // sprite set
+	ALLEGRO_COLOR tint;
+	struct Track* music;
+	ALLEGRO_SAMPLE_INSTANCE *ding, *tada, *no, *wrong_way;
+	struct Bot* bot; // controls the player instead of the keyboard, if set
+	int keys[4]; // keycodes, indexed by direction
+	int padIndex;
+	ALLEGRO_JOYSTICK* pad;
+	int stick[2]; // which side of the centre each axis was last seen on
+	struct View view;
+	// The mixer reports the music position only once per fragment, so the
+	// clock is extrapolated from the last position change with wall time.
+	unsigned int position; // last position reported by the mixer
+	int64_t samples; // samples played up to that position, across loops
+	double anchor; // time at which the position was seen first
+	unsigned int paused; // position of the music when the gamestate got paused
 };
 
 struct GamestateResources {
@@ -44,213 +73,534 @@ struct GamestateResources {
 	// It gets created on load and then gets passed around to all other function
 	// calls.
 	ALLEGRO_FONT* font;
+	ALLEGRO_BITMAP* atlas;
+	ALLEGRO_BITMAP* layer;
+	// loaded as separate bitmaps, replaced with atlas regions in PostLoad
 	ALLEGRO_BITMAP* pulseBitmap;
 	ALLEGRO_BITMAP* pointer;
 	ALLEGRO_BITMAP* grass;
 	ALLEGRO_BITMAP* tile;
+	ALLEGRO_BITMAP* pigs[2]; // colour and grey
+	ALLEGRO_BITMAP* sprites[2][4]; // pre-rotated pigs, indexed by direction
 
-	struct Player* player1;
-	struct Player* player2;
-	char* map;
-	int xGrass;
-	int yGrass;
+	// players are indexed the same way as in the match session
+	struct Player player[MATCH_MAX_PLAYERS];
+	struct Maze* maze;
+	struct MatchSession match;
+	struct Replay* replay; // being recorded, or played back
+	bool playback, saved;
+	bool resumed; // from a match suspended in a previous run
+	struct Netplay* net; // versus against another instance, if set
 
-	unsigned int pos1, pos2;
+	ALLEGRO_SAMPLE *ding_sample, *tada_sample, *no_sample, *wrong_way;
+	struct Source* music; // decoded a block at a time, shared by the players' tracks
 
-	ALLEGRO_SAMPLE *music_sample, *ding_sample, *tada_sample, *no_sample, *wrong_way;
+	bool hints;
+	double latency; // measured by the calibration, in seconds
 
 	bool ended;
 	struct Player* winner;
 	struct Tween endtween;
-};
 
-struct Player {
-	int x, y;
-	char* text;
-	float angle;
-	ALLEGRO_BITMAP* player;
-	int score;
-	struct RhythmPulse* rhythmPulse;
-	ALLEGRO_SAMPLE_INSTANCE *music, *ding, *tada, *no, *wrong_way;
+	bool drawn; // since the last start
 };
 
-int Gamestate_ProgressCount = 29; // number of loading steps as reported by Gamestate_Load
+int Gamestate_ProgressCount = 8; // number of loading steps as reported by Gamestate_Load
+
+// The first two players are told apart by their pigs, the rest by tinting
+// the grey one.
+static const unsigned char tints[MATCH_MAX_PLAYERS][3] = {
+	{255, 255, 255}, {255, 255, 255}, {255, 150, 150}, {150, 190, 255},
+	{255, 230, 120}, {160, 255, 160}, {230, 150, 255}, {255, 190, 130}};
+
+// up, down, left, right as Allegro key names; slots without any are played
+// with a gamepad only
+static const char* defaultKeys[MATCH_MAX_PLAYERS] = {"W,S,A,D", "UP,DOWN,LEFT,RIGHT", "I,K,J,L", "PAD 8,PAD 5,PAD 4,PAD 6"};
+
+static float FacingAngle(enum direction direction) {
+	switch (direction) {
+		case up:
+			return 1.5 * ALLEGRO_PI;
+		case down:
+			return 0.5 * ALLEGRO_PI;
+		case left:
+			return ALLEGRO_PI;
+		case right:
+		default:
+			return 0;
+	}
+}
 
-static float Abs(float a) {
-	if (a >= 0) {
-		return a;
+static ALLEGRO_BITMAP* GetSprite(struct GamestateResources* data, int id) {
+	return data->sprites[data->player[id].pig][data->match.facing[id]];
+}
+
+static void GetWinMessage(struct GamestateResources* data, int id, char* message, size_t size) {
+	// Both shown and said out loud.
+	if (data->match.players == 2) {
+		snprintf(message, size, "%s player wins!", id ? "Right" : "Left");
+	} else {
+		snprintf(message, size, "Player %d wins!", id + 1);
 	}
-	return -a;
 }
 
-static void IsGoodPressed(struct Game* game, struct RhythmPulse* pulse, struct Player* player,
-	struct GamestateResources* data, enum direction direction) {
-	float point = pulse->timer;
-	if (point <= 0.25f && point > -0.25f) {
-		if (Abs(point) <= 0.25f && pulse->status == -1) {
-			pulse->status = (int)(100 - Abs((point)*400));
-			player->text = "Good!";
-			player->score += pulse->status;
-			if (Abs(point) <= 0.15f) {
-				player->text = "Excellent!";
-			}
-			if (Abs(point) <= 0.05f) {
-				player->text = "Perfect!";
-			}
-			char flag = 1;
-			switch (direction) {
-				case up:
-					if (player->y > 0) {
-						if (data->map[player->x + (player->y - 1) * MAZE_WIDTH] != 1) {
-							player->y--;
-							player->angle = 1.5 * ALLEGRO_PI;
-							al_stop_sample_instance(player->ding);
-							al_set_sample_instance_speed(player->ding, 1.0 - Abs(point));
-							al_play_sample_instance(player->ding);
-							flag = 0;
-						}
-					}
-					break;
-				case down:
-					if (player->y < MAZE_HEIGHT - 1) {
-						if (data->map[player->x + (player->y + 1) * MAZE_WIDTH] != 1) {
-							player->y++;
-							player->angle = 0.5 * ALLEGRO_PI;
-							al_stop_sample_instance(player->ding);
-							al_set_sample_instance_speed(player->ding, 1.0 - Abs(point));
-							al_play_sample_instance(player->ding);
-							flag = 0;
-						}
-					}
-					break;
-				case left:
-					if (player->x > 0) {
-						if (data->map[player->x - 1 + player->y * MAZE_WIDTH] != 1) {
-							player->x--;
-							player->angle = ALLEGRO_PI;
-							al_stop_sample_instance(player->ding);
-							al_set_sample_instance_speed(player->ding, 1.0 - Abs(point));
-							al_play_sample_instance(player->ding);
-							flag = 0;
-						}
-					}
-					break;
-				case right:
-					if (player->x < MAZE_WIDTH - 1) {
-						if (data->map[player->x + 1 + player->y * MAZE_WIDTH] != 1) {
-							player->x++;
-							player->angle = 0;
-							al_stop_sample_instance(player->ding);
-							al_set_sample_instance_speed(player->ding, 1.0 - Abs(point));
-							al_play_sample_instance(player->ding);
-							flag = 0;
-						}
-					}
-					break;
-			}
-			if (flag) {
+static void PrerenderWinMessages(struct Game* game, struct GamestateResources* data) {
+	char messages[MATCH_MAX_PLAYERS][32];
+	char* texts[MATCH_MAX_PLAYERS];
+	int i;
+	for (i = 0; i < data->match.players; i++) {
+		GetWinMessage(data, i, messages[i], sizeof(messages[i]));
+		texts[i] = messages[i];
+	}
+	PrerenderSpeak(game, texts, data->match.players);
+}
+
+static ALLEGRO_SAMPLE_INSTANCE* CreateInstance(ALLEGRO_SAMPLE* sample, ALLEGRO_MIXER* mixer, ALLEGRO_PLAYMODE mode) {
+	ALLEGRO_SAMPLE_INSTANCE* instance = al_create_sample_instance(sample);
+	al_attach_sample_instance_to_mixer(instance, mixer);
+	al_set_sample_instance_playmode(instance, mode);
+	return instance;
+}
+
+static void CreateEndSounds(struct Game* game, struct GamestateResources* data) {
+	// Only needed once the match is over, so the match doesn't wait for
+	// them to be decoded when it starts.
+	int i;
+	if (data->tada_sample) {
+		return;
+	}
+	data->tada_sample = AcquireSample(game->data->assets, GetDataFilePath(game, "tada.flac"));
+	data->no_sample = AcquireSample(game->data->assets, GetDataFilePath(game, "no.flac"));
+	for (i = 0; i < data->match.players; i++) {
+		struct Player* player = &data->player[i];
+		ALLEGRO_MIXER* fx = (player->id % 2) ? game->data->audio.fx : game->audio.fx;
+		player->tada = CreateInstance(data->tada_sample, fx, ALLEGRO_PLAYMODE_ONCE);
+		player->no = CreateInstance(data->no_sample, fx, ALLEGRO_PLAYMODE_ONCE);
+		al_set_sample_instance_pan(player->tada, al_get_sample_instance_pan(player->ding));
+		al_set_sample_instance_pan(player->no, al_get_sample_instance_pan(player->ding));
+	}
+}
+
+static void PlayCues(struct Game* game, struct GamestateResources* data, struct MatchCues* cues) {
+	char message[32];
+	int i, j;
+	for (i = 0; i < cues->count; i++) {
+		struct MatchCue* cue = &cues->cue[i];
+		struct Player* player = &data->player[cue->player];
+		switch (cue->type) {
+			case MATCH_CUE_MUSIC_SPEED:
+				SetTrackSpeed(player->music, cue->value);
+				break;
+			case MATCH_CUE_DING:
+				al_stop_sample_instance(player->ding);
+				al_set_sample_instance_speed(player->ding, cue->value);
+				al_play_sample_instance(player->ding);
+				break;
+			case MATCH_CUE_WRONG_WAY:
 				al_stop_sample_instance(player->wrong_way);
-				al_set_sample_instance_speed(player->wrong_way, 1.0 - Abs(point));
+				al_set_sample_instance_speed(player->wrong_way, cue->value);
 				al_play_sample_instance(player->wrong_way);
-			}
-			if (player->x == data->xGrass && player->y == data->yGrass) {
-				// winning condition
+				break;
+			case MATCH_CUE_JUDGEMENT:
+				break;
+			case MATCH_CUE_WIN:
 				data->ended = true;
 				data->winner = player;
 				data->endtween = Tween(game, 100.0, 0.0, TWEEN_STYLE_BOUNCE_OUT, 1.5);
-				al_stop_sample_instance(data->player1->music);
-				al_stop_sample_instance(data->player2->music);
-				al_play_sample_instance(player->tada);
-				if (player == data->player1) {
-					al_play_sample_instance(data->player2->no);
-				} else {
-					al_play_sample_instance(data->player1->no);
+				CreateEndSounds(game, data);
+				for (j = 0; j < data->match.players; j++) {
+					SetTrackPlaying(data->player[j].music, false);
+					al_play_sample_instance((j == cue->player) ? data->player[j].tada : data->player[j].no);
 				}
-			}
+				GetWinMessage(data, cue->player, message, sizeof(message));
+				Speak(game, message);
+				break;
+		}
+	}
+}
 
-		} else {
-			player->text = "Bad!";
-			pulse->status = 0;
+static unsigned int GetMusicPosition(struct Player* player) {
+	// in samples
+	return GetTrackPosition(player->music);
+}
 
-			if (player->score >= 50) {
-				player->score -= 50;
-			}
-			if (player->score < 50) {
-				player->score = 0;
+static unsigned int GetMusicLength(struct Player* player) {
+	return GetTrackLength(player->music);
+}
+
+static void SeekMusic(struct Player* player, unsigned int position) {
+	SeekTrack(player->music, position);
+}
+
+static void ResetMusicClock(struct Player* player, int64_t samples) {
+	player->position = GetMusicPosition(player);
+	player->samples = samples;
+	player->anchor = al_get_time();
+}
+
+static void UpdateMusicClock(struct Player* player) {
+	unsigned int position = GetMusicPosition(player);
+	if (position == player->position) {
+		return;
+	}
+	if (position < player->position) {
+		// looped around
+		player->samples += GetMusicLength(player) - player->position + position;
+	} else {
+		player->samples += position - player->position;
+	}
+	player->position = position;
+	player->anchor = al_get_time();
+}
+
+static int64_t GetMusicClock(struct GamestateResources* data, struct Player* player, double time) {
+	// Position of the music at given time, in the al_get_time() domain.
+	// Also works for timestamps slightly in the past, like the ones of input
+	// events.
+	double rate = data->match.rate * GetMusicSpeed(&data->match, player->id);
+	int64_t clock = player->samples + (int64_t)((time - player->anchor) * rate);
+	return (clock > 0) ? clock : 0;
+}
+
+static void PressKey(struct Game* game, struct GamestateResources* data, struct Player* player, enum direction direction, double timestamp) {
+	// judged at the moment the key was pressed, not when the event got here,
+	// corrected by the latency of the setup
+	if (player->bot) {
+		return;
+	}
+	struct MatchInput input = {.player = player->id, .direction = direction, .clock = GetMusicClock(data, player, timestamp - data->latency)};
+	struct MatchCues cues;
+	if (data->net) {
+		// judged with the next frame, which also records it
+		QueueNetplayInput(data->net, &input);
+		return;
+	}
+	RecordReplayInput(data->replay, &data->match, &input);
+	StepMatch(&data->match, &input, 1, NULL, &cues);
+	PlayCues(game, data, &cues);
+}
+
+static void PlayBackInputs(struct Game* game, struct GamestateResources* data, const int64_t clocks[]) {
+	// Inputs are fed in recorded order once the player's music reaches them.
+	struct MatchInput input;
+	struct MatchCues cues;
+	while (!data->ended && PeekReplayInput(data->replay, &input) && input.clock <= clocks[input.player]) {
+		NextReplayInput(data->replay, &input);
+		StepMatch(&data->match, &input, 1, NULL, &cues);
+		PlayCues(game, data, &cues);
+	}
+}
+
+static void RunBots(struct Game* game, struct GamestateResources* data, const int64_t clocks[]) {
+	// Bots press through the same path as players do, so their inputs get
+	// judged and recorded the same way.
+	struct MatchInput input;
+	struct MatchCues cues;
+	int i;
+	for (i = 0; i < data->match.players; i++) {
+		if (!data->player[i].bot) {
+			continue;
+		}
+		while (!data->ended && RunBot(data->player[i].bot, &data->match, clocks[i], &input)) {
+			if (data->net) {
+				QueueNetplayInput(data->net, &input);
+				continue;
 			}
+			RecordReplayInput(data->replay, &data->match, &input);
+			StepMatch(&data->match, &input, 1, NULL, &cues);
+			PlayCues(game, data, &cues);
 		}
 	}
-	if (point <= -0.25f) {
-		IsGoodPressed(game, pulse->next, player, data, direction);
+}
+
+static void CreatePlayerBot(struct Game* game, struct Player* player) {
+	char option[8];
+	snprintf(option, 8, "bot%d", player->id + 1);
+	if (!strtol(GetConfigOptionDefault(game, "ZjedzTrawke2", option, "0"), NULL, 10)) {
+		return;
 	}
+	struct BotConfig config = {
+		.bias = strtof(GetConfigOptionDefault(game, "ZjedzTrawke2", "botbias", "0"), NULL),
+		.jitter = strtof(GetConfigOptionDefault(game, "ZjedzTrawke2", "botjitter", "0.08"), NULL),
+		.mistakes = strtof(GetConfigOptionDefault(game, "ZjedzTrawke2", "botmistakes", "0.05"), NULL),
+	};
+	player->bot = calloc(1, sizeof(struct Bot));
+	InitBot(player->bot, player->id, &config, rand());
 }
 
-static void DrawMap(struct Player* player, struct Player* otherPlayer,
-	struct GamestateResources* data, float x, float y) {
-	int i, j;
+static int FindKey(const char* name, size_t length) {
+	int key;
+	for (key = 1; key < ALLEGRO_KEY_MAX; key++) {
+		const char* candidate = al_keycode_to_name(key);
+		if (strlen(candidate) == length && !strncmp(candidate, name, length)) {
+			return key;
+		}
+	}
+	return 0;
+}
 
-	for (i = -3; i < 3; i++) {
-		if (i + player->x < 0 || i + player->x >= MAZE_WIDTH) { continue; }
-		for (j = -3; j < 3; j++) {
-			if (j + player->y < 0 || j + player->y >= MAZE_HEIGHT) { continue; }
-			int id = i + player->x + (j + player->y) * MAZE_WIDTH;
-			if (!data->map[id]) {
-				al_draw_bitmap_region(data->tile, 0, 0, 16, 16,
-					x + i * 16,
-					y + j * 16, 0);
-			}
-			if (j + player->y == data->yGrass && i + player->x == data->xGrass) {
-				al_draw_bitmap_region(data->grass, 0, 0, 16, 16,
-					x + i * 16,
-					y + j * 16, 0);
-			}
+static void LoadControls(struct Game* game, struct Player* player, int slot) {
+	// Slots are configured with keysN set to Allegro names of the keys for
+	// up, down, left and right, separated with commas, and padN set to the
+	// index of the gamepad, or -1 for none.
+	char option[8], value[8];
+	enum direction direction;
+	snprintf(option, 8, "keys%d", slot + 1);
+	const char* keys = GetConfigOptionDefault(game, "ZjedzTrawke2", option, defaultKeys[slot] ? defaultKeys[slot] : "");
+	for (direction = up; direction <= right; direction++) {
+		size_t length = strcspn(keys, ",");
+		player->keys[direction] = length ? FindKey(keys, length) : 0;
+		keys += length + (keys[length] == ',');
+	}
+	snprintf(option, 8, "pad%d", slot + 1);
+	snprintf(value, 8, "%d", slot);
+	player->padIndex = strtol(GetConfigOptionDefault(game, "ZjedzTrawke2", option, value), NULL, 10);
+}
 
-			if (id == (otherPlayer->x + otherPlayer->y * MAZE_WIDTH)) {
-				al_draw_tinted_rotated_bitmap(otherPlayer->player, al_map_rgb(96, 96, 96), 8, 8, x + i * 16 - 8 + 16, y + j * 16 - 8 + 16, otherPlayer->angle, 0);
-			}
-			if (id == (player->x + player->y * MAZE_WIDTH)) {
-				al_draw_rotated_bitmap(player->player, 8, 8, x + i * 16 - 8 + 16, y + j * 16 - 8 + 16, player->angle, 0);
+static void AssignPads(struct GamestateResources* data) {
+	int i, pads = al_is_joystick_installed() ? al_get_num_joysticks() : 0;
+	for (i = 0; i < data->match.players; i++) {
+		struct Player* player = &data->player[i];
+		player->pad = (player->padIndex >= 0 && player->padIndex < pads) ? al_get_joystick(player->padIndex) : NULL;
+		player->stick[0] = player->stick[1] = 0;
+	}
+}
+
+static void MovePadStick(struct Game* game, struct GamestateResources* data, struct Player* player, ALLEGRO_EVENT* ev) {
+	// The stick or d-pad leaving the centre counts as a press, just like a key.
+	int axis = ev->joystick.axis;
+	int side = (ev->joystick.pos > 0.5) ? 1 : (ev->joystick.pos < -0.5) ? -1 : 0;
+	if (ev->joystick.stick != 0 || axis > 1 || side == player->stick[axis]) {
+		return;
+	}
+	player->stick[axis] = side;
+	if (side) {
+		PressKey(game, data, player, axis ? ((side > 0) ? down : up) : ((side > 0) ? right : left), ev->any.timestamp);
+	}
+}
+
+static void LayOutViews(struct Game* game, struct GamestateResources* data) {
+	// Split screen with up to two players in a row and two rows above that.
+	// Every cell has a window into the maze, the beat lane on the side facing
+	// the middle of the screen and the judgement text below.
+	int count = data->match.players, i;
+	int rows = (count > 2) ? 2 : 1, columns = (count + rows - 1) / rows;
+	float w = floorf(game->viewport.width / (float)columns), h = floorf(game->viewport.height / (float)rows);
+	for (i = 0; i < count; i++) {
+		struct View* view = &data->player[i].view;
+		int column = i % columns, row = i / columns;
+		bool mirrored = column * 2 + 1 > columns;
+		float area = w - BEAT_LANE_WIDTH, areaX;
+		view->x = column * w;
+		view->y = row * h;
+		view->w = w;
+		view->h = h;
+		areaX = view->x + (mirrored ? BEAT_LANE_WIDTH : 0);
+
+		view->mapW = fminf(MAZE_WINDOW_SIZE, floorf((area - 8) / 2) * 2);
+		view->mapH = fminf(MAZE_WINDOW_SIZE, floorf((h - 26) / 2) * 2);
+		view->mapX = areaX + floorf((area - view->mapW) / 2);
+		view->mapY = view->y + fmaxf(4, floorf(h / 3 - view->mapH / 2));
+		view->pigX = view->mapX + floorf((view->mapW - 16) / 2);
+		view->pigY = view->mapY + floorf((view->mapH - 16) / 2);
+
+		view->laneX = mirrored ? view->x + 5 : view->x + w - BEAT_LANE_WIDTH;
+		view->laneY = view->y + floorf(h / 2) - 10;
+		view->laneSpacing = 40.0 / rows;
+		view->textX = areaX + area / 2;
+		view->textY = fmaxf(view->y + floorf(h / 1.3), view->mapY + view->mapH + 2);
+	}
+}
+
+static void SaveMatchReplay(struct Game* game, struct GamestateResources* data) {
+	char filename[64];
+	if (data->playback || data->saved || data->resumed) {
+		return;
+	}
+	data->saved = true;
+	FinishReplay(data->replay, &data->match);
+
+	ALLEGRO_PATH* path = al_get_standard_path(ALLEGRO_USER_DATA_PATH);
+	al_append_path_component(path, "replays");
+	al_make_directory(al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP));
+	snprintf(filename, 64, "%u-%ld" REPLAY_EXTENSION, data->maze->seed, (long)time(NULL));
+	al_set_path_filename(path, filename);
+	if (SaveReplay(data->replay, al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP))) {
+		PrintConsole(game, "Replay saved to %s", al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP));
+	}
+	al_destroy_path(path);
+}
+
+static ALLEGRO_PATH* GetSuspendPath(void) {
+	ALLEGRO_PATH* path = al_get_standard_path(ALLEGRO_USER_DATA_PATH);
+	al_make_directory(al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP));
+	al_set_path_filename(path, "suspended.zt2s");
+	return path;
+}
+
+static void SuspendMatch(struct Game* game, struct GamestateResources* data) {
+	// The match is written out whenever the game gets paused, so it can be
+	// picked up again even if the process doesn't survive the pause.
+	if (data->ended || data->playback || data->net) {
+		return;
+	}
+	ALLEGRO_PATH* path = GetSuspendPath();
+	if (!SaveMatch(&data->match, al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP))) {
+		PrintConsole(game, "Couldn't save the match to %s", al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP));
+	}
+	al_destroy_path(path);
+}
+
+static bool ResumeSuspendedMatch(struct Game* game, struct GamestateResources* data) {
+	// Takes over the maze and session of a suspended match, if there's one.
+	// The save is consumed, a new one gets written on the next pause.
+	ALLEGRO_PATH* path = GetSuspendPath();
+	const char* filename = al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP);
+	bool resumed = al_filename_exists(filename) && LoadMatch(&data->match, filename);
+	if (resumed) {
+		data->maze = data->match.maze;
+		if (!data->maze->endless) {
+			data->maze->distance = CreateDistanceField(data->maze, data->maze->xGrass, data->maze->yGrass);
+		}
+		PrintConsole(game, "Resuming a suspended match");
+	}
+	al_remove_filename(filename);
+	al_destroy_path(path);
+	return resumed;
+}
+
+static void DiscardSuspendedMatch(void) {
+	ALLEGRO_PATH* path = GetSuspendPath();
+	al_remove_filename(al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP));
+	al_destroy_path(path);
+}
+
+static void RenderMazeLayer(struct Game* game, struct GamestateResources* data) {
+	// The maze doesn't change during a match, so it gets drawn into a layer
+	// once and each frame only blits the visible window out of it. Endless
+	// mazes and ones too big for a texture are drawn tile by tile instead.
+	int width = data->maze->width * 16, height = data->maze->height * 16;
+	int max = al_get_display_option(game->display, ALLEGRO_MAX_BITMAP_SIZE);
+	int x, y;
+
+	data->layer = NULL;
+	if (data->maze->endless || width > max || height > max || width > MAZE_LAYER_MAX_SIZE || height > MAZE_LAYER_MAX_SIZE) {
+		return;
+	}
+
+	int flags = al_get_new_bitmap_flags();
+	al_set_new_bitmap_flags(flags & ~ALLEGRO_MAG_LINEAR);
+	data->layer = CreateNotPreservedBitmap(width, height);
+	al_set_new_bitmap_flags(flags);
+
+	al_set_target_bitmap(data->layer);
+	al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+	al_hold_bitmap_drawing(true);
+	for (y = 0; y < data->maze->height; y++) {
+		for (x = 0; x < data->maze->width; x++) {
+			if (!IsMazeWall(data->maze, x, y)) {
+				al_draw_bitmap(data->tile, x * 16, y * 16, 0);
 			}
 		}
 	}
+	if (data->maze->xGrass >= 0) {
+		al_draw_bitmap(data->grass, data->maze->xGrass * 16, data->maze->yGrass * 16, 0);
+	}
+	al_hold_bitmap_drawing(false);
+	al_set_target_backbuffer(game->display);
+}
+
+static void DrawTile(ALLEGRO_BITMAP* bitmap, struct View* view, float x, float y) {
+	// cut to the maze window
+	float sx = 0, sy = 0, w = 16, h = 16;
+	if (x < view->mapX) {
+		sx = view->mapX - x;
+		w -= sx;
+		x = view->mapX;
+	}
+	if (y < view->mapY) {
+		sy = view->mapY - y;
+		h -= sy;
+		y = view->mapY;
+	}
+	w = fminf(w, view->mapX + view->mapW - x);
+	h = fminf(h, view->mapY + view->mapH - y);
+	if (w > 0 && h > 0) {
+		al_draw_bitmap_region(bitmap, sx, sy, w, h, x, y, 0);
+	}
 }
 
-static void DeleteDeltaTimeFromPulse(struct RhythmPulse* pulse, float deltaTime,
-	struct Player* data, struct Game* game) {
-	float progress = (data->score) / 10000.0f;
-	float speed = SPEED * ((progress + 1));
-	float delatTime = (deltaTime * SPEED) * ((progress + 1));
-	al_set_sample_instance_speed(data->music, speed / 1.1675);
-	if (pulse->timer > -0.25f && pulse->timer - delatTime < -0.25f &&
-		pulse->status == -1) {
-		pulse->status = 0;
-		data->text = "Too Late!";
-		if (data->score >= 50) {
-			data->score -= 50;
+static void DrawMap(struct GamestateResources* data, int id) {
+	struct View* view = &data->player[id].view;
+	// maze coordinates of the window, in pixels
+	int left = data->match.x[id] * 16 - (view->pigX - view->mapX), top = data->match.y[id] * 16 - (view->pigY - view->mapY);
+	int i, j;
+
+	if (data->layer) {
+		// single blit of the window, clipped to the maze
+		int sx = left, sy = top, sw = view->mapW, sh = view->mapH;
+		float dx = view->mapX, dy = view->mapY;
+		if (sx < 0) {
+			dx -= sx;
+			sw += sx;
+			sx = 0;
 		}
-		if (data->score < 50) {
-			data->score = 0;
+		if (sy < 0) {
+			dy -= sy;
+			sh += sy;
+			sy = 0;
 		}
+		if (sx + sw > al_get_bitmap_width(data->layer)) {
+			sw = al_get_bitmap_width(data->layer) - sx;
+		}
+		if (sy + sh > al_get_bitmap_height(data->layer)) {
+			sh = al_get_bitmap_height(data->layer) - sy;
+		}
+		if (sw > 0 && sh > 0) {
+			al_draw_bitmap_region(data->layer, sx, sy, sw, sh, dx, dy, 0);
+		}
+		return;
 	}
-	pulse->timer -= delatTime;
 
-	if (pulse->next) {
-		DeleteDeltaTimeFromPulse(pulse->next, deltaTime, data, game);
+	for (j = (int)floorf(top / 16.0); j * 16 < top + view->mapH; j++) {
+		for (i = (int)floorf(left / 16.0); i * 16 < left + view->mapW; i++) {
+			float x = view->mapX + i * 16 - left, y = view->mapY + j * 16 - top;
+			if (!IsInMaze(data->maze, i, j)) { continue; }
+			if (!IsMazeWall(data->maze, i, j)) {
+				DrawTile(data->tile, view, x, y);
+			}
+			if (j == data->maze->yGrass && i == data->maze->xGrass) {
+				DrawTile(data->grass, view, x, y);
+			}
+		}
 	}
 }
 
-static void MoveEnd(struct RhythmPulse* pulse, struct RhythmPulse* onEnd, float offset) {
-	if (pulse->next == NULL) {
-		pulse->next = onEnd;
-		onEnd->next = NULL;
-		onEnd->status = -1;
-		onEnd->id = pulse->id + 1;
-		if (onEnd->id % 3 == 2) {
-			offset += 1.0;
+static void DrawPigs(struct GamestateResources* data, int id) {
+	struct View* view = &data->player[id].view;
+	int i;
+	for (i = 0; i < data->match.players; i++) {
+		// others only when they're fully inside the window
+		float x = view->pigX + (data->match.x[i] - data->match.x[id]) * 16, y = view->pigY + (data->match.y[i] - data->match.y[id]) * 16;
+		ALLEGRO_COLOR tint = data->player[i].tint;
+		if (i == id || x < view->mapX || y < view->mapY || x + 16 > view->mapX + view->mapW || y + 16 > view->mapY + view->mapH) {
+			continue;
 		}
-		onEnd->timer = pulse->timer + offset;
-	} else {
-		MoveEnd(pulse->next, onEnd, offset);
+		al_draw_tinted_bitmap(GetSprite(data, i), al_map_rgba_f(tint.r * 0.375, tint.g * 0.375, tint.b * 0.375, 1), x, y, 0);
+	}
+	al_draw_tinted_bitmap(GetSprite(data, id), data->player[id].tint, view->pigX, view->pigY, 0);
+}
+
+static void DrawHint(struct GamestateResources* data, int id) {
+	struct View* view = &data->player[id].view;
+	int dx, dy;
+	if (data->hints && data->maze->distance && GetBestMove(data->maze->distance, data->match.x[id], data->match.y[id], &dx, &dy)) {
+		// next best move hint
+		float cx = view->pigX + 8, cy = view->pigY + 8;
+		al_draw_filled_triangle(cx + dx * 14, cy + dy * 14,
+			cx + dx * 9 + dy * 4, cy + dy * 9 + dx * 4,
+			cx + dx * 9 - dy * 4, cy + dy * 9 - dx * 4,
+			al_map_rgba(160, 160, 0, 160));
 	}
 }
 
@@ -258,21 +608,39 @@ void Gamestate_Logic(struct Game* game, struct GamestateResources* data,
 	double delta) {
 	if (data->ended) {
 		UpdateTween(&data->endtween, delta);
+		if (data->net) {
+			// the other side may still be missing our last frames
+			PollNetplay(data->net, al_get_time());
+		}
 		return;
 	}
 
-	DeleteDeltaTimeFromPulse(data->player2->rhythmPulse, delta, data->player2, game);
-	DeleteDeltaTimeFromPulse(data->player1->rhythmPulse, delta, data->player1, game);
-	if (data->player1->rhythmPulse->timer < -5.0f) {
-		struct RhythmPulse* pulse = data->player1->rhythmPulse;
-		data->player1->rhythmPulse = data->player1->rhythmPulse->next;
-		MoveEnd(data->player1->rhythmPulse, pulse, 1);
+	struct MatchCues cues;
+	int64_t clocks[MATCH_MAX_PLAYERS];
+	double now = al_get_time();
+	int i;
+	for (i = 0; i < data->match.players; i++) {
+		UpdateTrack(data->player[i].music);
+		UpdateMusicClock(&data->player[i]);
+		clocks[i] = GetMusicClock(data, &data->player[i], now);
 	}
-	if (data->player2->rhythmPulse->timer < -5.0f) {
-		struct RhythmPulse* pulse = data->player2->rhythmPulse;
-		data->player2->rhythmPulse = data->player2->rhythmPulse->next;
-		MoveEnd(data->player2->rhythmPulse, pulse, 1);
+	if (data->playback) {
+		PlayBackInputs(game, data, clocks);
+	} else {
+		RunBots(game, data, clocks);
 	}
+	if (data->ended) {
+		return;
+	}
+	if (data->net) {
+		// Only our clock matters, the other player's comes with their frames.
+		// When they fall too far behind, the match waits for them.
+		StepNetplay(data->net, clocks[data->net->local], now, &cues);
+		PlayCues(game, data, &cues);
+		return;
+	}
+	StepMatch(&data->match, NULL, 0, clocks, &cues);
+	PlayCues(game, data, &cues);
 }
 
 void Gamestate_Tick(struct Game* game, struct GamestateResources* data) {
@@ -280,188 +648,180 @@ void Gamestate_Tick(struct Game* game, struct GamestateResources* data) {
 	// logic.
 }
 
-static void DrawAllPulse(struct RhythmPulse* pulse, struct Game* game,
-	struct GamestateResources* data, float x) {
-	al_draw_bitmap_region(data->pulseBitmap, 0, 0, 20, 20, x,
-		game->viewport.height / 2.0 - 10 + pulse->timer * 40,
-		0);
-	//al_draw_textf(data->font, al_map_rgb(0, 0, 0), x + 3, game->viewport.height / 2.0 - 10 + pulse->timer * 40 + 3, ALLEGRO_ALIGN_LEFT, "%d", pulse->id);
-
-	if (pulse->next) {
-		DrawAllPulse(pulse->next, game, data, x);
+static void DrawAllPulse(struct GamestateResources* data, int id) {
+	struct View* view = &data->player[id].view;
+	struct BeatQueue* queue = &data->match.beats[id];
+	int64_t clock = data->match.clock[id];
+	unsigned int i;
+	for (i = 0; i < queue->count; i++) {
+		unsigned int slot = BeatSlot(queue, i);
+		float y = view->laneY + GetBeatOffset(&data->match, queue->beat[slot], clock) * view->laneSpacing;
+		if (y < view->y || y + 20 > view->y + view->h) {
+			continue;
+		}
+		al_draw_bitmap_region(data->pulseBitmap, 0, 0, 20, 20, view->laneX, y, 0);
 	}
+	al_draw_bitmap_region(data->pointer, 0, 0, 20, 20, view->laneX, view->laneY, 0);
 }
 
 void Gamestate_Draw(struct Game* game, struct GamestateResources* data) {
 	// Called as soon as possible, but no sooner than next Gamestate_Logic call.
 	// Draw everything to the screen here.
+	int i;
+
+	// Everything up to the text comes either from the maze layer or from
+	// the atlas, so it gets drawn in two batches.
+	al_hold_bitmap_drawing(true);
+	for (i = 0; i < data->match.players; i++) {
+		DrawMap(data, i);
+	}
+	for (i = 0; i < data->match.players; i++) {
+		DrawPigs(data, i);
+		DrawAllPulse(data, i);
+	}
+	al_hold_bitmap_drawing(false);
 
-	DrawMap(data->player1, data->player2, data, 80, 60);
-	DrawMap(data->player2, data->player1, data, 250, 60);
-
-	DrawAllPulse(data->player1->rhythmPulse, game, data,
-		game->viewport.width / 2.0 - 25);
-	DrawAllPulse(data->player2->rhythmPulse, game, data,
-		game->viewport.width / 2.0 + 5);
-	al_draw_bitmap_region(data->pointer, 0, 0, 20, 20,
-		game->viewport.width / 2.0 - 25,
-		game->viewport.height / 2.0f - 10, 0);
-	al_draw_bitmap_region(data->pointer, 0, 0, 20, 20,
-		game->viewport.width / 2.0 + 5,
-		game->viewport.height / 2.0f - 10, 0);
-
-	al_draw_text(data->font, al_map_rgb(255, 255, 255), game->viewport.width / 4.0,
-		game->viewport.height / 1.3f, ALLEGRO_ALIGN_CENTRE,
-		data->player1->text);
-	al_draw_text(data->font, al_map_rgb(255, 255, 255),
-		game->viewport.width * 3 / 4.0, game->viewport.height / 1.3f,
-		ALLEGRO_ALIGN_CENTRE, data->player2->text);
+	for (i = 0; i < data->match.players; i++) {
+		DrawHint(data, i);
+		al_draw_text(data->font, al_map_rgb(255, 255, 255), data->player[i].view.textX,
+			data->player[i].view.textY, ALLEGRO_ALIGN_CENTRE, GetJudgementText(data->match.judgement[i]));
+	}
+
+	if (data->playback) {
+		al_draw_text(data->font, al_map_rgb(128, 128, 128), game->viewport.width / 2.0, 4, ALLEGRO_ALIGN_CENTRE, "REPLAY");
+	}
 
 	if (data->ended) {
 		double offset = GetTweenValue(&data->endtween);
+		char message[32];
+		ALLEGRO_BITMAP* sprite = data->sprites[data->winner->pig][right];
 
 		al_draw_filled_rectangle(0, 0, game->viewport.width, game->viewport.height, al_map_rgba(0, 0, 0, 222));
 
-		al_draw_bitmap(data->winner->player, game->viewport.width / 2.0 - al_get_bitmap_width(data->winner->player) / 2.0, game->viewport.height / 2.0 - 20 - offset, 0);
-		al_draw_textf(data->font, al_map_rgb(255, 255, 255), game->viewport.width / 2.0, game->viewport.height / 2.0 - offset, ALLEGRO_ALIGN_CENTER, "%s player wins!", data->winner == data->player1 ? "Left" : "Right");
+		al_draw_tinted_bitmap(sprite, data->winner->tint, game->viewport.width / 2.0 - al_get_bitmap_width(sprite) / 2.0, game->viewport.height / 2.0 - 20 - offset, 0);
+		GetWinMessage(data, data->winner->id, message, sizeof(message));
+		al_draw_text(data->font, al_map_rgb(255, 255, 255), game->viewport.width / 2.0, game->viewport.height / 2.0 - offset, ALLEGRO_ALIGN_CENTER, message);
+
+		al_draw_textf(data->font, al_map_rgb(128, 128, 128), game->viewport.width / 2.0, game->viewport.height - 12, ALLEGRO_ALIGN_CENTER, "seed: %u", data->maze->seed);
 
 		if (fmod(game->time, 1.0) > 0.2) {
 			al_draw_text(data->font, al_map_rgb(255, 255, 255), game->viewport.width / 2.0, 140, ALLEGRO_ALIGN_CENTER, "<ESCAPE>");
 		}
 	}
+
+	if (!data->drawn) {
+		data->drawn = true;
+		MarkMilestone(game, MILESTONE_PLAYABLE);
+	}
 }
 
 void Gamestate_ProcessEvent(struct Game* game, struct GamestateResources* data,
 	ALLEGRO_EVENT* ev) {
 	// Called for each event in Allegro event queue.
 	// Here you can handle user input, expiring timers etc.
+	int i;
+	enum direction direction;
 	if ((ev->type == ALLEGRO_EVENT_KEY_DOWN) &&
 		(ev->keyboard.keycode == ALLEGRO_KEY_ESCAPE)) {
 		SwitchCurrentGamestate(game, "menu");
 	}
-	if (data->ended) {
-		return;
-	}
-	if ((ev->type == ALLEGRO_EVENT_KEY_DOWN) &&
-		ev->keyboard.keycode == ALLEGRO_KEY_A) {
-		IsGoodPressed(game, data->player1->rhythmPulse, data->player1, data, left);
+	if (ev->type == ALLEGRO_EVENT_JOYSTICK_CONFIGURATION) {
+		al_reconfigure_joysticks();
+		AssignPads(data);
 	}
-	if ((ev->type == ALLEGRO_EVENT_KEY_DOWN) &&
-		(ev->keyboard.keycode == ALLEGRO_KEY_S)) {
-		IsGoodPressed(game, data->player1->rhythmPulse, data->player1, data, down);
+	if (data->ended || data->playback) {
+		return;
 	}
-	if ((ev->type == ALLEGRO_EVENT_KEY_DOWN) &&
-		(ev->keyboard.keycode == ALLEGRO_KEY_W)) {
-		IsGoodPressed(game, data->player1->rhythmPulse, data->player1, data, up);
+	for (i = 0; i < data->match.players; i++) {
+		struct Player* player = &data->player[i];
+		if (ev->type == ALLEGRO_EVENT_KEY_DOWN) {
+			for (direction = up; direction <= right; direction++) {
+				if (player->keys[direction] && ev->keyboard.keycode == player->keys[direction]) {
+					PressKey(game, data, player, direction, ev->any.timestamp);
+				}
+			}
+		}
+		if ((ev->type == ALLEGRO_EVENT_JOYSTICK_AXIS) && player->pad && (ev->joystick.id == player->pad)) {
+			MovePadStick(game, data, player, ev);
+		}
 	}
-	if ((ev->type == ALLEGRO_EVENT_KEY_DOWN) &&
-		(ev->keyboard.keycode == ALLEGRO_KEY_D)) {
-		IsGoodPressed(game, data->player1->rhythmPulse, data->player1, data, right);
+}
+
+static void CreatePlayerSounds(struct Game* game, struct GamestateResources* data, struct Player* player) {
+	// Players alternate between the two voices, so that each side can be
+	// sent to a different output.
+	ALLEGRO_MIXER* music = (player->id % 2) ? game->data->audio.music : game->audio.music;
+	ALLEGRO_MIXER* fx = (player->id % 2) ? game->data->audio.fx : game->audio.fx;
+	// Every player plays the same music at their own tempo, which speeds up
+	// without the pitch going up with it.
+	if (!player->music) {
+		player->music = CreateTrack(data->music, GetDataFilePath(game, "music.flac"), music);
 	}
+	player->ding = CreateInstance(data->ding_sample, fx, ALLEGRO_PLAYMODE_ONCE);
+	player->wrong_way = CreateInstance(data->wrong_way, fx, ALLEGRO_PLAYMODE_ONCE);
+}
 
-	if ((ev->type == ALLEGRO_EVENT_KEY_DOWN) &&
-		ev->keyboard.keycode == ALLEGRO_KEY_LEFT) {
-		IsGoodPressed(game, data->player2->rhythmPulse, data->player2, data, left);
+static struct NetLink* ConnectNetplay(struct Game* game, struct GamestateResources* data, struct NetplaySetup* setup, int* local) {
+	// With netplay set to "host", waits for someone to join and sends them
+	// the maze and sample rate; otherwise it's the address of the host to
+	// join, whose maze replaces ours. The network can be made worse for
+	// testing with netlatency, netjitter (in milliseconds) and netloss.
+	const char* address = GetConfigOption(game, "ZjedzTrawke2", "netplay");
+	int port = strtol(GetConfigOptionDefault(game, "ZjedzTrawke2", "netport", "7766"), NULL, 10);
+	double timeout = strtod(GetConfigOptionDefault(game, "ZjedzTrawke2", "nettimeout", "30"), NULL);
+	struct NetConditions conditions = {
+		.latency = strtod(GetConfigOptionDefault(game, "ZjedzTrawke2", "netlatency", "0"), NULL) / 1000.0,
+		.jitter = strtod(GetConfigOptionDefault(game, "ZjedzTrawke2", "netjitter", "0"), NULL) / 1000.0,
+		.loss = strtof(GetConfigOptionDefault(game, "ZjedzTrawke2", "netloss", "0"), NULL),
+	};
+	bool host = !strcmp(address, "host"), connected = false;
+	double start = al_get_time(), now = start;
+
+	if (game->data->endless) {
+		PrintConsole(game, "Netplay doesn't support endless races, playing locally");
+		return NULL;
 	}
-	if ((ev->type == ALLEGRO_EVENT_KEY_DOWN) &&
-		(ev->keyboard.keycode == ALLEGRO_KEY_DOWN)) {
-		IsGoodPressed(game, data->player2->rhythmPulse, data->player2, data, down);
+	struct NetLink* link = CreateUdpLink(host ? NULL : address, port);
+	if (!link) {
+		PrintConsole(game, "Couldn't open a connection on port %d, playing locally", port);
+		return NULL;
 	}
-	if ((ev->type == ALLEGRO_EVENT_KEY_DOWN) &&
-		(ev->keyboard.keycode == ALLEGRO_KEY_UP)) {
-		IsGoodPressed(game, data->player2->rhythmPulse, data->player2, data, up);
+	if (conditions.latency > 0 || conditions.jitter > 0 || conditions.loss > 0) {
+		link = CreateImpairedLink(link, &conditions, rand());
 	}
-	if ((ev->type == ALLEGRO_EVENT_KEY_DOWN) &&
-		(ev->keyboard.keycode == ALLEGRO_KEY_RIGHT)) {
-		IsGoodPressed(game, data->player2->rhythmPulse, data->player2, data, right);
+	if (host) {
+		PrintConsole(game, "Waiting for the other player on port %d...", port);
+	} else {
+		PrintConsole(game, "Joining %s:%d...", address, port);
 	}
-}
-
-static void CarveMaze(char* maze, int width, int height, int x, int y) {
-	int x1, y1;
-	int x2, y2;
-	int dx, dy;
-	int dir, count;
-
-	dir = rand() % 4;
-	count = 0;
-	while (count < 4) {
-		dx = 0;
-		dy = 0;
-		switch (dir) {
-			case 0:
-				dx = 1;
-				break;
-			case 1:
-				dy = 1;
-				break;
-			case 2:
-				dx = -1;
-				break;
-			default:
-				dy = -1;
-				break;
-		}
-		x1 = x + dx;
-		y1 = y + dy;
-		x2 = x1 + dx;
-		y2 = y1 + dy;
-		if (x2 > 0 && x2 < width && y2 > 0 && y2 < height &&
-			maze[y1 * width + x1] == 1 && maze[y2 * width + x2] == 1) {
-			maze[y1 * width + x1] = 0;
-			maze[y2 * width + x2] = 0;
-			x = x2;
-			y = y2;
-			dir = rand() % 4;
-			count = 0;
+	while (!connected && now - start < timeout) {
+		if (host) {
+			connected = ReceiveNetplaySetup(link, NULL, now);
 		} else {
-			dir = (dir + 1) % 4;
-			count += 1;
+			SendNetplaySetup(link, NULL, now);
+			connected = ReceiveNetplaySetup(link, setup, now);
 		}
-	}
-}
-
-/* Generate maze in matrix maze with size width, height. */
-static void GenerateMaze(char* maze, int width, int height) {
-	int x, y;
-
-	/* Initialize the maze. */
-	for (x = 0; x < width * height; x++) {
-		maze[x] = 1;
-	}
-	maze[1 * width + 1] = 0;
-
-	/* Carve the maze. */
-	for (y = 1; y < height; y += 2) {
-		for (x = 1; x < width; x += 2) {
-			CarveMaze(maze, width, height, x, y);
+		if (!connected) {
+			al_rest(0.1);
+			now = al_get_time();
 		}
 	}
+	if (!connected) {
+		PrintConsole(game, "Nobody to play with, playing locally");
+		link->destroy(link);
+		return NULL;
+	}
 
-	/* Set up the entry and exit. */
-	maze[0 * width + 1] = 0;
-	maze[(height - 1) * width + (width - 2)] = 0;
-}
-
-/* Display the maze. */
-static void ShowMaze(const char* maze, int width, int height) {
-	int x, y;
-	for (y = 0; y < height; y++) {
-		for (x = 0; x < width; x++) {
-			switch (maze[y * width + x]) {
-				case 1:
-					printf("[]");
-					break;
-				case 2:
-					printf("<>");
-					break;
-				default:
-					printf("  ");
-					break;
-			}
-		}
-		printf("\n");
+	if (host) {
+		SendNetplaySetup(link, setup, now);
+	} else if (setup->seed != data->maze->seed || setup->width != data->maze->width || setup->height != data->maze->height) {
+		DestroyMaze(data->maze);
+		data->maze = CreateMaze(setup->width, setup->height, setup->seed);
+		data->maze->distance = CreateDistanceField(data->maze, data->maze->xGrass, data->maze->yGrass);
 	}
+	*local = host ? 0 : 1;
+	PrintConsole(game, "Connected, playing as player %d", *local + 1);
+	return link;
 }
 
 void* Gamestate_Load(struct Game* game, void (*progress)(struct Game*)) {
@@ -475,144 +835,116 @@ void* Gamestate_Load(struct Game* game, void (*progress)(struct Game*)) {
 	// require main OpenGL context.
 
 	struct GamestateResources* data = calloc(1, sizeof(struct GamestateResources));
-	int flags = al_get_new_bitmap_flags();
-	al_set_new_bitmap_flags(flags ^ ALLEGRO_MAG_LINEAR); // disable linear scaling for pixelarty appearance
-	data->font = al_create_builtin_font();
-	data->pulseBitmap = al_load_bitmap(GetDataFilePath(game, "Sprites/rythmPulse.png"));
-	data->pointer = al_load_bitmap(GetDataFilePath(game, "Sprites/line.png"));
-	data->tile = al_load_bitmap(GetDataFilePath(game, "Sprites/tile.png"));
-	data->grass = al_load_bitmap(GetDataFilePath(game, "Sprites/grass.png"));
+	int flags = al_get_new_bitmap_flags(), i;
+	al_set_new_bitmap_flags(flags & ~ALLEGRO_MAG_LINEAR); // disable linear scaling for pixelarty appearance
+
+	// Everything gets decoded in parallel by the asset workers, what the
+	// first frame needs first, while the steps below wait for each asset in
+	// turn. The end sounds are picked up only once the match is over.
+	PrefetchBitmap(game->data->assets, GetDataFilePath(game, "Sprites/tile.png"), ASSET_PRIORITY_HIGH);
+	PrefetchBitmap(game->data->assets, GetDataFilePath(game, "Sprites/grass.png"), ASSET_PRIORITY_HIGH);
+	PrefetchBitmap(game->data->assets, GetDataFilePath(game, "Sprites/swinka_kolor.png"), ASSET_PRIORITY_HIGH);
+	PrefetchBitmap(game->data->assets, GetDataFilePath(game, "Sprites/swinka_czb.png"), ASSET_PRIORITY_HIGH);
+	PrefetchBitmap(game->data->assets, GetDataFilePath(game, "Sprites/rythmPulse.png"), ASSET_PRIORITY_HIGH);
+	PrefetchBitmap(game->data->assets, GetDataFilePath(game, "Sprites/line.png"), ASSET_PRIORITY_HIGH);
+	PrefetchSample(game->data->assets, GetDataFilePath(game, "ding.flac"), ASSET_PRIORITY_NORMAL);
+	PrefetchSample(game->data->assets, GetDataFilePath(game, "efekt.flac"), ASSET_PRIORITY_NORMAL);
+	PrefetchSample(game->data->assets, GetDataFilePath(game, "tada.flac"), ASSET_PRIORITY_LOW);
+	PrefetchSample(game->data->assets, GetDataFilePath(game, "no.flac"), ASSET_PRIORITY_LOW);
+
+	data->font = AcquireBuiltinFont(game->data->assets);
+	data->pulseBitmap = AcquireBitmap(game->data->assets, GetDataFilePath(game, "Sprites/rythmPulse.png"));
+	data->pointer = AcquireBitmap(game->data->assets, GetDataFilePath(game, "Sprites/line.png"));
+	data->tile = AcquireBitmap(game->data->assets, GetDataFilePath(game, "Sprites/tile.png"));
+	data->grass = AcquireBitmap(game->data->assets, GetDataFilePath(game, "Sprites/grass.png"));
 	progress(game); // report that we progressed with the loading, so the engine
 	// can move a progress bar
-	data->player1 = malloc(sizeof(struct Player));
-	data->player2 = malloc(sizeof(struct Player));
-	data->player1->text = "";
-	data->player1->rhythmPulse = malloc(sizeof(struct RhythmPulse));
-	data->player1->rhythmPulse->timer = 0;
-	data->player1->rhythmPulse->id = 0;
-	data->player1->score = 0;
-	data->player1->angle = 0.5 * ALLEGRO_PI;
-	(*progress)(game);
 
-	data->player1->player = al_load_bitmap(GetDataFilePath(game, "Sprites/swinka_kolor.png"));
-	(*progress)(game);
-	data->player2->player = al_load_bitmap(GetDataFilePath(game, "Sprites/swinka_czb.png"));
+	data->pigs[0] = AcquireBitmap(game->data->assets, GetDataFilePath(game, "Sprites/swinka_kolor.png"));
 	(*progress)(game);
-
-	data->player2->text = "";
-	data->player2->rhythmPulse = malloc(sizeof(struct RhythmPulse));
-	data->player2->rhythmPulse->timer = 0;
-	data->player2->rhythmPulse->id = 0;
-	data->player2->score = 0;
-	data->player2->angle = 0.5 * ALLEGRO_PI;
+	data->pigs[1] = AcquireBitmap(game->data->assets, GetDataFilePath(game, "Sprites/swinka_czb.png"));
 	(*progress)(game);
 
-	data->map = malloc(MAZE_WIDTH * MAZE_HEIGHT * sizeof(char));
-	GenerateMaze(data->map, MAZE_WIDTH, MAZE_HEIGHT);
-	ShowMaze(data->map, MAZE_WIDTH, MAZE_HEIGHT);
-	struct RhythmPulse* pulse = data->player1->rhythmPulse;
-	pulse->status = -1;
-	pulse->timer = 0;
-	int i;
-	for (i = 1; i <= 10; i++) {
-		if (i % 4 == 3) {
-			continue;
-		}
-		pulse->next = malloc(sizeof(struct RhythmPulse));
-		pulse = pulse->next;
-		pulse->timer = (float)i;
-		pulse->status = -1;
-		pulse->id = i;
-		(*progress)(game);
-	}
-	pulse->next = NULL;
-
-	struct RhythmPulse* pulse2 = data->player2->rhythmPulse;
-	pulse2->status = -1;
-	pulse2->timer = 0;
-	for (i = 1; i <= 10; i++) {
-		if (i % 4 == 3) {
-			continue;
-		}
-		pulse2->next = malloc(sizeof(struct RhythmPulse));
-		pulse2 = pulse2->next;
-		pulse2->timer = (float)i;
-		pulse2->status = -1;
-		pulse2->id = i;
-		(*progress)(game);
-	}
-	pulse2->next = NULL;
-	data->player1->x = 1;
-	data->player1->y = 0;
-	data->player2->x = 1;
-	data->player2->y = 0;
-	int j;
-	char flag = 0;
-	for (i = MAZE_WIDTH - 1; i >= 0; i--) {
-		for (j = MAZE_HEIGHT - 1; j >= 0; j--) {
-			if (data->map[i + (j)*MAZE_WIDTH] != 1) {
-				data->xGrass = i;
-				data->yGrass = j;
-				flag = 1;
-				break;
-			}
+	const char* seed = GetConfigOption(game, "ZjedzTrawke2", "seed");
+	const char* replay = GetConfigOption(game, "ZjedzTrawke2", "replay");
+	if (replay) {
+		data->replay = LoadReplay(replay);
+		if (!data->replay) {
+			PrintConsole(game, "Couldn't load replay %s", replay);
 		}
-		if (flag) {
-			break;
+	}
+	if (!data->replay && !GetConfigOption(game, "ZjedzTrawke2", "netplay") && ResumeSuspendedMatch(game, data)) {
+		data->resumed = true;
+	} else if (data->replay) {
+		data->playback = true;
+		data->maze = CreateReplayMaze(data->replay);
+		if (!data->maze->endless) {
+			data->maze->distance = CreateDistanceField(data->maze, data->maze->xGrass, data->maze->yGrass);
 		}
+	} else if (game->data->endless) {
+		data->maze = CreateEndlessMaze(game->data->mazeWidth, seed ? strtoul(seed, NULL, 10) : (uint32_t)rand());
+	} else if (seed) {
+		// replay a reported match
+		data->maze = CreateMaze(game->data->mazeWidth, game->data->mazeHeight, strtoul(seed, NULL, 10));
+		data->maze->distance = CreateDistanceField(data->maze, data->maze->xGrass, data->maze->yGrass);
+	} else {
+		data->maze = TakeMaze(game->data->mazes);
 	}
-
-	data->music_sample = al_load_sample(GetDataFilePath(game, "music.flac"));
-	data->player1->music = al_create_sample_instance(data->music_sample);
-	al_attach_sample_instance_to_mixer(data->player1->music, game->audio.music);
-	al_set_sample_instance_playmode(data->player1->music, ALLEGRO_PLAYMODE_LOOP);
-	(*progress)(game);
-
-	data->player2->music = al_create_sample_instance(data->music_sample);
-	al_attach_sample_instance_to_mixer(data->player2->music, game->data->audio.music);
-	al_set_sample_instance_playmode(data->player2->music, ALLEGRO_PLAYMODE_LOOP);
-	(*progress)(game);
-
-	data->ding_sample = al_load_sample(GetDataFilePath(game, "ding.flac"));
-	data->player1->ding = al_create_sample_instance(data->ding_sample);
-	al_attach_sample_instance_to_mixer(data->player1->ding, game->audio.fx);
-	al_set_sample_instance_playmode(data->player1->ding, ALLEGRO_PLAYMODE_ONCE);
+	if (data->maze->width <= 64) {
+		ShowMaze(data->maze);
+	}
+	data->hints = strtol(GetConfigOptionDefault(game, "ZjedzTrawke2", "hints", "0"), NULL, 10);
+	data->latency = strtod(GetConfigOptionDefault(game, "ZjedzTrawke2", "latency", "0"), NULL) / 1000.0;
 	(*progress)(game);
 
-	data->player2->ding = al_create_sample_instance(data->ding_sample);
-	al_attach_sample_instance_to_mixer(data->player2->ding, game->data->audio.fx);
-	al_set_sample_instance_playmode(data->player2->ding, ALLEGRO_PLAYMODE_ONCE);
+	// the first player's track tells the sample rate
+	data->music = OpenSource(GetDataFilePath(game, "music.flac"));
+	if (!data->music) {
+		PrintConsole(game, "Couldn't decode the music in blocks (no libFLAC in this build, or not a FLAC file); its pitch will go up with the tempo");
+	}
+	data->player[0].music = CreateTrack(data->music, GetDataFilePath(game, "music.flac"), game->audio.music);
+	int players = data->playback ? data->replay->players : game->data->players;
+	struct NetplaySetup setup = {data->maze->seed, data->maze->width, data->maze->height,
+		data->playback ? data->replay->rate : (int)GetTrackFrequency(data->player[0].music)};
+	struct NetLink* link = NULL;
+	int local = 0;
+	if (!data->playback && !data->resumed && GetConfigOption(game, "ZjedzTrawke2", "netplay")) {
+		link = ConnectNetplay(game, data, &setup, &local);
+		players = link ? NETPLAY_PLAYERS : players;
+	}
+	if (!data->resumed) {
+		InitMatch(&data->match, data->maze, players, setup.rate);
+	}
+	if (!data->playback) {
+		data->replay = CreateReplay(&data->match);
+	}
+	if (link) {
+		data->net = CreateNetplay(link, &data->match, local);
+		data->net->replay = data->replay;
+	}
+	PrerenderWinMessages(game, data);
 	(*progress)(game);
-
-	data->wrong_way = al_load_sample(GetDataFilePath(game, "efekt.flac"));
-	data->player1->wrong_way = al_create_sample_instance(data->wrong_way);
-	al_attach_sample_instance_to_mixer(data->player1->wrong_way, game->audio.fx);
-	al_set_sample_instance_playmode(data->player1->wrong_way, ALLEGRO_PLAYMODE_ONCE);
-
-	data->player2->wrong_way = al_create_sample_instance(data->wrong_way);
-	al_attach_sample_instance_to_mixer(data->player2->wrong_way, game->data->audio.fx);
-	al_set_sample_instance_playmode(data->player2->wrong_way, ALLEGRO_PLAYMODE_ONCE);
-
-	data->no_sample = al_load_sample(GetDataFilePath(game, "no.flac"));
-	data->player1->no = al_create_sample_instance(data->no_sample);
-	al_attach_sample_instance_to_mixer(data->player1->no, game->audio.fx);
-	al_set_sample_instance_playmode(data->player1->no, ALLEGRO_PLAYMODE_ONCE);
+	data->ding_sample = AcquireSample(game->data->assets, GetDataFilePath(game, "ding.flac"));
 	(*progress)(game);
-
-	data->player2->no = al_create_sample_instance(data->no_sample);
-	al_attach_sample_instance_to_mixer(data->player2->no, game->data->audio.fx);
-	al_set_sample_instance_playmode(data->player2->no, ALLEGRO_PLAYMODE_ONCE);
+	data->wrong_way = AcquireSample(game->data->assets, GetDataFilePath(game, "efekt.flac"));
 	(*progress)(game);
 
-	data->tada_sample = al_load_sample(GetDataFilePath(game, "tada.flac"));
-	data->player1->tada = al_create_sample_instance(data->tada_sample);
-	al_attach_sample_instance_to_mixer(data->player1->tada, game->audio.fx);
-	al_set_sample_instance_playmode(data->player1->tada, ALLEGRO_PLAYMODE_ONCE);
-	(*progress)(game);
-
-	data->player2->tada = al_create_sample_instance(data->tada_sample);
-	al_attach_sample_instance_to_mixer(data->player2->tada, game->data->audio.fx);
-	al_set_sample_instance_playmode(data->player2->tada, ALLEGRO_PLAYMODE_ONCE);
+	for (i = 0; i < data->match.players; i++) {
+		struct Player* player = &data->player[i];
+		player->id = i;
+		player->pig = i ? 1 : 0;
+		player->tint = al_map_rgb(tints[i][0], tints[i][1], tints[i][2]);
+		CreatePlayerSounds(game, data, player);
+		if (data->net && i != data->net->local) {
+			player->padIndex = -1; // played on the other side
+			continue;
+		}
+		// over the network, each side uses the controls of the first slot
+		LoadControls(game, player, data->net ? 0 : i);
+		if (!data->playback) {
+			CreatePlayerBot(game, player);
+		}
+	}
 	(*progress)(game);
 
 	al_set_new_bitmap_flags(flags);
@@ -620,94 +952,147 @@ void* Gamestate_Load(struct Game* game, void (*progress)(struct Game*)) {
 	return data;
 }
 
-static void FreePulse(struct RhythmPulse* pulse) {
-	if (pulse->next != NULL) {
-		FreePulse(pulse->next);
+static ALLEGRO_BITMAP* CopyToAtlas(struct Game* game, struct GamestateResources* data, ALLEGRO_BITMAP* bitmap, int x, int y) {
+	int w = al_get_bitmap_width(bitmap), h = al_get_bitmap_height(bitmap);
+	al_draw_bitmap(bitmap, x, y, 0);
+	ReleaseAsset(game->data->assets, bitmap);
+	return al_create_sub_bitmap(data->atlas, x, y, w, h);
+}
+
+static void CreatePigSprites(struct Game* game, struct GamestateResources* data, int pig, int y) {
+	enum direction direction;
+	for (direction = up; direction <= right; direction++) {
+		al_draw_rotated_bitmap(data->pigs[pig], 8, 8, direction * 16 + 8, y + 8, FacingAngle(direction), 0);
+		data->sprites[pig][direction] = al_create_sub_bitmap(data->atlas, direction * 16, y, 16, 16);
 	}
-	free(pulse);
+	ReleaseAsset(game->data->assets, data->pigs[pig]);
+	data->pigs[pig] = NULL;
+}
+
+void Gamestate_PostLoad(struct Game* game, struct GamestateResources* data) {
+	// Pack all the play field sprites into one texture, with the pigs
+	// pre-rotated in all four directions. The sprites were decoded by the
+	// asset workers and get turned into textures first.
+	//   0: tile, grass
+	//  16: colour pig, 32: grey pig (up, down, left, right)
+	//  48: beat pulse, pointer
+	int flags = al_get_new_bitmap_flags();
+	UploadAssets(game->data->assets);
+	al_set_new_bitmap_flags(flags & ~ALLEGRO_MAG_LINEAR);
+	data->atlas = al_create_bitmap(64, 68);
+	al_set_new_bitmap_flags(flags);
+
+	al_set_target_bitmap(data->atlas);
+	al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+	data->tile = CopyToAtlas(game, data, data->tile, 0, 0);
+	data->grass = CopyToAtlas(game, data, data->grass, 16, 0);
+	CreatePigSprites(game, data, 0, 16);
+	CreatePigSprites(game, data, 1, 32);
+	data->pulseBitmap = CopyToAtlas(game, data, data->pulseBitmap, 0, 48);
+	data->pointer = CopyToAtlas(game, data, data->pointer, 20, 48);
+	al_set_target_backbuffer(game->display);
+
+	RenderMazeLayer(game, data);
 }
 
 void Gamestate_Unload(struct Game* game, struct GamestateResources* data) {
 	// Called when the gamestate library is being unloaded.
 	// Good place for freeing all allocated memory and resources.
-
-	al_destroy_sample_instance(data->player1->music);
-	al_destroy_sample_instance(data->player2->music);
-	al_destroy_sample_instance(data->player1->ding);
-	al_destroy_sample_instance(data->player2->ding);
-	al_destroy_sample_instance(data->player1->tada);
-	al_destroy_sample_instance(data->player2->tada);
-	al_destroy_sample_instance(data->player1->no);
-	al_destroy_sample_instance(data->player2->no);
-	al_destroy_sample_instance(data->player1->wrong_way);
-	al_destroy_sample_instance(data->player2->wrong_way);
-	al_destroy_sample(data->music_sample);
-	al_destroy_sample(data->ding_sample);
-	al_destroy_sample(data->tada_sample);
-	al_destroy_sample(data->no_sample);
-	al_destroy_sample(data->wrong_way);
-
-	al_destroy_bitmap(data->player1->player);
-	al_destroy_bitmap(data->player2->player);
+	int i, j;
+	for (i = 0; i < data->match.players; i++) {
+		DestroyTrack(data->player[i].music);
+		al_destroy_sample_instance(data->player[i].ding);
+		if (data->player[i].tada) {
+			al_destroy_sample_instance(data->player[i].tada);
+			al_destroy_sample_instance(data->player[i].no);
+		}
+		al_destroy_sample_instance(data->player[i].wrong_way);
+		free(data->player[i].bot);
+	}
+	ReleaseAsset(game->data->assets, data->ding_sample);
+	ReleaseAsset(game->data->assets, data->tada_sample);
+	ReleaseAsset(game->data->assets, data->no_sample);
+	ReleaseAsset(game->data->assets, data->wrong_way);
+	CloseSource(data->music);
+
+	for (i = 0; i < 2; i++) {
+		for (j = 0; j < 4; j++) {
+			al_destroy_bitmap(data->sprites[i][j]);
+		}
+	}
 
 	al_destroy_bitmap(data->pulseBitmap);
 	al_destroy_bitmap(data->pointer);
 	al_destroy_bitmap(data->grass);
 	al_destroy_bitmap(data->tile);
+	al_destroy_bitmap(data->atlas);
+	if (data->layer) {
+		al_destroy_bitmap(data->layer);
+	}
 
-	al_destroy_font(data->font);
-	FreePulse(data->player1->rhythmPulse);
-	FreePulse(data->player2->rhythmPulse);
-	free(data->player1);
-	free(data->player2);
-	free(data->map);
+	ReleaseAsset(game->data->assets, data->font);
+	if (data->net) {
+		DestroyNetplay(data->net);
+	}
+	DestroyReplay(data->replay);
+	DestroyMaze(data->maze);
 	free(data);
 }
 
 void Gamestate_Start(struct Game* game, struct GamestateResources* data) {
 	// Called when this gamestate gets control. Good place for initializing state,
 	// playing music etc.
-	al_play_sample_instance(data->player1->music);
-	al_play_sample_instance(data->player2->music);
-
-	if (game->data->pan) {
-		al_set_sample_instance_pan(data->player1->music, -1.0);
-		al_set_sample_instance_pan(data->player2->music, 1.0);
-
-		al_set_sample_instance_pan(data->player1->ding, -1.0);
-		al_set_sample_instance_pan(data->player2->ding, 1.0);
-
-		al_set_sample_instance_pan(data->player1->no, -1.0);
-		al_set_sample_instance_pan(data->player2->no, 1.0);
-
-		al_set_sample_instance_pan(data->player1->tada, -1.0);
-		al_set_sample_instance_pan(data->player2->tada, 1.0);
-
-		al_set_sample_instance_pan(data->player1->wrong_way, -1.0);
-		al_set_sample_instance_pan(data->player2->wrong_way, 1.0);
+	int i;
+	SetProfilerScope(game, "game");
+	data->drawn = false;
+	LayOutViews(game, data);
+	AssignPads(data);
+	for (i = 0; i < data->match.players; i++) {
+		struct Player* player = &data->player[i];
+		// a resumed match carries on where its music was
+		SeekMusic(player, data->match.clock[i] % GetMusicLength(player));
+		SetTrackSpeed(player->music, GetMusicSpeed(&data->match, i));
+		SetTrackPlaying(player->music, true);
+		ResetMusicClock(player, data->match.clock[i]);
+
+		if (game->data->pan) {
+			// spread from left to right
+			float pan = (data->match.players > 1) ? -1.0 + 2.0 * i / (data->match.players - 1) : 0.0;
+			SetTrackPan(player->music, pan);
+			al_set_sample_instance_pan(player->ding, pan);
+			al_set_sample_instance_pan(player->wrong_way, pan);
+		}
 	}
 }
 
 void Gamestate_Stop(struct Game* game, struct GamestateResources* data) {
 	// Called when gamestate gets stopped. Stop timers, music etc. here.
+	SaveMatchReplay(game, data);
+	DiscardSuspendedMatch();
 }
 
 void Gamestate_Pause(struct Game* game, struct GamestateResources* data) {
 	// Called when gamestate gets paused (so only Draw is being called, no Logic
 	// nor ProcessEvent)
 	// Pause your timers and/or sounds here.
-	data->pos1 = al_get_sample_instance_position(data->player1->music);
-	data->pos2 = al_get_sample_instance_position(data->player2->music);
-	al_set_sample_instance_playing(data->player1->music, false);
-	al_set_sample_instance_playing(data->player2->music, false);
+	int i;
+	for (i = 0; i < data->match.players; i++) {
+		data->player[i].paused = GetMusicPosition(&data->player[i]);
+		SetTrackPlaying(data->player[i].music, false);
+	}
+	SuspendMatch(game, data);
 }
 
 void Gamestate_Resume(struct Game* game, struct GamestateResources* data) {
 	// Called when gamestate gets resumed. Resume your timers and/or sounds here.
-	al_set_sample_instance_playing(data->player1->music, true);
-	al_set_sample_instance_playing(data->player2->music, true);
-	al_set_sample_instance_position(data->player1->music, data->pos1);
-	al_set_sample_instance_position(data->player2->music, data->pos2);
+	int i;
+	for (i = 0; i < data->match.players; i++) {
+		SeekMusic(&data->player[i], data->player[i].paused);
+		SetTrackPlaying(data->player[i].music, true);
+		// the clocks carry on from where they were stopped
+		ResetMusicClock(&data->player[i], data->match.clock[i]);
+	}
+	DiscardSuspendedMatch();
 }
 
 void Gamestate_Reload(struct Game* game, struct GamestateResources* data) {
@@ -715,4 +1100,8 @@ void Gamestate_Reload(struct Game* game, struct GamestateResources* data) {
 	// recreated.
 	// Unless you want to support mobile platforms, you should be able to ignore
 	// it.
+	if (data->layer) {
+		al_destroy_bitmap(data->layer);
+	}
+	RenderMazeLayer(game, data);
 }
@@ -20,6 +20,8 @@
  */
 
 #include "../common.h"
+#include "../assets.h"
+#include "../profiler.h"
 #include <libsuperderpy.h>
 
 #define NEXT_GAMESTATE "menu"
@@ -62,7 +64,7 @@ void* Gamestate_Load(struct Game* game, void (*progress)(struct Game*)) {
 	int flags = al_get_new_bitmap_flags();
 	al_set_new_bitmap_flags(flags ^ ALLEGRO_MAG_LINEAR);
 
-	data->bmp = al_load_bitmap(GetDataFilePath(game, "holypangolin.webp"));
+	data->bmp = AcquireBitmap(game->data->assets, GetDataFilePath(game, "holypangolin.webp"));
 	progress(game); // report that we progressed with the loading, so the engine can draw a progress bar
 
 	data->monkeys = al_load_audio_stream(GetDataFilePath(game, "holypangolin.flac"), 4, 1024);
@@ -76,12 +78,13 @@ void* Gamestate_Load(struct Game* game, void (*progress)(struct Game*)) {
 }
 
 void Gamestate_Unload(struct Game* game, struct GamestateResources* data) {
-	al_destroy_bitmap(data->bmp);
+	ReleaseAsset(game->data->assets, data->bmp);
 	al_destroy_audio_stream(data->monkeys);
 	free(data);
 }
 
 void Gamestate_Start(struct Game* game, struct GamestateResources* data) {
+	SetProfilerScope(game, "holypangolin");
 	data->counter = 0;
 	al_rewind_audio_stream(data->monkeys);
 	al_set_audio_stream_playing(data->monkeys, true);
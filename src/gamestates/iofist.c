@@ -19,6 +19,8 @@
  */
 
 #include "../common.h"
+#include "../assets.h"
+#include "../profiler.h"
 #include <libsuperderpy.h>
 
 #define NEXT_GAMESTATE "holypangolin"
@@ -69,7 +71,7 @@ void* Gamestate_Load(struct Game* game, void (*progress)(struct Game*)) {
 	al_set_new_bitmap_flags(flags ^ ALLEGRO_MAG_LINEAR); // disable linear scaling for pixelarty appearance
 
 	progress(game); // report that we progressed with the loading, so the engine can move a progress bar
-	data->logo = al_load_bitmap(GetDataFilePath(game, "Sprites/iofist.png"));
+	data->logo = AcquireBitmap(game->data->assets, GetDataFilePath(game, "Sprites/iofist.png"));
 
 	al_set_new_bitmap_flags(flags);
 	return data;
@@ -78,13 +80,14 @@ void* Gamestate_Load(struct Game* game, void (*progress)(struct Game*)) {
 void Gamestate_Unload(struct Game* game, struct GamestateResources* data) {
 	// Called when the gamestate library is being unloaded.
 	// Good place for freeing all allocated memory and resources.
-	al_destroy_bitmap(data->logo);
+	ReleaseAsset(game->data->assets, data->logo);
 	free(data);
 }
 
 void Gamestate_Start(struct Game* game, struct GamestateResources* data) {
 	// Called when this gamestate gets control. Good place for initializing state,
 	// playing music etc.
+	SetProfilerScope(game, "iofist");
 }
 
 void Gamestate_Stop(struct Game* game, struct GamestateResources* data) {
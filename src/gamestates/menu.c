@@ -20,6 +20,8 @@
  */
 
 #include "../common.h"
+#include "../assets.h"
+#include "../profiler.h"
 #include <allegro5/allegro_primitives.h>
 #include <libsuperderpy.h>
 #include <math.h>
@@ -39,15 +41,15 @@ struct GamestateResources {
 
 int Gamestate_ProgressCount = 1; // number of loading steps as reported by Gamestate_Load
 
-static char* texts[] = {"Play", "Options", "Extras", "Quit",
-	"Fullscreen: on", "Music: on", "Sounds: on", "Voice: on", "Pan to stereo channels: on", "Back",
-	"Fullscreen: off", "Music: off", "Sounds: off", "Voice: off", "Pan to stereo channels: off", "Back"};
+static char* texts[] = {"Play", "Options", "Endless race", "Quit",
+	"Fullscreen: on", "Music: on", "Sounds: on", "Voice: on", "Pan to stereo channels: on", "Calibrate latency", "Back",
+	"Fullscreen: off", "Music: off", "Sounds: off", "Voice: off", "Pan to stereo channels: off", "Calibrate latency", "Back"};
 
 static void AdjustOption(struct Game* game, struct GamestateResources* data) {
 	switch (data->option) {
 		case 4:
 			if (!game->config.fullscreen) {
-				data->option += 6;
+				data->option += 7;
 			}
 #ifdef ALLEGRO_ANDROID
 			data->option++;
@@ -55,50 +57,50 @@ static void AdjustOption(struct Game* game, struct GamestateResources* data) {
 			break;
 		case 5:
 			if (!game->config.music) {
-				data->option += 6;
+				data->option += 7;
 			}
 			break;
 		case 6:
 			if (!game->config.fx) {
-				data->option += 6;
+				data->option += 7;
 			}
 			break;
 		case 7:
 			if (!game->config.voice) {
-				data->option += 6;
+				data->option += 7;
 			}
 			break;
 		case 8:
 			if (!game->data->pan) {
-				data->option += 6;
+				data->option += 7;
 			}
 			break;
-		case 10:
+		case 11:
 			if (game->config.fullscreen) {
-				data->option -= 6;
+				data->option -= 7;
 			}
 #ifdef ALLEGRO_ANDROID
 			data->option++;
 #endif
 			break;
-		case 11:
+		case 12:
 			if (game->config.music) {
-				data->option -= 6;
+				data->option -= 7;
 			}
 			break;
-		case 12:
+		case 13:
 			if (game->config.fx) {
-				data->option -= 6;
+				data->option -= 7;
 			}
 			break;
-		case 13:
+		case 14:
 			if (game->config.voice) {
-				data->option -= 6;
+				data->option -= 7;
 			}
 			break;
-		case 14:
+		case 15:
 			if (game->data->pan) {
-				data->option -= 6;
+				data->option -= 7;
 			}
 			break;
 	}
@@ -152,6 +154,8 @@ static void MenuSelect(struct Game* game, struct GamestateResources* data) {
 	data->blink = 0;
 	switch (data->option) {
 		case 0:
+			game->data->endless = false;
+			MarkMilestone(game, MILESTONE_MATCH);
 			SwitchCurrentGamestate(game, "game");
 			break;
 		case 1:
@@ -159,21 +163,22 @@ static void MenuSelect(struct Game* game, struct GamestateResources* data) {
 			Speak(game, texts[data->option]);
 			break;
 		case 2:
-			data->option = 14;
-			Speak(game, texts[data->option]);
+			game->data->endless = true;
+			MarkMilestone(game, MILESTONE_MATCH);
+			SwitchCurrentGamestate(game, "game");
 			break;
 		case 3:
 			UnloadAllGamestates(game);
 			break;
 		case 4:
-		case 10:
+		case 11:
 			// fullscreen
 			ToggleFullscreen(game);
 			AdjustOption(game, data);
 			Speak(game, texts[data->option]);
 			break;
 		case 5:
-		case 11:
+		case 12:
 			// music
 			game->config.music = game->config.music ? 0 : 10;
 			SetConfigOption(game, "SuperDerpy", "music", game->config.music ? "10" : "0");
@@ -183,7 +188,7 @@ static void MenuSelect(struct Game* game, struct GamestateResources* data) {
 			Speak(game, texts[data->option]);
 			break;
 		case 6:
-		case 12:
+		case 13:
 			// sounds
 			game->config.fx = game->config.fx ? 0 : 10;
 			SetConfigOption(game, "SuperDerpy", "fx", game->config.fx ? "10" : "0");
@@ -193,24 +198,29 @@ static void MenuSelect(struct Game* game, struct GamestateResources* data) {
 			Speak(game, texts[data->option]);
 			break;
 		case 7:
-		case 13:
+		case 14:
 			// voices
 			game->config.voice = game->config.voice ? 0 : 10;
 			SetConfigOption(game, "SuperDerpy", "voice", game->config.voice ? "10" : "0");
 			al_set_mixer_gain(game->audio.voice, game->config.voice / 10.0);
 			al_set_mixer_gain(game->data->audio.voice, game->config.voice / 10.0);
+			PrerenderSpeak(game, texts, sizeof(texts) / sizeof(texts[0]));
 			AdjustOption(game, data);
 			Speak(game, texts[data->option]);
 			break;
 		case 8:
-		case 14:
+		case 15:
 			game->data->pan = !game->data->pan;
 			SetConfigOption(game, "ZjedzTrawke2", "pan", game->data->pan ? "1" : "0");
 			AdjustOption(game, data);
 			Speak(game, texts[data->option]);
 			break;
 		case 9:
-		case 15:
+		case 16:
+			SwitchCurrentGamestate(game, "calibration");
+			break;
+		case 10:
+		case 17:
 			data->option = 0;
 			Speak(game, texts[data->option]);
 			break;
@@ -223,30 +233,26 @@ static void MenuLeft(struct Game* game, struct GamestateResources* data) {
 	data->blink = 0;
 	data->option--;
 
-	if (data->option == 9) {
-		data->option = 15;
+	if (data->option == 10) {
+		data->option = 17;
 	}
 #ifdef ALLEGRO_ANDROID
-	if (data->option == 10) {
-		data->option = 15;
+	if (data->option == 11) {
+		data->option = 17;
 	}
 #endif
 	if (data->option == 3) {
-		data->option = 9;
+		data->option = 10;
 	}
 #ifdef ALLEGRO_ANDROID
 	if (data->option == 4) {
-		data->option = 9;
+		data->option = 10;
 	}
 #endif
 	if (data->option == -1) {
 		data->option = 3;
 	}
 
-	if (data->option == 2) {
-		data->option--;
-	}
-
 	AdjustOption(game, data);
 	Speak(game, texts[data->option]);
 }
@@ -260,23 +266,19 @@ static void MenuRight(struct Game* game, struct GamestateResources* data) {
 	if (data->option == 4) {
 		data->option = 0;
 	}
-	if (data->option == 10) {
+	if (data->option == 11) {
 		data->option = 4;
 #ifdef ALLEGRO_ANDROID
 		data->option++;
 #endif
 	}
-	if (data->option == 16) {
-		data->option = 10;
+	if (data->option == 18) {
+		data->option = 11;
 #ifdef ALLEGRO_ANDROID
 		data->option++;
 #endif
 	}
 
-	if (data->option == 2) {
-		data->option++;
-	}
-
 	AdjustOption(game, data);
 	Speak(game, texts[data->option]);
 }
@@ -342,16 +344,18 @@ void* Gamestate_Load(struct Game* game, void (*progress)(struct Game*)) {
 	struct GamestateResources* data = malloc(sizeof(struct GamestateResources));
 	int flags = al_get_new_bitmap_flags();
 	al_set_new_bitmap_flags(flags ^ ALLEGRO_MAG_LINEAR); // disable linear scaling for pixelarty appearance
-	data->font = al_create_builtin_font();
+	data->font = AcquireBuiltinFont(game->data->assets);
 	progress(game); // report that we progressed with the loading, so the engine can draw a progress bar
 
-	data->logo = al_load_bitmap(GetDataFilePath(game, "logo.png"));
+	data->logo = AcquireBitmap(game->data->assets, GetDataFilePath(game, "logo.png"));
 
-	data->menu_sample = al_load_sample(GetDataFilePath(game, "menu.flac"));
+	data->menu_sample = AcquireSample(game->data->assets, GetDataFilePath(game, "menu.flac"));
 	data->menu = al_create_sample_instance(data->menu_sample);
 	al_attach_sample_instance_to_mixer(data->menu, game->audio.music);
 	al_set_sample_instance_playmode(data->menu, ALLEGRO_PLAYMODE_LOOP);
 
+	PrerenderSpeak(game, texts, sizeof(texts) / sizeof(texts[0]));
+
 	al_set_new_bitmap_flags(flags);
 	return data;
 }
@@ -359,14 +363,23 @@ void* Gamestate_Load(struct Game* game, void (*progress)(struct Game*)) {
 void Gamestate_Unload(struct Game* game, struct GamestateResources* data) {
 	// Called when the gamestate library is being unloaded.
 	// Good place for freeing all allocated memory and resources.
-	al_destroy_font(data->font);
+	ReleaseAsset(game->data->assets, data->font);
 	al_destroy_sample_instance(data->menu);
+	ReleaseAsset(game->data->assets, data->menu_sample);
+	ReleaseAsset(game->data->assets, data->logo);
 	free(data);
 }
 
+void Gamestate_PostLoad(struct Game* game, struct GamestateResources* data) {
+	// The logo was decoded by the asset workers, as a memory bitmap when
+	// loaded off the main thread; turn it into a texture.
+	UploadAssets(game->data->assets);
+}
+
 void Gamestate_Start(struct Game* game, struct GamestateResources* data) {
 	// Called when this gamestate gets control. Good place for initializing state,
 	// playing music etc.
+	SetProfilerScope(game, "menu");
 	data->option = 0;
 	data->blink = 0;
 	data->offset = 30;
@@ -376,6 +389,7 @@ void Gamestate_Start(struct Game* game, struct GamestateResources* data) {
 #endif
 
 	Speak(game, texts[0]);
+	MarkMilestone(game, MILESTONE_MENU);
 }
 
 void Gamestate_Stop(struct Game* game, struct GamestateResources* data) {
@@ -20,6 +20,7 @@
 
 #include "common.h"
 #include "defines.h"
+#include "profiler.h"
 #include <libsuperderpy.h>
 #include <signal.h>
 #include <stdio.h>
@@ -44,6 +45,10 @@ int main(int argc, char** argv) {
 			.handlers = (struct Handlers){
 				.event = GlobalEventHandler,
 				.destroy = DestroyGameData,
+				.prelogic = ProfilerPreLogic,
+				.postlogic = GlobalPostLogic,
+				.predraw = ProfilerPreDraw,
+				.postdraw = ProfilerPostDraw,
 			},
 		});
 	if (!game) { return 1; }
@@ -54,6 +59,7 @@ int main(int argc, char** argv) {
 	StartGamestate(game, "dosowisko");
 
 	game->data = CreateGameData(game);
+	PrefetchGamestates(game);
 
 	al_hide_mouse_cursor(game->display);
 
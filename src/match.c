@@ -0,0 +1,408 @@
+/*! \file match.c
+ *  \brief Match simulation core, independent from Allegro.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "match.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+static float Abs(float a) {
+	if (a >= 0) {
+		return a;
+	}
+	return -a;
+}
+
+static void EmitCue(struct MatchCues* cues, enum MatchCueType type, int player, float value) {
+	if (!cues || cues->count >= MATCH_MAX_CUES) {
+		return;
+	}
+	cues->cue[cues->count].type = type;
+	cues->cue[cues->count].player = player;
+	cues->cue[cues->count].value = value;
+	cues->count++;
+}
+
+unsigned int BeatSlot(const struct BeatQueue* queue, unsigned int i) {
+	return (queue->head + i) & (BEAT_QUEUE_SIZE - 1);
+}
+
+/* Both the clock and the beats are mapped to a common integer timeline, on
+ * which a beat is rate * BEATS_PER_SECOND_DEN units long, so nothing is ever
+ * accumulated in floating point. */
+static int64_t BeatLength(const struct MatchSession* session) {
+	return (int64_t)session->rate * BEATS_PER_SECOND_DEN;
+}
+
+static int64_t ClockToTimeline(int64_t clock) {
+	return clock * BEATS_PER_SECOND_NUM;
+}
+
+float GetBeatOffset(const struct MatchSession* session, int beat, int64_t clock) {
+	// beats until the given beat, negative once it has passed
+	int64_t length = BeatLength(session);
+	return (double)(beat * length - ClockToTimeline(clock)) / length;
+}
+
+int64_t GetBeatClock(const struct MatchSession* session, int beat, float offset) {
+	// clock at which the given beat is offset beats away, positive is later
+	return llround((beat + (double)offset) * BeatLength(session) / BEATS_PER_SECOND_NUM);
+}
+
+float GetMusicSpeed(const struct MatchSession* session, int id) {
+	float progress = (session->score[id]) / 10000.0f;
+	return SPEED * (progress + 1) / (BEATS_PER_SECOND_NUM / (float)BEATS_PER_SECOND_DEN);
+}
+
+static void PushBeat(struct BeatQueue* queue, int beat, int id) {
+	unsigned int slot = BeatSlot(queue, queue->count);
+	queue->beat[slot] = beat;
+	queue->status[slot] = -1;
+	queue->id[slot] = id;
+	queue->count++;
+}
+
+static void RecycleBeat(struct BeatQueue* queue) {
+	// reuses the oldest beat as the newest one
+	unsigned int last = BeatSlot(queue, queue->count - 1);
+	int id = queue->id[last] + 1;
+	int beat = queue->beat[last] + ((id % 3 == 2) ? 2 : 1);
+	queue->head = BeatSlot(queue, 1);
+	queue->count--;
+	PushBeat(queue, beat, id);
+}
+
+static void Penalize(struct MatchSession* session, int id) {
+	if (session->score[id] >= 50) {
+		session->score[id] -= 50;
+	}
+	if (session->score[id] < 50) {
+		session->score[id] = 0;
+	}
+}
+
+static void Move(struct MatchSession* session, int id, enum direction direction, float point, struct MatchCues* cues) {
+	int x = session->x[id], y = session->y[id];
+	switch (direction) {
+		case up:
+			y--;
+			break;
+		case down:
+			y++;
+			break;
+		case left:
+			x--;
+			break;
+		case right:
+			x++;
+			break;
+	}
+	if (IsMazeWall(session->maze, x, y)) {
+		EmitCue(cues, MATCH_CUE_WRONG_WAY, id, 1.0 - Abs(point));
+		return;
+	}
+	session->x[id] = x;
+	session->y[id] = y;
+	session->facing[id] = direction;
+	EmitCue(cues, MATCH_CUE_DING, id, 1.0 - Abs(point));
+}
+
+static void ScrollMaze(struct MatchSession* session, struct MatchCues* cues) {
+	// Endless mazes keep growing in front of the leading player. Whoever falls
+	// behind the oldest row that is still kept loses.
+	struct Maze* maze = session->maze;
+	int i, leader = 0;
+	for (i = 1; i < session->players; i++) {
+		if (session->y[i] > session->y[leader]) {
+			leader = i;
+		}
+	}
+	while (session->y[leader] + MAZE_ENDLESS_LOOKAHEAD >= maze->yFirst + maze->height) {
+		ExtendEndlessMaze(maze);
+	}
+	for (i = 0; i < session->players; i++) {
+		if (session->y[i] < maze->yFirst) {
+			session->ended = true;
+			session->winner = leader;
+			EmitCue(cues, MATCH_CUE_WIN, leader, 0);
+			return;
+		}
+	}
+}
+
+static void IsGoodPressed(struct MatchSession* session, int id, enum direction direction, int64_t clock, struct MatchCues* cues) {
+	struct BeatQueue* queue = &session->beats[id];
+	unsigned int i, slot = 0;
+	float point = 0;
+	for (i = 0; i < queue->count; i++) {
+		slot = BeatSlot(queue, i);
+		point = GetBeatOffset(session, queue->beat[slot], clock);
+		if (point > -0.25f) {
+			break;
+		}
+	}
+	if (i == queue->count) {
+		return;
+	}
+	if (point > 0.25f) {
+		return;
+	}
+	if (queue->status[slot] != -1) {
+		session->judgement[id] = JUDGEMENT_BAD;
+		queue->status[slot] = 0;
+		Penalize(session, id);
+		EmitCue(cues, MATCH_CUE_JUDGEMENT, id, 0);
+		return;
+	}
+
+	queue->status[slot] = (int)(100 - Abs((point)*400));
+	session->judgement[id] = JUDGEMENT_GOOD;
+	session->score[id] += queue->status[slot];
+	if (Abs(point) <= 0.15f) {
+		session->judgement[id] = JUDGEMENT_EXCELLENT;
+	}
+	if (Abs(point) <= 0.05f) {
+		session->judgement[id] = JUDGEMENT_PERFECT;
+	}
+	EmitCue(cues, MATCH_CUE_JUDGEMENT, id, 0);
+
+	Move(session, id, direction, point, cues);
+
+	if (session->maze->endless) {
+		ScrollMaze(session, cues);
+		return;
+	}
+
+	if (session->x[id] == session->maze->xGrass && session->y[id] == session->maze->yGrass) {
+		// winning condition
+		session->ended = true;
+		session->winner = id;
+		EmitCue(cues, MATCH_CUE_WIN, id, 0);
+	}
+}
+
+static void ExpireBeats(struct MatchSession* session, int id, int64_t now, struct MatchCues* cues) {
+	// Gives up on the beats whose window has closed before the given point of
+	// the timeline.
+	struct BeatQueue* queue = &session->beats[id];
+
+	// Free slots never have status -1, so it's safe to sweep the whole buffer
+	// without caring about where the ring wraps around.
+	int64_t length = BeatLength(session);
+	int i, missed = 0;
+	for (i = 0; i < BEAT_QUEUE_SIZE; i++) {
+		int late = (queue->status[i] == -1) & (queue->beat[i] * length + length / 4 < now);
+		queue->status[i] = late ? 0 : queue->status[i];
+		missed += late;
+	}
+
+	if (missed) {
+		for (; missed > 0; missed--) {
+			Penalize(session, id);
+		}
+		session->judgement[id] = JUDGEMENT_TOO_LATE;
+		EmitCue(cues, MATCH_CUE_JUDGEMENT, id, 0);
+	}
+
+	while (queue->beat[queue->head] * length + length * 5 < now) {
+		RecycleBeat(queue);
+	}
+}
+
+int64_t GetInputClock(const struct MatchSession* session, const struct MatchInput* input) {
+	// The clock an input gets judged at: its own, but never further behind
+	// its player's clock than the grace period. The beats before that have
+	// been given up on already, so the input is judged the same as it would
+	// be if the clock hadn't been updated in between.
+	int64_t grace = BeatLength(session) * MATCH_GRACE_QUARTERS / 4;
+	int64_t earliest = (ClockToTimeline(session->clock[input->player]) - grace + BEATS_PER_SECOND_NUM - 1) / BEATS_PER_SECOND_NUM;
+	return (input->clock > earliest) ? input->clock : earliest;
+}
+
+static void UpdateBeats(struct MatchSession* session, int id, int64_t clock, struct MatchCues* cues) {
+	if (clock > session->clock[id]) {
+		session->clock[id] = clock;
+	}
+	EmitCue(cues, MATCH_CUE_MUSIC_SPEED, id, GetMusicSpeed(session, id));
+
+	// Presses may get here a bit after they happened, so beats are given up
+	// on only after a grace period. Inputs expire beats up to their own clock
+	// before being judged, and later ones are moved up to the end of the
+	// grace period, which keeps the outcome the same no matter how often the
+	// clock gets updated - replays depend on that.
+	ExpireBeats(session, id, ClockToTimeline(session->clock[id]) - BeatLength(session) * MATCH_GRACE_QUARTERS / 4, cues);
+}
+
+void InitMatch(struct MatchSession* session, struct Maze* maze, int players, int rate) {
+	memset(session, 0, sizeof(struct MatchSession));
+	session->players = (players < 1) ? 1 : (players > MATCH_MAX_PLAYERS) ? MATCH_MAX_PLAYERS : players;
+	session->maze = maze;
+	session->rate = rate;
+	session->winner = -1;
+	int p, i;
+	for (p = 0; p < session->players; p++) {
+		session->x[p] = maze->xStart;
+		session->y[p] = maze->yStart;
+		session->facing[p] = down;
+		session->judgement[p] = JUDGEMENT_NONE;
+		for (i = 0; i <= 10; i++) {
+			if (i % 4 == 3) {
+				continue;
+			}
+			PushBeat(&session->beats[p], i, i);
+		}
+	}
+}
+
+void StepMatch(struct MatchSession* session, const struct MatchInput* inputs, int count, const int64_t clocks[], struct MatchCues* cues) {
+	// Inputs are judged at their own clock, in the order given, just like key
+	// presses arriving between two logic frames. The clocks then move forward
+	// to the given positions, if any, one for each player. That still happens
+	// once the match has ended, so that the beats the other players missed
+	// before the end are accounted for no matter whose input ended it.
+	int i;
+	if (cues) {
+		cues->count = 0;
+	}
+	for (i = 0; i < count && !session->ended; i++) {
+		int64_t clock;
+		if (inputs[i].player < 0 || inputs[i].player >= session->players) {
+			continue;
+		}
+		clock = GetInputClock(session, &inputs[i]);
+		ExpireBeats(session, inputs[i].player, ClockToTimeline(clock), cues);
+		IsGoodPressed(session, inputs[i].player, inputs[i].direction, clock, cues);
+	}
+	if (!clocks) {
+		return;
+	}
+	for (i = session->players - 1; i >= 0; i--) {
+		UpdateBeats(session, i, clocks[i], cues);
+	}
+}
+
+const char* GetJudgementText(enum Judgement judgement) {
+	static const char* texts[] = {"", "Bad!", "Good!", "Excellent!", "Perfect!", "Too Late!"};
+	return texts[judgement];
+}
+
+struct MatchSaveHeader {
+	// The session is stored as is, so a save can only be loaded by the same
+	// build on the same platform; the size guards against anything else.
+	// The maze is stored as what's needed to generate it again.
+	char magic[4];
+	uint32_t version, size;
+	uint32_t seed;
+	int32_t width, height, yFirst;
+	uint8_t endless;
+};
+
+bool SaveMatch(const struct MatchSession* session, const char* filename) {
+	struct MatchSaveHeader header = {.version = MATCH_SAVE_VERSION, .size = sizeof(struct MatchSession),
+		.seed = session->maze->seed, .width = session->maze->width, .height = session->maze->height,
+		.yFirst = session->maze->yFirst, .endless = session->maze->endless};
+	struct MatchSession copy = *session;
+	FILE* file = fopen(filename, "wb");
+	bool ok;
+	if (!file) {
+		return false;
+	}
+	memcpy(header.magic, MATCH_SAVE_MAGIC, 4);
+	copy.maze = NULL;
+	ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	ok &= fwrite(&copy, sizeof(copy), 1, file) == 1;
+	ok &= !fclose(file);
+	return ok;
+}
+
+static bool IsSessionValid(const struct MatchSession* session) {
+	// Everything that gets used as an index, so that a damaged save can't
+	// make it read out of bounds.
+	int i;
+	if (session->players < 1 || session->players > MATCH_MAX_PLAYERS || session->rate <= 0 ||
+		session->winner < -1 || session->winner >= session->players) {
+		return false;
+	}
+	for (i = 0; i < session->players; i++) {
+		const struct BeatQueue* queue = &session->beats[i];
+		if (session->judgement[i] < JUDGEMENT_NONE || session->judgement[i] > JUDGEMENT_TOO_LATE ||
+			session->facing[i] < up || session->facing[i] > right ||
+			queue->head >= BEAT_QUEUE_SIZE || queue->count > BEAT_QUEUE_SIZE) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static int GetReachableRow(const struct MatchSession* session) {
+	// How far down an endless maze could have scrolled: no player moves
+	// more than a row per beat, and no beat was pressed past the newest
+	// one queued.
+	int i, row = 0;
+	for (i = 0; i < session->players; i++) {
+		const struct BeatQueue* queue = &session->beats[i];
+		if (queue->count && queue->beat[BeatSlot(queue, queue->count - 1)] + 1 > row) {
+			row = queue->beat[BeatSlot(queue, queue->count - 1)] + 1;
+		}
+	}
+	return (row < MATCH_SAVE_MAX_BEATS) ? row : MATCH_SAVE_MAX_BEATS;
+}
+
+bool LoadMatch(struct MatchSession* session, const char* filename) {
+	// Restores the session along with a new maze, which the caller owns.
+	struct MatchSaveHeader header;
+	struct MatchSession loaded;
+	FILE* file = fopen(filename, "rb");
+	bool ok;
+	int i;
+	if (!file) {
+		return false;
+	}
+	ok = fread(&header, sizeof(header), 1, file) == 1 && fread(&loaded, sizeof(loaded), 1, file) == 1;
+	fclose(file);
+	if (!ok || memcmp(header.magic, MATCH_SAVE_MAGIC, 4) || header.version != MATCH_SAVE_VERSION || header.size != sizeof(struct MatchSession) ||
+		!IsSessionValid(&loaded) || header.width < MAZE_MIN_SIZE || header.width > MAZE_MAX_SIZE) {
+		return false;
+	}
+	if (header.endless) {
+		// the maze gets generated all the way down to where it was
+		if (header.width > MAZE_ENDLESS_MAX_WIDTH || header.yFirst < 0 || header.yFirst > GetReachableRow(&loaded)) {
+			return false;
+		}
+		loaded.maze = CreateEndlessMaze(header.width, header.seed);
+		while (loaded.maze->yFirst < header.yFirst) {
+			ExtendEndlessMaze(loaded.maze);
+		}
+	} else {
+		if (header.height < MAZE_MIN_SIZE || header.height > MAZE_MAX_SIZE) {
+			return false;
+		}
+		loaded.maze = CreateMaze(header.width, header.height, header.seed);
+	}
+	for (i = 0; i < loaded.players; i++) {
+		if (loaded.x[i] < 0 || loaded.x[i] >= loaded.maze->width || loaded.y[i] < loaded.maze->yFirst ||
+			loaded.y[i] >= loaded.maze->yFirst + loaded.maze->height) {
+			DestroyMaze(loaded.maze);
+			return false;
+		}
+	}
+	*session = loaded;
+	return true;
+}
@@ -0,0 +1,131 @@
+/*! \file match.h
+ *  \brief Match simulation core, independent from Allegro.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZJEDZTRAWKE2_MATCH_H
+#define ZJEDZTRAWKE2_MATCH_H
+
+#include "maze.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SPEED 1.1
+#define MATCH_MAX_PLAYERS 8
+#define BEAT_QUEUE_SIZE 16 // must be a power of two
+#define MATCH_MAX_CUES 32
+#define MATCH_SAMPLE_RATE 44100 // used when there's no music to follow
+// Beats per second of music played at normal speed, as a fraction, so that
+// the beat timeline can be kept in integer samples.
+#define BEATS_PER_SECOND_NUM 2335
+#define BEATS_PER_SECOND_DEN 2000
+#define MATCH_GRACE_QUARTERS 1 // how long missed beats wait for late input events, in quarters of a beat
+#define MATCH_SAVE_MAGIC "ZT2S"
+#define MATCH_SAVE_VERSION 1
+#define MATCH_SAVE_MAX_BEATS 65536 // saves of matches past this are taken as damaged, as catching up takes too long
+
+enum direction {
+	up,
+	down,
+	left,
+	right
+};
+
+enum Judgement {
+	JUDGEMENT_NONE,
+	JUDGEMENT_BAD,
+	JUDGEMENT_GOOD,
+	JUDGEMENT_EXCELLENT,
+	JUDGEMENT_PERFECT,
+	JUDGEMENT_TOO_LATE,
+};
+
+struct BeatQueue {
+	// Ring buffer of beats in flight, stored as struct of arrays so the
+	// per-tick update is a single linear pass. Live beats occupy slots
+	// head .. head + count - 1 (modulo BEAT_QUEUE_SIZE), oldest first.
+	int beat[BEAT_QUEUE_SIZE]; // position on the timeline, in whole beats
+	int status[BEAT_QUEUE_SIZE];
+	int id[BEAT_QUEUE_SIZE];
+	unsigned int head, count;
+};
+
+struct MatchSession {
+	// Everything a match needs to run. Sessions don't share any state,
+	// so any number of them can be simulated at once. Players are indexed
+	// into arrays of their state, so that updating all of them is a loop
+	// over each array.
+	//
+	// The state is a single flat block: the only pointer is to the maze,
+	// which the session doesn't own and which never goes back in time, so
+	// copying the struct is a snapshot and copying it back restores it.
+	int players;
+	int x[MATCH_MAX_PLAYERS], y[MATCH_MAX_PLAYERS];
+	enum direction facing[MATCH_MAX_PLAYERS];
+	int score[MATCH_MAX_PLAYERS];
+	enum Judgement judgement[MATCH_MAX_PLAYERS]; // of the last press or miss
+	struct BeatQueue beats[MATCH_MAX_PLAYERS];
+	// Position of each player's music in samples since the match started, not
+	// wrapping when the music loops. Beats are timed against it.
+	int64_t clock[MATCH_MAX_PLAYERS];
+
+	struct Maze* maze;
+	int rate; // sample rate of the clocks
+	bool ended;
+	int winner;
+};
+
+struct MatchInput {
+	int player;
+	enum direction direction;
+	int64_t clock; // player's clock at the moment of the press
+};
+
+enum MatchCueType {
+	MATCH_CUE_MUSIC_SPEED, // value: playback speed of the player's music
+	MATCH_CUE_DING, // value: playback speed of the sound
+	MATCH_CUE_WRONG_WAY, // value: playback speed of the sound
+	MATCH_CUE_JUDGEMENT, // player's text has changed
+	MATCH_CUE_WIN,
+};
+
+struct MatchCue {
+	enum MatchCueType type;
+	int player;
+	float value;
+};
+
+struct MatchCues {
+	// Audio and visual feedback produced by a step, to be played back by the
+	// caller in order.
+	struct MatchCue cue[MATCH_MAX_CUES];
+	int count;
+};
+
+void InitMatch(struct MatchSession* session, struct Maze* maze, int players, int rate);
+void StepMatch(struct MatchSession* session, const struct MatchInput* inputs, int count, const int64_t clocks[], struct MatchCues* cues);
+unsigned int BeatSlot(const struct BeatQueue* queue, unsigned int i);
+float GetBeatOffset(const struct MatchSession* session, int beat, int64_t clock);
+int64_t GetInputClock(const struct MatchSession* session, const struct MatchInput* input);
+int64_t GetBeatClock(const struct MatchSession* session, int beat, float offset);
+float GetMusicSpeed(const struct MatchSession* session, int id);
+const char* GetJudgementText(enum Judgement judgement);
+bool SaveMatch(const struct MatchSession* session, const char* filename);
+bool LoadMatch(struct MatchSession* session, const char* filename);
+
+#endif
@@ -0,0 +1,336 @@
+/*! \file maze.c
+ *  \brief Maze generation, independent from Allegro.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "maze.h"
+#include "distance.h"
+#include "rng.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct EllerState {
+	// Eller's algorithm needs just the set membership of the current row.
+	struct Rng rng;
+	int columns; // rooms are on odd coordinates, walls in between
+	int* sets; // 0 for rooms that haven't been assigned to a set yet
+	bool* down; // whether the room connects to the next row
+	bool* used; // indexed by set, to reuse ids instead of growing them forever
+	bool* hasDown; // indexed by set
+};
+
+static void ClearWall(struct Maze* maze, int x, int y) {
+	uint64_t bit;
+	uint64_t* block = GetMazeBlock(maze, x, y, &bit);
+	*block &= ~bit;
+}
+
+static void CarveMaze(struct Rng* rng, struct Maze* maze, int x, int y) {
+	int x1, y1;
+	int x2, y2;
+	int dx, dy;
+	int dir, count;
+
+	dir = RandomBelow(rng, 4);
+	count = 0;
+	while (count < 4) {
+		dx = 0;
+		dy = 0;
+		switch (dir) {
+			case 0:
+				dx = 1;
+				break;
+			case 1:
+				dy = 1;
+				break;
+			case 2:
+				dx = -1;
+				break;
+			default:
+				dy = -1;
+				break;
+		}
+		x1 = x + dx;
+		y1 = y + dy;
+		x2 = x1 + dx;
+		y2 = y1 + dy;
+		if (x2 > 0 && x2 < maze->width && y2 > 0 && y2 < maze->height &&
+			IsMazeWall(maze, x1, y1) && IsMazeWall(maze, x2, y2)) {
+			ClearWall(maze, x1, y1);
+			ClearWall(maze, x2, y2);
+			x = x2;
+			y = y2;
+			dir = RandomBelow(rng, 4);
+			count = 0;
+		} else {
+			dir = (dir + 1) % 4;
+			count += 1;
+		}
+	}
+}
+
+/* Generate maze with size width, height. */
+static void GenerateMaze(struct Rng* rng, struct Maze* maze) {
+	int x, y;
+
+	/* Initialize the maze. */
+	memset(maze->walls, 0xff, GetMazeStorageSize(maze));
+	ClearWall(maze, 1, 1);
+
+	/* Carve the maze. */
+	for (y = 1; y < maze->height; y += 2) {
+		for (x = 1; x < maze->width; x += 2) {
+			CarveMaze(rng, maze, x, y);
+		}
+	}
+
+	/* Set up the entry and exit. */
+	ClearWall(maze, 1, 0);
+	ClearWall(maze, maze->width - 2, maze->height - 1);
+}
+
+/* Place the grass in the last open cell, scanning columns from the right. */
+static void PlaceGrass(struct Maze* maze) {
+	int i, j;
+	for (i = maze->width - 1; i >= 0; i--) {
+		for (j = maze->height - 1; j >= 0; j--) {
+			if (!IsMazeWall(maze, i, j)) {
+				maze->xGrass = i;
+				maze->yGrass = j;
+				return;
+			}
+		}
+	}
+}
+
+struct Maze* CreateMaze(int width, int height, uint32_t seed) {
+	struct Rng rng;
+	struct Maze* maze = calloc(1, sizeof(struct Maze));
+	SeedRandom(&rng, seed);
+	maze->seed = seed;
+	maze->width = width;
+	maze->height = height;
+	maze->blocksPerRow = (width + MAZE_BLOCK - 1) / MAZE_BLOCK;
+	maze->blockRows = (height + MAZE_BLOCK - 1) / MAZE_BLOCK;
+	maze->walls = malloc(GetMazeStorageSize(maze));
+	GenerateMaze(&rng, maze);
+	maze->xStart = 1;
+	maze->yStart = 0;
+	PlaceGrass(maze);
+	return maze;
+}
+
+/* Generate rows 2n and 2n+1 of an endless maze: the passages leading down
+ * from the previous row of rooms, and a new row of rooms. Takes O(width)
+ * time, apart from set merging which is bounded by MAZE_ENDLESS_MAX_WIDTH. */
+static void GenerateEllerRows(struct Maze* maze, int y) {
+	struct EllerState* eller = maze->eller;
+	int i, j, x;
+
+	for (x = 0; x < maze->width; x++) {
+		uint64_t bit;
+		*GetMazeBlock(maze, x, y, &bit) |= bit;
+		*GetMazeBlock(maze, x, y + 1, &bit) |= bit;
+	}
+
+	/* Open the passages chosen for the previous row and give fresh sets to
+	 * the rooms that aren't connected to anything above. */
+	memset(eller->used, 0, (eller->columns + 1) * sizeof(bool));
+	for (i = 0; i < eller->columns; i++) {
+		if (eller->down[i]) {
+			ClearWall(maze, i * 2 + 1, y);
+			eller->used[eller->sets[i]] = true;
+		} else {
+			eller->sets[i] = 0;
+		}
+	}
+	for (i = 0, j = 1; i < eller->columns; i++) {
+		if (!eller->sets[i]) {
+			while (eller->used[j]) {
+				j++;
+			}
+			eller->sets[i] = j;
+			eller->used[j] = true;
+		}
+		ClearWall(maze, i * 2 + 1, y + 1);
+	}
+
+	/* Randomly join neighbouring rooms from different sets. */
+	for (i = 0; i < eller->columns - 1; i++) {
+		if (eller->sets[i] != eller->sets[i + 1] && RandomBelow(&eller->rng, 2)) {
+			int merged = eller->sets[i + 1];
+			ClearWall(maze, i * 2 + 2, y + 1);
+			for (j = 0; j < eller->columns; j++) {
+				if (eller->sets[j] == merged) {
+					eller->sets[j] = eller->sets[i];
+				}
+			}
+		}
+	}
+
+	/* Every set has to continue downwards at least once. */
+	memset(eller->hasDown, 0, (eller->columns + 1) * sizeof(bool));
+	for (i = 0; i < eller->columns; i++) {
+		eller->down[i] = RandomBelow(&eller->rng, 2);
+		eller->hasDown[eller->sets[i]] |= eller->down[i];
+	}
+	for (i = eller->columns - 1; i >= 0; i--) {
+		if (!eller->hasDown[eller->sets[i]]) {
+			eller->down[i] = true;
+			eller->hasDown[eller->sets[i]] = true;
+		}
+	}
+}
+
+struct Maze* CreateEndlessMaze(int width, uint32_t seed) {
+	struct Maze* maze = calloc(1, sizeof(struct Maze));
+	struct EllerState* eller = calloc(1, sizeof(struct EllerState));
+	int i;
+
+	if (width > MAZE_ENDLESS_MAX_WIDTH) {
+		width = MAZE_ENDLESS_MAX_WIDTH;
+	}
+	maze->seed = seed;
+	maze->width = width;
+	maze->height = MAZE_ENDLESS_ROWS;
+	maze->blocksPerRow = (width + MAZE_BLOCK - 1) / MAZE_BLOCK;
+	maze->blockRows = MAZE_ENDLESS_ROWS / MAZE_BLOCK;
+	maze->walls = malloc(GetMazeStorageSize(maze));
+	maze->xStart = 1;
+	maze->yStart = 0;
+	maze->xGrass = -1;
+	maze->yGrass = -1;
+	maze->endless = true;
+	maze->eller = eller;
+
+	SeedRandom(&eller->rng, seed);
+	eller->columns = (width - 1) / 2;
+	eller->sets = calloc(eller->columns, sizeof(int));
+	eller->down = calloc(eller->columns, sizeof(bool));
+	eller->used = calloc(eller->columns + 1, sizeof(bool));
+	eller->hasDown = calloc(eller->columns + 1, sizeof(bool));
+
+	/* The first passage down is the entry. */
+	eller->down[0] = true;
+	eller->sets[0] = 1;
+	for (i = 0; i < MAZE_ENDLESS_ROWS; i += 2) {
+		GenerateEllerRows(maze, i);
+	}
+	return maze;
+}
+
+/* Drop the two oldest rows and generate two new ones in their place. */
+void ExtendEndlessMaze(struct Maze* maze) {
+	GenerateEllerRows(maze, maze->yFirst + maze->height);
+	maze->yFirst += 2;
+}
+
+void DestroyMaze(struct Maze* maze) {
+	if (maze->distance) {
+		DestroyDistanceField(maze->distance);
+	}
+	if (maze->eller) {
+		free(maze->eller->sets);
+		free(maze->eller->down);
+		free(maze->eller->used);
+		free(maze->eller->hasDown);
+		free(maze->eller);
+	}
+	free(maze->walls);
+	free(maze);
+}
+
+size_t GetMazeStorageSize(const struct Maze* maze) {
+	return (size_t)maze->blockRows * maze->blocksPerRow * sizeof(uint64_t);
+}
+
+/* Check whether the grass can be reached from the start with a flood fill.
+ * The stack grows with the frontier, which stays far smaller than the maze. */
+bool IsMazeSolvable(const struct Maze* maze) {
+	int size = maze->width * maze->height;
+	int capacity = 256, count = 0;
+	int* stack = malloc(capacity * sizeof(int));
+	uint8_t* visited = calloc((size + 7) / 8, sizeof(uint8_t));
+	bool found = false;
+
+	stack[count++] = maze->xStart + maze->yStart * maze->width;
+	visited[stack[0] / 8] |= 1 << (stack[0] % 8);
+	while (count) {
+		int cell = stack[--count];
+		int x = cell % maze->width, y = cell / maze->width;
+		if (x == maze->xGrass && y == maze->yGrass) {
+			found = true;
+			break;
+		}
+		const int dx[] = {0, 0, -1, 1}, dy[] = {-1, 1, 0, 0};
+		int i;
+		for (i = 0; i < 4; i++) {
+			int next = (x + dx[i]) + (y + dy[i]) * maze->width;
+			if (!IsMazeWall(maze, x + dx[i], y + dy[i]) && !(visited[next / 8] & (1 << (next % 8)))) {
+				visited[next / 8] |= 1 << (next % 8);
+				if (count == capacity) {
+					capacity *= 2;
+					stack = realloc(stack, capacity * sizeof(int));
+				}
+				stack[count++] = next;
+			}
+		}
+	}
+
+	free(stack);
+	free(visited);
+	return found;
+}
+
+/* Keep trying consecutive seeds until the grass is reachable. The distance
+ * field doubles as the check. */
+struct Maze* CreateSolvableMaze(int width, int height, uint32_t seed) {
+	while (true) {
+		struct Maze* maze = CreateMaze(width, height, seed++);
+		maze->distance = CreateDistanceField(maze, maze->xGrass, maze->yGrass);
+		if (GetDistance(maze->distance, maze->xStart, maze->yStart) != DISTANCE_UNREACHABLE) {
+			return maze;
+		}
+		DestroyMaze(maze);
+	}
+}
+
+void SetMazeWall(struct Maze* maze, int x, int y, bool wall) {
+	uint64_t bit;
+	uint64_t* block;
+	if (!IsInMaze(maze, x, y) || IsMazeWall(maze, x, y) == wall) {
+		return;
+	}
+	block = GetMazeBlock(maze, x, y, &bit);
+	*block = wall ? (*block | bit) : (*block & ~bit);
+	if (maze->distance) {
+		UpdateDistanceField(maze->distance, maze, x, y);
+	}
+}
+
+/* Display the maze. */
+void ShowMaze(const struct Maze* maze) {
+	int x, y;
+	for (y = maze->yFirst; y < maze->yFirst + maze->height; y++) {
+		for (x = 0; x < maze->width; x++) {
+			printf(IsMazeWall(maze, x, y) ? "[]" : "  ");
+		}
+		printf("\n");
+	}
+}
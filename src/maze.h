@@ -0,0 +1,85 @@
+/*! \file maze.h
+ *  \brief Maze generation, independent from Allegro.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZJEDZTRAWKE2_MAZE_H
+#define ZJEDZTRAWKE2_MAZE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MAZE_WIDTH 20
+#define MAZE_HEIGHT 20
+#define MAZE_MIN_SIZE 4
+#define MAZE_MAX_SIZE 4096
+#define MAZE_BLOCK 8
+#define MAZE_ENDLESS_ROWS 64 // must be a multiple of MAZE_BLOCK
+#define MAZE_ENDLESS_LOOKAHEAD 16
+#define MAZE_ENDLESS_MAX_WIDTH 512
+
+struct EllerState;
+struct DistanceField;
+
+struct Maze {
+	uint32_t seed;
+	int width, height;
+	// Walls are packed one bit per cell in 8x8 blocks, one uint64_t per block,
+	// so a small window around a player only touches a handful of words.
+	uint64_t* walls;
+	int blocksPerRow, blockRows;
+	int xStart, yStart;
+	int xGrass, yGrass; // -1 when there's no grass
+	// Endless mazes only keep a ring of the last `height` rows, starting at
+	// row yFirst, and grow downwards one row pair at a time.
+	bool endless;
+	int yFirst;
+	struct EllerState* eller;
+	// distance to the grass, computed for solvable mazes only
+	struct DistanceField* distance;
+};
+
+struct Maze* CreateMaze(int width, int height, uint32_t seed);
+struct Maze* CreateSolvableMaze(int width, int height, uint32_t seed);
+struct Maze* CreateEndlessMaze(int width, uint32_t seed);
+void ExtendEndlessMaze(struct Maze* maze);
+void DestroyMaze(struct Maze* maze);
+bool IsMazeSolvable(const struct Maze* maze);
+void SetMazeWall(struct Maze* maze, int x, int y, bool wall);
+void ShowMaze(const struct Maze* maze);
+size_t GetMazeStorageSize(const struct Maze* maze);
+
+static inline uint64_t* GetMazeBlock(const struct Maze* maze, int x, int y, uint64_t* bit) {
+	*bit = 1ULL << ((y % MAZE_BLOCK) * MAZE_BLOCK + (x % MAZE_BLOCK));
+	return &maze->walls[((y / MAZE_BLOCK) % maze->blockRows) * maze->blocksPerRow + x / MAZE_BLOCK];
+}
+
+static inline bool IsInMaze(const struct Maze* maze, int x, int y) {
+	return x >= 0 && x < maze->width && y >= maze->yFirst && y < maze->yFirst + maze->height;
+}
+
+static inline bool IsMazeWall(const struct Maze* maze, int x, int y) {
+	uint64_t bit;
+	if (!IsInMaze(maze, x, y)) {
+		return true;
+	}
+	return *GetMazeBlock(maze, x, y, &bit) & bit;
+}
+
+#endif
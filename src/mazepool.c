@@ -0,0 +1,116 @@
+/*! \file mazepool.c
+ *  \brief Background pool of pregenerated mazes.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mazepool.h"
+#include "rng.h"
+#include <libsuperderpy.h>
+
+struct MazePool {
+	// A worker thread keeps the pool filled with solvable mazes, along with
+	// their distance fields, so starting a match never has to wait for them.
+	struct Maze** mazes;
+	int size, count;
+	int width, height;
+	struct Rng rng;
+	ALLEGRO_THREAD* thread;
+	ALLEGRO_MUTEX* mutex;
+	ALLEGRO_COND* cond;
+};
+
+static uint32_t NextSeed(struct MazePool* pool) {
+	al_lock_mutex(pool->mutex);
+	uint32_t seed = NextRandom(&pool->rng);
+	al_unlock_mutex(pool->mutex);
+	return seed;
+}
+
+static void* MazePoolThread(ALLEGRO_THREAD* thread, void* arg) {
+	struct MazePool* pool = arg;
+	while (true) {
+		al_lock_mutex(pool->mutex);
+		while (pool->count == pool->size && !al_get_thread_should_stop(thread)) {
+			al_wait_cond(pool->cond, pool->mutex);
+		}
+		al_unlock_mutex(pool->mutex);
+		if (al_get_thread_should_stop(thread)) {
+			break;
+		}
+
+		struct Maze* maze = CreateSolvableMaze(pool->width, pool->height, NextSeed(pool));
+
+		al_lock_mutex(pool->mutex);
+		pool->mazes[pool->count++] = maze;
+		al_unlock_mutex(pool->mutex);
+	}
+	return NULL;
+}
+
+struct MazePool* CreateMazePool(int size, int width, int height, uint32_t seed) {
+	struct MazePool* pool = calloc(1, sizeof(struct MazePool));
+	pool->mazes = calloc(size, sizeof(struct Maze*));
+	pool->size = size;
+	pool->width = width;
+	pool->height = height;
+	SeedRandom(&pool->rng, seed);
+	pool->mutex = al_create_mutex();
+	pool->cond = al_create_cond();
+	pool->thread = al_create_thread(MazePoolThread, pool);
+	if (pool->thread) {
+		al_start_thread(pool->thread);
+	}
+	return pool;
+}
+
+struct Maze* TakeMaze(struct MazePool* pool) {
+	struct Maze* maze = NULL;
+	al_lock_mutex(pool->mutex);
+	if (pool->count) {
+		maze = pool->mazes[0];
+		memmove(pool->mazes, pool->mazes + 1, (pool->count - 1) * sizeof(struct Maze*));
+		pool->count--;
+		al_signal_cond(pool->cond);
+	}
+	al_unlock_mutex(pool->mutex);
+
+	if (!maze) {
+		// the pool has run dry (or there are no threads available), so generate one in place
+		maze = CreateSolvableMaze(pool->width, pool->height, NextSeed(pool));
+	}
+	return maze;
+}
+
+void DestroyMazePool(struct MazePool* pool) {
+	int i;
+	if (pool->thread) {
+		al_lock_mutex(pool->mutex);
+		al_set_thread_should_stop(pool->thread);
+		al_broadcast_cond(pool->cond);
+		al_unlock_mutex(pool->mutex);
+		al_join_thread(pool->thread, NULL);
+		al_destroy_thread(pool->thread);
+	}
+	for (i = 0; i < pool->count; i++) {
+		DestroyMaze(pool->mazes[i]);
+	}
+	al_destroy_cond(pool->cond);
+	al_destroy_mutex(pool->mutex);
+	free(pool->mazes);
+	free(pool);
+}
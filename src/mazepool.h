@@ -0,0 +1,35 @@
+/*! \file mazepool.h
+ *  \brief Background pool of pregenerated mazes.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZJEDZTRAWKE2_MAZEPOOL_H
+#define ZJEDZTRAWKE2_MAZEPOOL_H
+
+#include "maze.h"
+
+#define MAZE_POOL_SIZE 4 // mazes prepared in advance at most
+#define MAZE_POOL_BUDGET (16 * 1024 * 1024) // bytes of distance fields they may take
+
+struct MazePool;
+
+struct MazePool* CreateMazePool(int size, int width, int height, uint32_t seed);
+struct Maze* TakeMaze(struct MazePool* pool);
+void DestroyMazePool(struct MazePool* pool);
+
+#endif
@@ -0,0 +1,672 @@
+/*! \file netplay.c
+ *  \brief Versus matches between two instances with rollback, independent from Allegro.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "netplay.h"
+#include "replay.h"
+#include "rng.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef __EMSCRIPTEN__
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+#endif
+
+#define NETPLAY_MAGIC "ZT2N"
+#define NETPLAY_RESEND 32 // frames sent in a single packet at most
+#define IMPAIRED_QUEUE 256
+
+enum PacketType {
+	PACKET_JOIN,
+	PACKET_SETUP,
+	PACKET_FRAMES,
+};
+
+/* Packets start with the magic and a type byte, all integers are little
+ * endian. PACKET_SETUP carries seed, width, height and rate as 32 bits each.
+ * PACKET_FRAMES carries how many of the receiver's frames the sender knows
+ * about, the number of the first frame sent and the count of them, then for
+ * every frame the clock (64 bits), the count of inputs and the inputs, each
+ * as a direction byte followed by its clock. */
+
+static void Put32(uint8_t* buffer, size_t* size, uint32_t value) {
+	int i;
+	for (i = 0; i < 4; i++) {
+		buffer[(*size)++] = value >> (i * 8);
+	}
+}
+
+static void Put64(uint8_t* buffer, size_t* size, uint64_t value) {
+	Put32(buffer, size, value);
+	Put32(buffer, size, value >> 32);
+}
+
+static bool Get32(const uint8_t* buffer, size_t size, size_t* cursor, uint32_t* value) {
+	int i;
+	if (*cursor + 4 > size) {
+		return false;
+	}
+	*value = 0;
+	for (i = 0; i < 4; i++) {
+		*value |= (uint32_t)buffer[(*cursor)++] << (i * 8);
+	}
+	return true;
+}
+
+static bool Get64(const uint8_t* buffer, size_t size, size_t* cursor, int64_t* value) {
+	uint32_t low, high;
+	if (!Get32(buffer, size, cursor, &low) || !Get32(buffer, size, cursor, &high)) {
+		return false;
+	}
+	*value = (int64_t)(((uint64_t)high << 32) | low);
+	return true;
+}
+
+static size_t StartPacket(uint8_t* buffer, enum PacketType type) {
+	memcpy(buffer, NETPLAY_MAGIC, 4);
+	buffer[4] = type;
+	return 5;
+}
+
+static int ReceivePacket(struct NetLink* link, uint8_t* buffer, double now) {
+	// type of the next valid packet, -1 when there are no more
+	int size;
+	while ((size = link->receive(link, buffer, NETPLAY_MAX_PACKET, now)) >= 0) {
+		if (size >= 5 && !memcmp(buffer, NETPLAY_MAGIC, 4)) {
+			return buffer[4] | (size << 8);
+		}
+	}
+	return -1;
+}
+
+/* UDP */
+
+#ifndef __EMSCRIPTEN__
+#ifdef _WIN32
+typedef SOCKET Socket;
+#define CloseSocket closesocket
+#else
+typedef int Socket;
+#define INVALID_SOCKET -1
+#define CloseSocket close
+#endif
+
+struct UdpLink {
+	struct NetLink link;
+	Socket socket;
+	struct sockaddr_storage peer;
+	socklen_t peerLength; // 0 until the peer is known
+};
+
+static bool SendUdp(struct NetLink* link, const uint8_t* data, size_t size, double now) {
+	struct UdpLink* udp = (struct UdpLink*)link;
+	if (!udp->peerLength) {
+		return false;
+	}
+	return sendto(udp->socket, (const char*)data, size, 0, (struct sockaddr*)&udp->peer, udp->peerLength) == (int)size;
+}
+
+static int ReceiveUdp(struct NetLink* link, uint8_t* buffer, size_t size, double now) {
+	// The host doesn't know who it's going to play with, so it adopts the
+	// first sender as its peer.
+	struct UdpLink* udp = (struct UdpLink*)link;
+	struct sockaddr_storage from;
+	socklen_t length = sizeof(from);
+	int received = recvfrom(udp->socket, (char*)buffer, size, 0, (struct sockaddr*)&from, &length);
+	if (received < 0) {
+		return -1;
+	}
+	if (!udp->peerLength) {
+		udp->peer = from;
+		udp->peerLength = length;
+	}
+	return received;
+}
+
+static void DestroyUdp(struct NetLink* link) {
+	struct UdpLink* udp = (struct UdpLink*)link;
+	CloseSocket(udp->socket);
+	free(udp);
+}
+
+struct NetLink* CreateUdpLink(const char* host, int port) {
+	// Listens on the port when there's no host to connect to.
+	struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_DGRAM, .ai_flags = host ? 0 : AI_PASSIVE};
+	struct addrinfo* address;
+	char service[8];
+#ifdef _WIN32
+	WSADATA wsa;
+	WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+	snprintf(service, 8, "%d", port);
+	if (getaddrinfo(host, service, &hints, &address)) {
+		return NULL;
+	}
+	struct UdpLink* udp = calloc(1, sizeof(struct UdpLink));
+	udp->socket = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+	if (udp->socket == INVALID_SOCKET || (!host && bind(udp->socket, address->ai_addr, address->ai_addrlen))) {
+		if (udp->socket != INVALID_SOCKET) {
+			CloseSocket(udp->socket);
+		}
+		freeaddrinfo(address);
+		free(udp);
+		return NULL;
+	}
+	if (host) {
+		memcpy(&udp->peer, address->ai_addr, address->ai_addrlen);
+		udp->peerLength = address->ai_addrlen;
+	}
+	freeaddrinfo(address);
+#ifdef _WIN32
+	u_long nonblocking = 1;
+	ioctlsocket(udp->socket, FIONBIO, &nonblocking);
+#else
+	fcntl(udp->socket, F_SETFL, fcntl(udp->socket, F_GETFL) | O_NONBLOCK);
+#endif
+	udp->link.send = SendUdp;
+	udp->link.receive = ReceiveUdp;
+	udp->link.destroy = DestroyUdp;
+	return &udp->link;
+}
+#else
+struct NetLink* CreateUdpLink(const char* host, int port) {
+	return NULL;
+}
+#endif
+
+/* In process */
+
+struct LoopbackPacket {
+	size_t size;
+	uint8_t data[NETPLAY_MAX_PACKET];
+};
+
+struct LoopbackQueue {
+	struct LoopbackPacket packets[IMPAIRED_QUEUE];
+	unsigned int head, count;
+	int references;
+};
+
+struct LoopbackLink {
+	struct NetLink link;
+	struct LoopbackQueue *in, *out;
+};
+
+static bool SendLoopback(struct NetLink* link, const uint8_t* data, size_t size, double now) {
+	struct LoopbackQueue* queue = ((struct LoopbackLink*)link)->out;
+	if (queue->count == IMPAIRED_QUEUE || size > NETPLAY_MAX_PACKET) {
+		return false;
+	}
+	struct LoopbackPacket* packet = &queue->packets[(queue->head + queue->count++) % IMPAIRED_QUEUE];
+	packet->size = size;
+	memcpy(packet->data, data, size);
+	return true;
+}
+
+static int ReceiveLoopback(struct NetLink* link, uint8_t* buffer, size_t size, double now) {
+	struct LoopbackQueue* queue = ((struct LoopbackLink*)link)->in;
+	if (!queue->count) {
+		return -1;
+	}
+	struct LoopbackPacket* packet = &queue->packets[queue->head];
+	queue->head = (queue->head + 1) % IMPAIRED_QUEUE;
+	queue->count--;
+	if (packet->size > size) {
+		return -1;
+	}
+	memcpy(buffer, packet->data, packet->size);
+	return packet->size;
+}
+
+static void ReleaseQueue(struct LoopbackQueue* queue) {
+	if (!--queue->references) {
+		free(queue);
+	}
+}
+
+static void DestroyLoopback(struct NetLink* link) {
+	struct LoopbackLink* loopback = (struct LoopbackLink*)link;
+	ReleaseQueue(loopback->in);
+	ReleaseQueue(loopback->out);
+	free(loopback);
+}
+
+void CreateLoopbackLinks(struct NetLink* links[2]) {
+	// two ends of a lossless pipe
+	struct LoopbackQueue* queues[2] = {calloc(1, sizeof(struct LoopbackQueue)), calloc(1, sizeof(struct LoopbackQueue))};
+	int i;
+	for (i = 0; i < 2; i++) {
+		struct LoopbackLink* loopback = calloc(1, sizeof(struct LoopbackLink));
+		loopback->in = queues[i];
+		loopback->out = queues[!i];
+		queues[0]->references++;
+		queues[1]->references++;
+		loopback->link.send = SendLoopback;
+		loopback->link.receive = ReceiveLoopback;
+		loopback->link.destroy = DestroyLoopback;
+		links[i] = &loopback->link;
+	}
+}
+
+/* Network simulation */
+
+struct DelayedPacket {
+	double due;
+	size_t size;
+	uint8_t data[NETPLAY_MAX_PACKET];
+};
+
+struct ImpairedLink {
+	// Outgoing packets get dropped or held back for a while, which also
+	// reorders them when the jitter is bigger than the interval between them.
+	struct NetLink link;
+	struct NetLink* inner;
+	struct NetConditions conditions;
+	struct Rng rng;
+	struct DelayedPacket queue[IMPAIRED_QUEUE];
+	int count;
+};
+
+static void FlushImpaired(struct ImpairedLink* impaired, double now) {
+	int i;
+	for (i = 0; i < impaired->count;) {
+		if (impaired->queue[i].due > now) {
+			i++;
+			continue;
+		}
+		impaired->inner->send(impaired->inner, impaired->queue[i].data, impaired->queue[i].size, now);
+		impaired->queue[i] = impaired->queue[--impaired->count];
+	}
+}
+
+static bool SendImpaired(struct NetLink* link, const uint8_t* data, size_t size, double now) {
+	struct ImpairedLink* impaired = (struct ImpairedLink*)link;
+	FlushImpaired(impaired, now);
+	if (RandomFloat(&impaired->rng) < impaired->conditions.loss) {
+		return true;
+	}
+	if (impaired->count == IMPAIRED_QUEUE || size > NETPLAY_MAX_PACKET) {
+		return false;
+	}
+	struct DelayedPacket* packet = &impaired->queue[impaired->count++];
+	double delay = impaired->conditions.latency + impaired->conditions.jitter * (2.0 * RandomFloat(&impaired->rng) - 1.0);
+	packet->due = now + ((delay > 0) ? delay : 0);
+	packet->size = size;
+	memcpy(packet->data, data, size);
+	FlushImpaired(impaired, now);
+	return true;
+}
+
+static int ReceiveImpaired(struct NetLink* link, uint8_t* buffer, size_t size, double now) {
+	struct ImpairedLink* impaired = (struct ImpairedLink*)link;
+	FlushImpaired(impaired, now);
+	return impaired->inner->receive(impaired->inner, buffer, size, now);
+}
+
+static void DestroyImpaired(struct NetLink* link) {
+	struct ImpairedLink* impaired = (struct ImpairedLink*)link;
+	impaired->inner->destroy(impaired->inner);
+	free(impaired);
+}
+
+struct NetLink* CreateImpairedLink(struct NetLink* link, const struct NetConditions* conditions, uint32_t seed) {
+	// takes ownership of the wrapped link
+	struct ImpairedLink* impaired = calloc(1, sizeof(struct ImpairedLink));
+	impaired->inner = link;
+	impaired->conditions = *conditions;
+	SeedRandom(&impaired->rng, seed);
+	impaired->link.send = SendImpaired;
+	impaired->link.receive = ReceiveImpaired;
+	impaired->link.destroy = DestroyImpaired;
+	return &impaired->link;
+}
+
+/* Setup */
+
+bool SendNetplaySetup(struct NetLink* link, const struct NetplaySetup* setup, double now) {
+	// Without a setup, asks the host for one.
+	uint8_t buffer[32];
+	size_t size = StartPacket(buffer, setup ? PACKET_SETUP : PACKET_JOIN);
+	if (setup) {
+		Put32(buffer, &size, setup->seed);
+		Put32(buffer, &size, setup->width);
+		Put32(buffer, &size, setup->height);
+		Put32(buffer, &size, setup->rate);
+	}
+	return link->send(link, buffer, size, now);
+}
+
+bool ReceiveNetplaySetup(struct NetLink* link, struct NetplaySetup* setup, double now) {
+	// True once the host has sent the setup or, when setup is NULL, once
+	// someone asked for it.
+	uint8_t buffer[NETPLAY_MAX_PACKET];
+	int packet;
+	while ((packet = ReceivePacket(link, buffer, now)) >= 0) {
+		size_t cursor = 5, size = packet >> 8;
+		uint32_t seed, width, height, rate;
+		if (!setup && (packet & 0xff) == PACKET_JOIN) {
+			return true;
+		}
+		if (setup && (packet & 0xff) == PACKET_SETUP && Get32(buffer, size, &cursor, &seed) && Get32(buffer, size, &cursor, &width) &&
+			Get32(buffer, size, &cursor, &height) && Get32(buffer, size, &cursor, &rate) &&
+			width >= MAZE_MIN_SIZE && width <= MAZE_MAX_SIZE && height >= MAZE_MIN_SIZE && height <= MAZE_MAX_SIZE && rate) {
+			setup->seed = seed;
+			setup->width = width;
+			setup->height = height;
+			setup->rate = rate;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Rollback */
+
+static struct NetFrame* GetFrame(struct Netplay* net, int frame) {
+	return &net->frames[frame & (NETPLAY_HISTORY - 1)];
+}
+
+static void ClearFrame(struct Netplay* net, int frame) {
+	struct NetFrame* entry = GetFrame(net, frame);
+	memset(entry->count, 0, sizeof(entry->count));
+	entry->frame = frame;
+	entry->confirmed = false;
+	entry->heard = false;
+}
+
+static void PredictFrame(struct Netplay* net, int frame) {
+	// The other player most likely didn't press anything, and their music
+	// kept playing at the speed of the previous frames.
+	struct NetFrame* entry = GetFrame(net, frame);
+	int64_t clock = 0, step = 0;
+	if (entry->confirmed) {
+		return;
+	}
+	if (frame > 0) {
+		clock = GetFrame(net, frame - 1)->clock[net->remote];
+	}
+	if (frame > 1) {
+		step = clock - GetFrame(net, frame - 2)->clock[net->remote];
+	}
+	entry->clock[net->remote] = clock + ((step > 0) ? step : 0);
+	entry->count[net->remote] = 0;
+}
+
+static void AddCue(struct MatchCues* cues, const struct MatchCue* cue) {
+	if (cues && cues->count < MATCH_MAX_CUES) {
+		cues->cue[cues->count++] = *cue;
+	}
+}
+
+static void SimulateFrame(struct Netplay* net, int frame, struct MatchCues* cues, bool again) {
+	// Inputs are judged in the order of players, the same as when both play
+	// on one machine. When simulating again, only the sounds of remote inputs
+	// that weren't heard yet are kept.
+	struct NetFrame* entry = GetFrame(net, frame);
+	struct MatchInput inputs[NETPLAY_PLAYERS * NETPLAY_MAX_INPUTS];
+	struct MatchCues step;
+	int count = 0, p, i;
+	bool ended = net->session->ended;
+	entry->before = *net->session;
+	for (p = 0; p < NETPLAY_PLAYERS; p++) {
+		for (i = 0; i < entry->count[p]; i++) {
+			inputs[count++] = entry->inputs[p][i];
+		}
+	}
+	StepMatch(net->session, inputs, count, entry->clock, &step);
+	if (!ended && net->session->ended) {
+		net->end = frame;
+	}
+	for (i = 0; i < step.count; i++) {
+		struct MatchCue* cue = &step.cue[i];
+		if (cue->type == MATCH_CUE_WIN) {
+			continue; // announced only once confirmed
+		}
+		if (!again || (cue->player == net->remote && entry->confirmed && !entry->heard && cue->type != MATCH_CUE_MUSIC_SPEED)) {
+			AddCue(cues, cue);
+		}
+	}
+	if (entry->confirmed && entry->count[net->remote]) {
+		entry->heard = true;
+	}
+}
+
+static void SendFrames(struct Netplay* net, double now) {
+	uint8_t buffer[NETPLAY_MAX_PACKET];
+	size_t size = StartPacket(buffer, PACKET_FRAMES), count;
+	int first = net->acked, last = net->frame, frame, i;
+	if (last - first > NETPLAY_RESEND) {
+		last = first + NETPLAY_RESEND;
+	}
+	Put32(buffer, &size, net->received);
+	Put32(buffer, &size, first);
+	count = size++;
+	for (frame = first; frame < last && size + 9 + NETPLAY_MAX_INPUTS * 9 <= NETPLAY_MAX_PACKET; frame++) {
+		struct NetFrame* entry = GetFrame(net, frame);
+		Put64(buffer, &size, entry->clock[net->local]);
+		buffer[size++] = entry->count[net->local];
+		for (i = 0; i < entry->count[net->local]; i++) {
+			buffer[size++] = entry->inputs[net->local][i].direction;
+			Put64(buffer, &size, entry->inputs[net->local][i].clock);
+		}
+	}
+	buffer[count] = frame - first;
+	net->link->send(net->link, buffer, size, now);
+}
+
+static int ReadFrames(struct Netplay* net, const uint8_t* buffer, size_t size) {
+	// Stores the remote data and returns the first frame that has already
+	// been simulated with a wrong prediction, if any.
+	size_t cursor = 5;
+	uint32_t acked, first;
+	int rollback = net->frame, frame, i;
+	if (!Get32(buffer, size, &cursor, &acked) || !Get32(buffer, size, &cursor, &first) || cursor >= size) {
+		return rollback;
+	}
+	if ((int)acked > net->acked && (int)acked <= net->frame) {
+		net->acked = acked;
+	}
+	int count = buffer[cursor++];
+	for (frame = first; frame < (int)first + count; frame++) {
+		struct NetFrame* entry = GetFrame(net, frame);
+		struct NetFrame received = {.count = {0}};
+		if (!Get64(buffer, size, &cursor, &received.clock[net->remote]) || cursor >= size) {
+			return rollback;
+		}
+		received.count[net->remote] = buffer[cursor++];
+		if (received.count[net->remote] > NETPLAY_MAX_INPUTS) {
+			return rollback;
+		}
+		for (i = 0; i < received.count[net->remote]; i++) {
+			struct MatchInput* input = &received.inputs[net->remote][i];
+			if (cursor >= size) {
+				return rollback;
+			}
+			input->player = net->remote;
+			input->direction = buffer[cursor++] & 3;
+			if (!Get64(buffer, size, &cursor, &input->clock)) {
+				return rollback;
+			}
+		}
+		if (frame < net->received || frame >= net->received + NETPLAY_HISTORY - NETPLAY_WINDOW) {
+			continue; // known already, or too far ahead to keep
+		}
+		if (frame >= net->frame && entry->frame != frame) {
+			ClearFrame(net, frame);
+		}
+		if (entry->confirmed) {
+			continue;
+		}
+		if (frame < net->frame && (entry->clock[net->remote] != received.clock[net->remote] || received.count[net->remote])) {
+			rollback = (frame < rollback) ? frame : rollback;
+		}
+		entry->clock[net->remote] = received.clock[net->remote];
+		entry->count[net->remote] = received.count[net->remote];
+		memcpy(entry->inputs[net->remote], received.inputs[net->remote], sizeof(received.inputs[net->remote]));
+		entry->confirmed = true;
+	}
+	while (net->received < net->frame + NETPLAY_WINDOW && GetFrame(net, net->received)->frame == net->received && GetFrame(net, net->received)->confirmed) {
+		net->received++;
+	}
+	return rollback;
+}
+
+static void RecordConfirmed(struct Netplay* net) {
+	// frames known from both sides won't change anymore
+	int p, i;
+	while (net->recorded < net->frame && net->recorded < net->received && (net->end < 0 || net->recorded <= net->end)) {
+		struct NetFrame* entry = GetFrame(net, net->recorded);
+		for (p = 0; p < NETPLAY_PLAYERS && net->replay; p++) {
+			for (i = 0; i < entry->count[p]; i++) {
+				RecordReplayInput(net->replay, &entry->before, &entry->inputs[p][i]);
+			}
+		}
+		net->recorded++;
+	}
+}
+
+static void Receive(struct Netplay* net, double now, struct MatchCues* cues) {
+	uint8_t buffer[NETPLAY_MAX_PACKET];
+	int packet, rollback = net->frame, frame;
+	while ((packet = ReceivePacket(net->link, buffer, now)) >= 0) {
+		if ((packet & 0xff) == PACKET_JOIN && net->local == 0) {
+			// the setup got lost, or the other side started over
+			struct NetplaySetup setup = {net->session->maze->seed, net->session->maze->width, net->session->maze->height, net->session->rate};
+			SendNetplaySetup(net->link, &setup, now);
+		}
+		if ((packet & 0xff) == PACKET_FRAMES) {
+			frame = ReadFrames(net, buffer, packet >> 8);
+			rollback = (frame < rollback) ? frame : rollback;
+		}
+	}
+	if (rollback >= net->frame || net->over) {
+		return;
+	}
+	// Roll back to the first mispredicted frame and simulate everything
+	// since then again.
+	net->rollbacks++;
+	*net->session = GetFrame(net, rollback)->before;
+	if (net->end >= rollback) {
+		net->end = -1;
+	}
+	for (frame = rollback; frame < net->frame; frame++) {
+		PredictFrame(net, frame);
+		SimulateFrame(net, frame, cues, true);
+		net->resimulated++;
+	}
+}
+
+static void CheckEnd(struct Netplay* net, struct MatchCues* cues) {
+	// Once everything up to the end is known from both sides, the state
+	// after the frame the match ended in is the final one.
+	if (net->over || net->end < 0 || net->received <= net->end) {
+		return;
+	}
+	if (net->frame > net->end + 1) {
+		*net->session = GetFrame(net, net->end + 1)->before;
+		net->frame = net->end + 1;
+	}
+	net->over = true;
+	struct MatchCue win = {.type = MATCH_CUE_WIN, .player = net->session->winner};
+	AddCue(cues, &win);
+}
+
+struct Netplay* CreateNetplay(struct NetLink* link, struct MatchSession* session, int local) {
+	// Takes ownership of the link. The session has to be freshly initialized,
+	// for two players and on a maze that doesn't change, so not an endless one.
+	struct Netplay* net = calloc(1, sizeof(struct Netplay));
+	int i;
+	net->link = link;
+	net->session = session;
+	net->local = local;
+	net->remote = !local;
+	net->end = -1;
+	for (i = 0; i < NETPLAY_HISTORY; i++) {
+		net->frames[i].frame = -1;
+	}
+	return net;
+}
+
+void DestroyNetplay(struct Netplay* net) {
+	net->link->destroy(net->link);
+	free(net);
+}
+
+void QueueNetplayInput(struct Netplay* net, const struct MatchInput* input) {
+	// Local inputs wait for the next frame to be simulated.
+	if (net->pendingCount < NETPLAY_MAX_INPUTS) {
+		net->pending[net->pendingCount++] = *input;
+	}
+}
+
+bool StepNetplay(struct Netplay* net, int64_t clock, double now, struct MatchCues* cues) {
+	// Simulates the next frame with the local player's queued inputs and
+	// clock, predicting whatever the other player did. Returns false when
+	// it has to wait for the other side to catch up instead.
+	int i;
+	if (cues) {
+		cues->count = 0;
+	}
+	Receive(net, now, cues);
+	CheckEnd(net, cues);
+	if (net->over || net->frame - net->received >= NETPLAY_WINDOW) {
+		net->stalls += !net->over;
+		SendFrames(net, now);
+		RecordConfirmed(net);
+		return false;
+	}
+
+	struct NetFrame* entry = GetFrame(net, net->frame);
+	if (entry->frame != net->frame) {
+		ClearFrame(net, net->frame);
+	}
+	entry->clock[net->local] = clock;
+	entry->count[net->local] = net->pendingCount;
+	for (i = 0; i < net->pendingCount; i++) {
+		entry->inputs[net->local][i] = net->pending[i];
+		entry->inputs[net->local][i].player = net->local;
+	}
+	net->pendingCount = 0;
+	PredictFrame(net, net->frame);
+	SimulateFrame(net, net->frame, cues, false);
+	net->frame++;
+
+	CheckEnd(net, cues);
+	SendFrames(net, now);
+	RecordConfirmed(net);
+	return true;
+}
+
+void PollNetplay(struct Netplay* net, double now) {
+	// Keeps the other side supplied with our frames while not simulating,
+	// e.g. on the end screen.
+	Receive(net, now, NULL);
+	SendFrames(net, now);
+	RecordConfirmed(net);
+}
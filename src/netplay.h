@@ -0,0 +1,105 @@
+/*! \file netplay.h
+ *  \brief Versus matches between two instances with rollback, independent from Allegro.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZJEDZTRAWKE2_NETPLAY_H
+#define ZJEDZTRAWKE2_NETPLAY_H
+
+#include "match.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define NETPLAY_PORT 7766
+#define NETPLAY_PLAYERS 2
+#define NETPLAY_WINDOW 64 // frames that can go unconfirmed before the match waits for the other side
+#define NETPLAY_HISTORY (NETPLAY_WINDOW * 2) // must be a power of two
+#define NETPLAY_MAX_INPUTS 4 // per player and frame
+#define NETPLAY_MAX_PACKET 1024
+
+struct Replay;
+
+struct NetLink {
+	// Unreliable, unordered datagrams. Implemented with UDP, or in process
+	// for testing; either can be wrapped in a simulation of a bad network.
+	bool (*send)(struct NetLink* link, const uint8_t* data, size_t size, double now);
+	int (*receive)(struct NetLink* link, uint8_t* buffer, size_t size, double now); // -1 when there's nothing
+	void (*destroy)(struct NetLink* link);
+};
+
+struct NetConditions {
+	double latency, jitter; // in seconds, one way
+	float loss; // chance of a packet getting lost
+};
+
+struct NetplaySetup {
+	// sent by the host, so both sides play the same match
+	uint32_t seed;
+	int width, height;
+	int rate;
+};
+
+struct NetFrame {
+	// Everything needed to simulate a frame again: the state it started from
+	// and each player's inputs and clock. The remote player's data is
+	// predicted until it arrives.
+	int frame;
+	struct MatchSession before;
+	int64_t clock[NETPLAY_PLAYERS];
+	struct MatchInput inputs[NETPLAY_PLAYERS][NETPLAY_MAX_INPUTS];
+	int count[NETPLAY_PLAYERS];
+	bool confirmed; // remote data is known
+	bool heard; // remote inputs have already been played back as cues
+};
+
+struct Netplay {
+	struct NetLink* link;
+	struct MatchSession* session;
+	struct Replay* replay; // confirmed inputs get recorded into it, if set
+	int local, remote;
+
+	struct NetFrame frames[NETPLAY_HISTORY];
+	int frame; // next one to simulate
+	int received; // remote data is known for all frames before this one
+	int acked; // the other side knows our data for all frames before this one
+	int recorded; // frames recorded into the replay
+	int end; // frame the match ended in, -1 if it didn't yet
+	bool over; // the end is confirmed and the state final
+
+	struct MatchInput pending[NETPLAY_MAX_INPUTS];
+	int pendingCount;
+
+	// statistics
+	int rollbacks, resimulated, stalls;
+};
+
+struct NetLink* CreateUdpLink(const char* host, int port);
+void CreateLoopbackLinks(struct NetLink* links[2]);
+struct NetLink* CreateImpairedLink(struct NetLink* link, const struct NetConditions* conditions, uint32_t seed);
+
+bool SendNetplaySetup(struct NetLink* link, const struct NetplaySetup* setup, double now);
+bool ReceiveNetplaySetup(struct NetLink* link, struct NetplaySetup* setup, double now);
+
+struct Netplay* CreateNetplay(struct NetLink* link, struct MatchSession* session, int local);
+void DestroyNetplay(struct Netplay* net);
+void QueueNetplayInput(struct Netplay* net, const struct MatchInput* input);
+bool StepNetplay(struct Netplay* net, int64_t clock, double now, struct MatchCues* cues);
+void PollNetplay(struct Netplay* net, double now);
+
+#endif
@@ -0,0 +1,350 @@
+/*! \file pack.c
+ *  \brief Build step decoding the assets ahead of time into a single archive.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "archive.h"
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_acodec.h>
+#include <allegro5/allegro_audio.h>
+#include <allegro5/allegro_font.h>
+#include <allegro5/allegro_image.h>
+#include <allegro5/allegro_ttf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FONT_FIRST 32
+#define FONT_LAST 126
+#define FONT_COLUMNS 16
+
+struct Packed {
+	struct ArchiveEntry entry;
+	void* payload;
+};
+
+static void* CopyPixels(ALLEGRO_BITMAP* bitmap, struct ArchiveEntry* entry) {
+	// Stored the way al_load_bitmap left them, premultiplied alpha included.
+	int width = al_get_bitmap_width(bitmap), height = al_get_bitmap_height(bitmap), y;
+	uint8_t* pixels = malloc((size_t)width * height * 4);
+	ALLEGRO_LOCKED_REGION* region = al_lock_bitmap(bitmap, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_READONLY);
+	if (!region) {
+		free(pixels);
+		return NULL;
+	}
+	for (y = 0; y < height; y++) {
+		memcpy(pixels + (size_t)y * width * 4, (uint8_t*)region->data + (ptrdiff_t)y * region->pitch, (size_t)width * 4);
+	}
+	al_unlock_bitmap(bitmap);
+	entry->width = width;
+	entry->height = height;
+	entry->size = width * height * 4;
+	return pixels;
+}
+
+static void* PackBitmap(const char* filename, struct ArchiveEntry* entry) {
+	ALLEGRO_BITMAP* bitmap = al_load_bitmap(filename);
+	void* pixels;
+	if (!bitmap) {
+		return NULL;
+	}
+	pixels = CopyPixels(bitmap, entry);
+	al_destroy_bitmap(bitmap);
+	return pixels;
+}
+
+static bool GetFrame(const void* data, ALLEGRO_AUDIO_DEPTH depth, size_t i, float* value) {
+	switch (depth) {
+		case ALLEGRO_AUDIO_DEPTH_INT8:
+			*value = ((const int8_t*)data)[i] / 128.0f;
+			return true;
+		case ALLEGRO_AUDIO_DEPTH_UINT8:
+			*value = (((const uint8_t*)data)[i] - 128) / 128.0f;
+			return true;
+		case ALLEGRO_AUDIO_DEPTH_INT16:
+			*value = ((const int16_t*)data)[i] / 32768.0f;
+			return true;
+		case ALLEGRO_AUDIO_DEPTH_UINT16:
+			*value = (((const uint16_t*)data)[i] - 32768) / 32768.0f;
+			return true;
+		case ALLEGRO_AUDIO_DEPTH_FLOAT32:
+			*value = ((const float*)data)[i];
+			return true;
+		default:
+			return false;
+	}
+}
+
+static void* PackSample(const char* filename, int rate, struct ArchiveEntry* entry) {
+	// Converted to 16 bit PCM at the rate of the mixers, so playing it back
+	// needs neither decoding nor resampling. Resampled linearly, which is
+	// what the mixers would do anyway.
+	ALLEGRO_SAMPLE* sample = al_load_sample(filename);
+	ALLEGRO_AUDIO_DEPTH depth;
+	const void* data;
+	int16_t* pcm;
+	size_t length, frames, frame;
+	int channels, c, source;
+	float a, b;
+	if (!sample) {
+		return NULL;
+	}
+	depth = al_get_sample_depth(sample);
+	data = al_get_sample_data(sample);
+	source = al_get_sample_frequency(sample);
+	channels = al_get_channel_count(al_get_sample_channels(sample));
+	length = al_get_sample_length(sample);
+	if (!rate) {
+		rate = source;
+	}
+	frames = (size_t)((double)length * rate / source);
+	pcm = malloc(frames * channels * sizeof(int16_t) + 1);
+	for (frame = 0; frame < frames; frame++) {
+		double position = (double)frame * source / rate;
+		size_t i = (size_t)position;
+		float t = position - i;
+		for (c = 0; c < channels; c++) {
+			if (!GetFrame(data, depth, i * channels + c, &a) || !GetFrame(data, depth, ((i + 1 < length) ? i + 1 : i) * channels + c, &b)) {
+				fprintf(stderr, "%s: unsupported sample depth\n", filename);
+				free(pcm);
+				al_destroy_sample(sample);
+				return NULL;
+			}
+			a += (b - a) * t;
+			pcm[frame * channels + c] = (int16_t)(a <= -1 ? -32768 : (a >= 1 ? 32767 : a * 32767));
+		}
+	}
+	al_destroy_sample(sample);
+	entry->rate = rate;
+	entry->channels = channels;
+	entry->length = frames;
+	entry->size = frames * channels * sizeof(int16_t);
+	return pcm;
+}
+
+static void* PackFont(const char* filename, int size, struct ArchiveEntry* entry) {
+	// Glyphs are rendered into equally tall cells separated by a border of
+	// the color of the top left pixel, which al_grab_font_from_bitmap then
+	// cuts them out by. Kerning is lost, which doesn't matter for the
+	// monospace fonts used.
+	ALLEGRO_FONT* font = al_load_ttf_font(filename, size, 0);
+	ALLEGRO_BITMAP* atlas;
+	ALLEGRO_COLOR border = al_map_rgb(255, 0, 255);
+	int height, width = 0, rowWidth = 1, rows = 0, x, y, c, i, j;
+	void* pixels;
+	if (!font) {
+		return NULL;
+	}
+	height = al_get_font_line_height(font);
+	for (c = FONT_FIRST; c <= FONT_LAST; c++) {
+		if ((c - FONT_FIRST) % FONT_COLUMNS == 0) {
+			rowWidth = 1;
+			rows++;
+		}
+		rowWidth += al_get_glyph_advance(font, c, ALLEGRO_NO_KERNING) + 1;
+		if (rowWidth > width) {
+			width = rowWidth;
+		}
+	}
+	atlas = al_create_bitmap(width, rows * (height + 1) + 1);
+	al_set_target_bitmap(atlas);
+	al_clear_to_color(border);
+	x = 1;
+	y = 1;
+	for (c = FONT_FIRST; c <= FONT_LAST; c++) {
+		int advance = al_get_glyph_advance(font, c, ALLEGRO_NO_KERNING);
+		if (c > FONT_FIRST && (c - FONT_FIRST) % FONT_COLUMNS == 0) {
+			x = 1;
+			y += height + 1;
+		}
+		for (i = 0; i < advance; i++) {
+			for (j = 0; j < height; j++) {
+				al_put_pixel(x + i, y + j, al_map_rgba(0, 0, 0, 0));
+			}
+		}
+		al_draw_glyph(font, al_map_rgb(255, 255, 255), x, y, c);
+		x += advance + 1;
+	}
+	al_destroy_font(font);
+	pixels = CopyPixels(atlas, entry);
+	al_destroy_bitmap(atlas);
+	entry->fontSize = size;
+	entry->first = FONT_FIRST;
+	entry->last = FONT_LAST;
+	return pixels;
+}
+
+static void* PackCheckerboard(struct ArchiveEntry* entry) {
+	// The one dosowisko draws over its pixelated text; every fourth pixel
+	// is a dark one.
+	int width = 320, height = 180, x, y;
+	uint8_t* pixels = calloc((size_t)width * height, 4);
+	for (y = 0; y < height; y += 2) {
+		for (x = 0; x < width; x += 2) {
+			pixels[((size_t)y * width + x) * 4 + 3] = 64;
+		}
+	}
+	entry->width = width;
+	entry->height = height;
+	entry->size = width * height * 4;
+	return pixels;
+}
+
+static bool HasExtension(const char* name, const char* extensions) {
+	const char* dot = strrchr(name, '.');
+	char extension[16];
+	if (!dot || strlen(dot) >= sizeof(extension) - 1) {
+		return false;
+	}
+	snprintf(extension, sizeof(extension), "%s,", dot + 1);
+	return strstr(extensions, extension) != NULL;
+}
+
+static bool Pack(const char* dir, const char* name, int rate, struct Packed* packed) {
+	// Names are paths relative to the data directory, with ":size" added for
+	// fonts. The ones starting with "@" are generated instead.
+	char path[4096], filename[ARCHIVE_NAME_LENGTH];
+	char* size = NULL;
+	struct ArchiveEntry* entry = &packed->entry;
+
+	if (strlen(name) >= ARCHIVE_NAME_LENGTH) {
+		fprintf(stderr, "%s: name too long\n", name);
+		return false;
+	}
+	strcpy(filename, name);
+	if (strchr(filename, ':')) {
+		size = strchr(filename, ':');
+		*size++ = '\0';
+	}
+	memset(entry, 0, sizeof(struct ArchiveEntry));
+	strcpy(entry->name, filename);
+	snprintf(path, sizeof(path), "%s/%s", dir, filename);
+
+	if (!strcmp(filename, "@checkerboard")) {
+		entry->type = ARCHIVE_BITMAP;
+		packed->payload = PackCheckerboard(entry);
+	} else if (size) {
+		entry->type = ARCHIVE_FONT;
+		packed->payload = PackFont(path, strtol(size, NULL, 10), entry);
+	} else if (HasExtension(filename, "png,webp,jpg,bmp,")) {
+		entry->type = ARCHIVE_BITMAP;
+		packed->payload = PackBitmap(path, entry);
+	} else if (HasExtension(filename, "flac,ogg,opus,wav,")) {
+		entry->type = ARCHIVE_SAMPLE;
+		packed->payload = PackSample(path, rate, entry);
+	} else {
+		fprintf(stderr, "%s: unknown type of asset\n", name);
+		return false;
+	}
+	if (!packed->payload) {
+		fprintf(stderr, "%s: could not be decoded\n", name);
+		return false;
+	}
+	return true;
+}
+
+static bool Write(const char* filename, struct Packed* packed, int count) {
+	static const uint8_t padding[ARCHIVE_ALIGNMENT] = {0};
+	struct ArchiveHeader header = {.version = ARCHIVE_VERSION, .count = count};
+	uint32_t offset = sizeof(struct ArchiveHeader) + count * sizeof(struct ArchiveEntry);
+	FILE* file = fopen(filename, "wb");
+	int i;
+	bool ok;
+	if (!file) {
+		return false;
+	}
+	memcpy(header.magic, ARCHIVE_MAGIC, 4);
+	for (i = 0; i < count; i++) {
+		offset = (offset + ARCHIVE_ALIGNMENT - 1) / ARCHIVE_ALIGNMENT * ARCHIVE_ALIGNMENT;
+		packed[i].entry.offset = offset;
+		offset += packed[i].entry.size;
+	}
+	ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	offset = sizeof(struct ArchiveHeader);
+	for (i = 0; i < count && ok; i++) {
+		ok = fwrite(&packed[i].entry, sizeof(struct ArchiveEntry), 1, file) == 1;
+		offset += sizeof(struct ArchiveEntry);
+	}
+	for (i = 0; i < count && ok; i++) {
+		ok = fwrite(padding, 1, packed[i].entry.offset - offset, file) == packed[i].entry.offset - offset;
+		ok = ok && fwrite(packed[i].payload, 1, packed[i].entry.size, file) == packed[i].entry.size;
+		offset = packed[i].entry.offset + packed[i].entry.size;
+	}
+	return !fclose(file) && ok;
+}
+
+static void Usage(const char* name) {
+	fprintf(stderr, "Usage: %s -d dir -o archive [-r rate] asset...\n", name);
+	fprintf(stderr, "  -d  data directory the assets are in\n");
+	fprintf(stderr, "  -o  archive to write\n");
+	fprintf(stderr, "  -r  sample rate to convert samples to (default: keep their own)\n");
+	fprintf(stderr, "  assets are paths relative to the data directory, fonts followed by :size,\n");
+	fprintf(stderr, "  and @checkerboard for the generated texture\n");
+}
+
+int main(int argc, char** argv) {
+	const char *dir = NULL, *output = NULL;
+	struct Packed* packed;
+	int i, count = 0, rate = 0;
+	bool ok = true;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+			dir = argv[++i];
+		} else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+			output = argv[++i];
+		} else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+			rate = strtol(argv[++i], NULL, 10);
+		} else if (argv[i][0] == '-') {
+			Usage(argv[0]);
+			return 1;
+		} else {
+			break;
+		}
+	}
+	if (!dir || !output || i == argc) {
+		Usage(argv[0]);
+		return 1;
+	}
+
+	// everything is decoded into memory bitmaps, there's no display here
+	al_init();
+	al_init_image_addon();
+	al_init_acodec_addon();
+	al_init_font_addon();
+	al_init_ttf_addon();
+	al_set_new_bitmap_flags(ALLEGRO_MEMORY_BITMAP);
+
+	packed = calloc(argc - i, sizeof(struct Packed));
+	for (; i < argc; i++) {
+		if (Pack(dir, argv[i], rate, &packed[count])) {
+			count++;
+		} else {
+			ok = false;
+		}
+	}
+	if (ok && !Write(output, packed, count)) {
+		fprintf(stderr, "%s: could not be written\n", output);
+		ok = false;
+	}
+	for (i = 0; i < count; i++) {
+		free(packed[i].payload);
+	}
+	free(packed);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,289 @@
+/*! \file profiler.c
+ *  \brief Frame time measurements and their overlay.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "profiler.h"
+#include "common.h"
+#include "assets.h"
+#include <allegro5/allegro_primitives.h>
+#include <libsuperderpy.h>
+#include <stdio.h>
+#include <string.h>
+
+#define PROFILER_SAMPLES 256 // must be a power of two
+#define PROFILER_SCOPES 8
+#define SPARKLINE_WIDTH 128
+
+enum ProfilerSection {
+	PROFILE_LOGIC,
+	PROFILE_DRAW,
+	PROFILE_EVENT,
+	PROFILE_FRAME,
+	PROFILE_SECTIONS
+};
+
+static const char* sectionNames[] = {"logic", "draw", "event", "frame"};
+
+struct ProfilerSamples {
+	// ring of the most recent durations in milliseconds; recording one is
+	// just a store, statistics are only computed while the overlay is shown
+	float ms[PROFILER_SAMPLES];
+	unsigned int count;
+	float max;
+};
+
+struct ProfilerScope {
+	const char* name; // of the gamestate
+	struct ProfilerSamples section[PROFILE_SECTIONS];
+	int dropped;
+};
+
+struct Profiler {
+	ALLEGRO_FONT* font;
+	bool visible;
+	struct ProfilerScope scopes[PROFILER_SCOPES];
+	struct ProfilerScope* scope;
+	double start[PROFILE_SECTIONS];
+	bool event; // an event is being handled
+	double budget; // duration of a frame, in seconds
+
+	// how long the player waits, from launch to the menu and from picking
+	// a match to playing it, in seconds; negative until measured
+	double launched, picked;
+	double toMenu, toPlay;
+	double menuTarget, playTarget;
+};
+
+static void AddSample(struct ProfilerScope* scope, enum ProfilerSection section, double seconds) {
+	struct ProfilerSamples* samples = &scope->section[section];
+	float ms = seconds * 1000;
+	samples->ms[samples->count++ & (PROFILER_SAMPLES - 1)] = ms;
+	if (ms > samples->max) {
+		samples->max = ms;
+	}
+}
+
+static void EndEvent(struct Profiler* profiler, double now) {
+	// There's no handler called after an event has been processed, so an
+	// event lasts until whatever gets called next. That may include waiting
+	// for the next event to arrive, so anything longer than a frame gets
+	// thrown away.
+	if (profiler->event && now - profiler->start[PROFILE_EVENT] < profiler->budget) {
+		AddSample(profiler->scope, PROFILE_EVENT, now - profiler->start[PROFILE_EVENT]);
+	}
+	profiler->event = false;
+}
+
+static struct Profiler* GetProfiler(struct Game* game) {
+	return game->data ? game->data->profiler : NULL;
+}
+
+struct Profiler* CreateProfiler(struct Game* game) {
+	struct Profiler* profiler = calloc(1, sizeof(struct Profiler));
+	int refresh = al_get_display_refresh_rate(game->display);
+	profiler->font = al_create_builtin_font();
+	profiler->budget = 1.0 / (refresh ? refresh : 60);
+	profiler->scope = &profiler->scopes[0];
+	profiler->scope->name = "";
+	profiler->launched = al_get_time();
+	profiler->picked = -1;
+	profiler->toMenu = -1;
+	profiler->toPlay = -1;
+	profiler->menuTarget = strtod(GetConfigOptionDefault(game, "ZjedzTrawke2", "menutarget", "14"), NULL);
+	profiler->playTarget = strtod(GetConfigOptionDefault(game, "ZjedzTrawke2", "playtarget", "1"), NULL);
+	return profiler;
+}
+
+void DestroyProfiler(struct Profiler* profiler) {
+	al_destroy_font(profiler->font);
+	free(profiler);
+}
+
+void ToggleProfiler(struct Profiler* profiler) {
+	profiler->visible = !profiler->visible;
+}
+
+void SetProfilerScope(struct Game* game, const char* name) {
+	// Called by gamestates when they start, so that their timings are
+	// collected separately.
+	struct Profiler* profiler = GetProfiler(game);
+	int i;
+	if (!profiler) {
+		return;
+	}
+	for (i = 0; i < PROFILER_SCOPES; i++) {
+		if (!profiler->scopes[i].name || !strcmp(profiler->scopes[i].name, name)) {
+			break;
+		}
+	}
+	if (i == PROFILER_SCOPES) {
+		i = 0;
+	}
+	if (!profiler->scopes[i].name || strcmp(profiler->scopes[i].name, name)) {
+		memset(&profiler->scopes[i], 0, sizeof(struct ProfilerScope));
+		profiler->scopes[i].name = name;
+	}
+	profiler->scope = &profiler->scopes[i];
+}
+
+void ProfileEvent(struct Game* game) {
+	struct Profiler* profiler = GetProfiler(game);
+	if (!profiler) {
+		return;
+	}
+	double now = al_get_time();
+	EndEvent(profiler, now);
+	profiler->start[PROFILE_EVENT] = now;
+	profiler->event = true;
+}
+
+static void ReportWait(struct Game* game, const char* name, double seconds, double target) {
+	PrintConsole(game, "%s: %.3f s (target %.2f s)%s", name, seconds, target, (seconds > target) ? ", too slow!" : "");
+}
+
+void MarkMilestone(struct Game* game, enum Milestone milestone) {
+	// Only the first time the menu shows up counts; after that, it's already
+	// loaded.
+	struct Profiler* profiler = GetProfiler(game);
+	double now = al_get_time();
+	if (!profiler) {
+		return;
+	}
+	switch (milestone) {
+		case MILESTONE_MENU:
+			if (profiler->toMenu < 0) {
+				profiler->toMenu = now - profiler->launched;
+				ReportWait(game, "Launch to menu", profiler->toMenu, profiler->menuTarget);
+			}
+			break;
+		case MILESTONE_MATCH:
+			profiler->picked = now;
+			break;
+		case MILESTONE_PLAYABLE:
+			if (profiler->picked >= 0) {
+				profiler->toPlay = now - profiler->picked;
+				profiler->picked = -1;
+				ReportWait(game, "Menu to match", profiler->toPlay, profiler->playTarget);
+			}
+			break;
+	}
+}
+
+void ProfilerPreLogic(struct Game* game, double delta) {
+	struct Profiler* profiler = GetProfiler(game);
+	if (!profiler) {
+		return;
+	}
+	profiler->start[PROFILE_LOGIC] = al_get_time();
+	EndEvent(profiler, profiler->start[PROFILE_LOGIC]);
+}
+
+void ProfilerPostLogic(struct Game* game, double delta) {
+	struct Profiler* profiler = GetProfiler(game);
+	if (!profiler) {
+		return;
+	}
+	AddSample(profiler->scope, PROFILE_LOGIC, al_get_time() - profiler->start[PROFILE_LOGIC]);
+}
+
+void ProfilerPreDraw(struct Game* game) {
+	struct Profiler* profiler = GetProfiler(game);
+	if (!profiler) {
+		return;
+	}
+	double now = al_get_time();
+	EndEvent(profiler, now);
+	if (profiler->start[PROFILE_FRAME]) {
+		double frame = now - profiler->start[PROFILE_FRAME];
+		AddSample(profiler->scope, PROFILE_FRAME, frame);
+		if (frame > profiler->budget * 1.5) {
+			profiler->scope->dropped++;
+		}
+	}
+	profiler->start[PROFILE_FRAME] = now;
+	profiler->start[PROFILE_DRAW] = now;
+}
+
+static int CompareFloats(const void* a, const void* b) {
+	float x = *(const float*)a, y = *(const float*)b;
+	return (x > y) - (x < y);
+}
+
+static void DrawSection(struct Profiler* profiler, enum ProfilerSection section, float y) {
+	struct ProfilerSamples* samples = &profiler->scope->section[section];
+	unsigned int count = (samples->count < PROFILER_SAMPLES) ? samples->count : PROFILER_SAMPLES;
+	float sorted[PROFILER_SAMPLES];
+	char text[64];
+	if (!count) {
+		snprintf(text, 64, "%-5s    -     -     -", sectionNames[section]);
+	} else {
+		memcpy(sorted, samples->ms, count * sizeof(float));
+		qsort(sorted, count, sizeof(float), CompareFloats);
+		snprintf(text, 64, "%-5s %5.2f %5.2f %5.2f", sectionNames[section], sorted[count / 2], sorted[count * 99 / 100], samples->max);
+	}
+	al_draw_text(profiler->font, al_map_rgb(255, 255, 255), 4, y, ALLEGRO_ALIGN_LEFT, text);
+}
+
+static void DrawSparkline(struct Profiler* profiler, float x, float y, float height) {
+	// frame times, with the frame budget at half the height
+	struct ProfilerSamples* samples = &profiler->scope->section[PROFILE_FRAME];
+	float budget = profiler->budget * 1000;
+	unsigned int i;
+	al_draw_line(x, y - height / 2.0, x + SPARKLINE_WIDTH, y - height / 2.0, al_map_rgba(128, 128, 128, 128), 1);
+	for (i = 0; i < SPARKLINE_WIDTH && i < samples->count; i++) {
+		float ms = samples->ms[(samples->count - 1 - i) & (PROFILER_SAMPLES - 1)];
+		float h = ms / budget * height / 2.0;
+		if (h > height) {
+			h = height;
+		}
+		al_draw_line(x + SPARKLINE_WIDTH - i - 0.5, y, x + SPARKLINE_WIDTH - i - 0.5, y - h,
+			(ms > budget * 1.5) ? al_map_rgb(255, 64, 64) : al_map_rgb(160, 160, 0), 1);
+	}
+}
+
+void ProfilerPostDraw(struct Game* game) {
+	struct Profiler* profiler = GetProfiler(game);
+	char text[64];
+	int i;
+	if (!profiler) {
+		return;
+	}
+	AddSample(profiler->scope, PROFILE_DRAW, al_get_time() - profiler->start[PROFILE_DRAW]);
+	if (!profiler->visible) {
+		return;
+	}
+
+	// the overlay itself isn't counted in the draw timings
+	al_draw_filled_rectangle(0, 0, 188, 98, al_map_rgba(0, 0, 0, 192));
+	snprintf(text, 64, "%s, dropped: %d", profiler->scope->name, profiler->scope->dropped);
+	al_draw_text(profiler->font, al_map_rgb(255, 255, 255), 4, 2, ALLEGRO_ALIGN_LEFT, text);
+	al_draw_text(profiler->font, al_map_rgb(160, 160, 160), 4, 12, ALLEGRO_ALIGN_LEFT, "ms      p50   p99   max");
+	for (i = 0; i < PROFILE_SECTIONS; i++) {
+		DrawSection(profiler, i, 22 + i * 9);
+	}
+	DrawSparkline(profiler, 4, 76, 16);
+
+	struct AssetStats assets;
+	GetAssetStats(game->data->assets, &assets);
+	snprintf(text, 64, "assets: %d (%d used), %.1f MB", assets.count, assets.used, assets.bytes / (1024.0 * 1024.0));
+	al_draw_text(profiler->font, al_map_rgb(160, 160, 160), 4, 78, ALLEGRO_ALIGN_LEFT, text);
+
+	snprintf(text, 64, "menu %.1fs, play %.2fs", (profiler->toMenu < 0) ? 0 : profiler->toMenu, (profiler->toPlay < 0) ? 0 : profiler->toPlay);
+	al_draw_text(profiler->font, al_map_rgb(160, 160, 160), 4, 87, ALLEGRO_ALIGN_LEFT, text);
+}
@@ -0,0 +1,48 @@
+/*! \file profiler.h
+ *  \brief Frame time measurements and their overlay.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZJEDZTRAWKE2_PROFILER_H
+#define ZJEDZTRAWKE2_PROFILER_H
+
+#include <stdbool.h>
+
+struct Game;
+struct Profiler;
+
+enum Milestone {
+	MILESTONE_MENU, // the menu takes input
+	MILESTONE_MATCH, // a match got picked in the menu
+	MILESTONE_PLAYABLE, // its first frame got drawn
+};
+
+struct Profiler* CreateProfiler(struct Game* game);
+void DestroyProfiler(struct Profiler* profiler);
+void ToggleProfiler(struct Profiler* profiler);
+void SetProfilerScope(struct Game* game, const char* name);
+void ProfileEvent(struct Game* game);
+void MarkMilestone(struct Game* game, enum Milestone milestone);
+
+// to be used as libsuperderpy handlers
+void ProfilerPreLogic(struct Game* game, double delta);
+void ProfilerPostLogic(struct Game* game, double delta);
+void ProfilerPreDraw(struct Game* game);
+void ProfilerPostDraw(struct Game* game);
+
+#endif
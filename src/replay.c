@@ -0,0 +1,273 @@
+/*! \file replay.c
+ *  \brief Match recording and playback, independent from Allegro.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "replay.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REPLAY_MAGIC "ZT2R"
+#define REPLAY_VERSION 2 // version 1 didn't store the number of players, always two
+#define REPLAY_ENDLESS 1
+#define REPLAY_FINISHED 2
+
+/* File layout, all integers as LEB128 varints, signed ones zigzag encoded:
+ * magic, version byte, seed, width, height, flags byte, number of players,
+ * rate, size of the event stream followed by the stream itself, and for
+ * finished replays the final clocks, winner and scores of every player. */
+
+static void Reserve(struct Replay* replay, size_t size) {
+	if (replay->size + size <= replay->capacity) {
+		return;
+	}
+	while (replay->size + size > replay->capacity) {
+		replay->capacity = replay->capacity ? replay->capacity * 2 : 1024;
+	}
+	replay->events = realloc(replay->events, replay->capacity);
+}
+
+static size_t EncodeVarint(uint8_t* buffer, uint64_t value) {
+	size_t i = 0;
+	while (value >= 0x80) {
+		buffer[i++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	buffer[i++] = value;
+	return i;
+}
+
+static uint64_t ZigZag(int64_t value) {
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t UnZigZag(uint64_t value) {
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static bool DecodeVarint(const uint8_t* buffer, size_t size, size_t* cursor, uint64_t* value) {
+	int shift = 0;
+	*value = 0;
+	while (*cursor < size && shift < 64) {
+		uint8_t byte = buffer[(*cursor)++];
+		*value |= (uint64_t)(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			return true;
+		}
+		shift += 7;
+	}
+	return false;
+}
+
+struct Replay* CreateReplay(const struct MatchSession* session) {
+	struct Replay* replay = calloc(1, sizeof(struct Replay));
+	const struct Maze* maze = session->maze;
+	replay->seed = maze->seed;
+	replay->width = maze->width;
+	replay->height = maze->endless ? 0 : maze->height;
+	replay->endless = maze->endless;
+	replay->players = session->players;
+	replay->rate = session->rate;
+	replay->winner = -1;
+	return replay;
+}
+
+void DestroyReplay(struct Replay* replay) {
+	free(replay->events);
+	free(replay);
+}
+
+void RecordReplayInput(struct Replay* replay, const struct MatchSession* session, const struct MatchInput* input) {
+	// To be called with the session the input is about to be judged on.
+	// What's stored is the clock it gets judged at, so that playing it back
+	// doesn't depend on the clock updates that came before it.
+	int64_t clock = GetInputClock(session, input);
+	Reserve(replay, 11);
+	replay->events[replay->size++] = (input->player << 2) | input->direction;
+	replay->size += EncodeVarint(replay->events + replay->size, ZigZag(clock - replay->last[input->player]));
+	replay->last[input->player] = clock;
+}
+
+void FinishReplay(struct Replay* replay, const struct MatchSession* session) {
+	int i;
+	for (i = 0; i < session->players; i++) {
+		replay->clocks[i] = session->clock[i];
+		replay->scores[i] = session->score[i];
+	}
+	replay->winner = session->winner;
+	replay->finished = true;
+}
+
+static bool WriteVarint(FILE* file, uint64_t value) {
+	uint8_t buffer[10];
+	size_t size = EncodeVarint(buffer, value);
+	return fwrite(buffer, 1, size, file) == size;
+}
+
+bool SaveReplay(const struct Replay* replay, const char* filename) {
+	FILE* file = fopen(filename, "wb");
+	bool ok;
+	int i;
+	if (!file) {
+		return false;
+	}
+	ok = fwrite(REPLAY_MAGIC, 1, 4, file) == 4;
+	ok &= fputc(REPLAY_VERSION, file) != EOF;
+	ok &= WriteVarint(file, replay->seed);
+	ok &= WriteVarint(file, replay->width);
+	ok &= WriteVarint(file, replay->height);
+	ok &= fputc((replay->endless ? REPLAY_ENDLESS : 0) | (replay->finished ? REPLAY_FINISHED : 0), file) != EOF;
+	ok &= WriteVarint(file, replay->players);
+	ok &= WriteVarint(file, replay->rate);
+	ok &= WriteVarint(file, replay->size);
+	ok &= fwrite(replay->events, 1, replay->size, file) == replay->size;
+	if (replay->finished) {
+		for (i = 0; i < replay->players; i++) {
+			ok &= WriteVarint(file, ZigZag(replay->clocks[i]));
+		}
+		ok &= WriteVarint(file, ZigZag(replay->winner));
+		for (i = 0; i < replay->players; i++) {
+			ok &= WriteVarint(file, replay->scores[i]);
+		}
+	}
+	ok &= fclose(file) == 0;
+	return ok;
+}
+
+struct Replay* LoadReplay(const char* filename) {
+	FILE* file = fopen(filename, "rb");
+	uint8_t* buffer;
+	long length;
+	size_t cursor = 5;
+	uint64_t seed, width, height, players = 2, rate, size, value;
+	int i;
+	if (!file) {
+		return NULL;
+	}
+	fseek(file, 0, SEEK_END);
+	length = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if (length < 6) {
+		fclose(file);
+		return NULL;
+	}
+	buffer = malloc(length);
+	if (fread(buffer, 1, length, file) != (size_t)length || memcmp(buffer, REPLAY_MAGIC, 4) || buffer[4] < 1 || buffer[4] > REPLAY_VERSION) {
+		fclose(file);
+		free(buffer);
+		return NULL;
+	}
+	fclose(file);
+
+	if (!DecodeVarint(buffer, length, &cursor, &seed) || !DecodeVarint(buffer, length, &cursor, &width) ||
+		!DecodeVarint(buffer, length, &cursor, &height) || cursor >= (size_t)length) {
+		free(buffer);
+		return NULL;
+	}
+	uint8_t flags = buffer[cursor++];
+	if ((buffer[4] >= 2 && !DecodeVarint(buffer, length, &cursor, &players)) ||
+		!DecodeVarint(buffer, length, &cursor, &rate) || !DecodeVarint(buffer, length, &cursor, &size) ||
+		size > (size_t)length - cursor || width < MAZE_MIN_SIZE || width > MAZE_MAX_SIZE || !players || players > MATCH_MAX_PLAYERS ||
+		(!(flags & REPLAY_ENDLESS) && (height < MAZE_MIN_SIZE || height > MAZE_MAX_SIZE)) || !rate) {
+		free(buffer);
+		return NULL;
+	}
+
+	struct Replay* replay = calloc(1, sizeof(struct Replay));
+	replay->seed = seed;
+	replay->width = width;
+	replay->height = height;
+	replay->endless = flags & REPLAY_ENDLESS;
+	replay->players = players;
+	replay->rate = rate;
+	replay->winner = -1;
+	replay->size = replay->capacity = size;
+	replay->events = malloc(size ? size : 1);
+	memcpy(replay->events, buffer + cursor, size);
+	cursor += size;
+
+	if (flags & REPLAY_FINISHED) {
+		replay->finished = true;
+		for (i = 0; i < replay->players; i++) {
+			replay->finished &= DecodeVarint(buffer, length, &cursor, &value);
+			replay->clocks[i] = UnZigZag(value);
+		}
+		replay->finished &= DecodeVarint(buffer, length, &cursor, &value);
+		replay->winner = UnZigZag(value);
+		for (i = 0; i < replay->players; i++) {
+			replay->finished &= DecodeVarint(buffer, length, &cursor, &value);
+			replay->scores[i] = value;
+		}
+	}
+	free(buffer);
+	return replay;
+}
+
+struct Maze* CreateReplayMaze(const struct Replay* replay) {
+	if (replay->endless) {
+		return CreateEndlessMaze(replay->width, replay->seed);
+	}
+	return CreateMaze(replay->width, replay->height, replay->seed);
+}
+
+void RewindReplay(struct Replay* replay) {
+	replay->cursor = 0;
+	memset(replay->last, 0, sizeof(replay->last));
+}
+
+static bool DecodeInput(const struct Replay* replay, size_t* cursor, int64_t last[MATCH_MAX_PLAYERS], struct MatchInput* input) {
+	uint64_t delta;
+	if (*cursor >= replay->size) {
+		return false;
+	}
+	uint8_t byte = replay->events[(*cursor)++];
+	input->player = byte >> 2;
+	input->direction = byte & 3;
+	if (input->player >= replay->players || !DecodeVarint(replay->events, replay->size, cursor, &delta)) {
+		return false;
+	}
+	input->clock = last[input->player] + UnZigZag(delta);
+	last[input->player] = input->clock;
+	return true;
+}
+
+bool PeekReplayInput(struct Replay* replay, struct MatchInput* input) {
+	size_t cursor = replay->cursor;
+	int64_t last[MATCH_MAX_PLAYERS];
+	memcpy(last, replay->last, sizeof(last));
+	return DecodeInput(replay, &cursor, last, input);
+}
+
+bool NextReplayInput(struct Replay* replay, struct MatchInput* input) {
+	return DecodeInput(replay, &replay->cursor, replay->last, input);
+}
+
+void PlayReplay(struct Replay* replay, struct MatchSession* session) {
+	// Plays the whole replay back on a freshly initialized session, as fast
+	// as possible. Clock updates between inputs don't need to be repeated:
+	// the recorded clocks are already the ones the inputs were judged at.
+	struct MatchInput input;
+	RewindReplay(replay);
+	while (!session->ended && NextReplayInput(replay, &input)) {
+		StepMatch(session, &input, 1, NULL, NULL);
+	}
+	if (replay->finished) {
+		StepMatch(session, NULL, 0, replay->clocks, NULL);
+	}
+}
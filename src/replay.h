@@ -0,0 +1,67 @@
+/*! \file replay.h
+ *  \brief Match recording and playback, independent from Allegro.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZJEDZTRAWKE2_REPLAY_H
+#define ZJEDZTRAWKE2_REPLAY_H
+
+#include "match.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define REPLAY_EXTENSION ".zt2r"
+
+struct Replay {
+	// A match is fully determined by its maze and the inputs in the order
+	// they were judged, so that's all that gets stored. Each input takes a
+	// byte for the player and direction followed by a varint with the
+	// difference from the player's previous clock - usually 3 bytes total.
+	uint32_t seed;
+	int width, height;
+	bool endless;
+	int players;
+	int rate;
+
+	uint8_t* events;
+	size_t size, capacity;
+	size_t cursor; // read position during playback
+	int64_t last[MATCH_MAX_PLAYERS]; // previous clock of each player, for delta coding
+
+	// result of the recorded match, to verify playback against
+	bool finished;
+	int64_t clocks[MATCH_MAX_PLAYERS];
+	int winner;
+	int scores[MATCH_MAX_PLAYERS];
+};
+
+struct Replay* CreateReplay(const struct MatchSession* session);
+void DestroyReplay(struct Replay* replay);
+void RecordReplayInput(struct Replay* replay, const struct MatchSession* session, const struct MatchInput* input);
+void FinishReplay(struct Replay* replay, const struct MatchSession* session);
+bool SaveReplay(const struct Replay* replay, const char* filename);
+struct Replay* LoadReplay(const char* filename);
+
+struct Maze* CreateReplayMaze(const struct Replay* replay);
+void RewindReplay(struct Replay* replay);
+bool PeekReplayInput(struct Replay* replay, struct MatchInput* input);
+bool NextReplayInput(struct Replay* replay, struct MatchInput* input);
+void PlayReplay(struct Replay* replay, struct MatchSession* session);
+
+#endif
@@ -0,0 +1,56 @@
+/*! \file rng.h
+ *  \brief Small seedable PRNG (PCG32) for reproducible matches.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZJEDZTRAWKE2_RNG_H
+#define ZJEDZTRAWKE2_RNG_H
+
+#include <stdint.h>
+
+struct Rng {
+	uint64_t state, inc;
+};
+
+static inline uint32_t NextRandom(struct Rng* rng) {
+	uint64_t old = rng->state;
+	rng->state = old * 6364136223846793005ULL + rng->inc;
+	uint32_t xorshifted = (uint32_t)(((old >> 18u) ^ old) >> 27u);
+	uint32_t rot = (uint32_t)(old >> 59u);
+	return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+static inline void SeedRandom(struct Rng* rng, uint32_t seed) {
+	rng->state = 0;
+	rng->inc = ((uint64_t)seed << 1u) | 1u;
+	NextRandom(rng);
+	rng->state += seed;
+	NextRandom(rng);
+}
+
+// Returns a number in range [0, n).
+static inline uint32_t RandomBelow(struct Rng* rng, uint32_t n) {
+	return (uint32_t)(((uint64_t)NextRandom(rng) * n) >> 32);
+}
+
+// Returns a number in range [0, 1].
+static inline float RandomFloat(struct Rng* rng) {
+	return NextRandom(rng) / (float)UINT32_MAX;
+}
+
+#endif
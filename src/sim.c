@@ -0,0 +1,471 @@
+/*! \file sim.c
+ *  \brief Headless match simulator used for difficulty tuning.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "bot.h"
+#include "distance.h"
+#include "match.h"
+#include "netplay.h"
+#include "replay.h"
+#include "rng.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define TICK (1 / 60.0)
+
+struct Script {
+	// Scripted player: follows the right hand wall and presses with a random
+	// timing error of up to +-jitter beats.
+	enum direction heading;
+	float jitter;
+	float offset;
+	int beat;
+	struct Rng* rng;
+};
+
+struct Options {
+	int matches;
+	uint32_t seed;
+	uint32_t maze;
+	bool fixed;
+	bool endless;
+	double timeout;
+	int players;
+	float jitter[MATCH_MAX_PLAYERS];
+	bool verbose;
+	bool bots; // distance field following bots instead of scripts
+	float mistakes;
+	const char* record; // directory to save replays to
+	bool check; // play every match back from its replay, comparing the outcome
+	float latency; // in beats, that inputs reach the match late by, like uncalibrated setups do
+	bool netplay; // play every match again between two peers over a simulated network
+	struct NetConditions network;
+};
+
+struct Peer {
+	struct Netplay* net;
+	struct MatchSession session;
+	struct Maze* maze;
+	struct Bot bot;
+	double music;
+	bool stalled;
+};
+
+struct NetplayStats {
+	int mismatches, rollbacks, resimulated, stalls;
+};
+
+static bool RunScript(struct Script* script, const struct MatchSession* session, int id, struct MatchInput* input) {
+	// Looks for the next beat that hasn't been judged yet and presses once its
+	// offset reaches the planned one.
+	const struct Maze* maze = session->maze;
+	const struct BeatQueue* queue = &session->beats[id];
+	unsigned int i;
+	for (i = 0; i < queue->count; i++) {
+		unsigned int slot = BeatSlot(queue, i);
+		float offset = GetBeatOffset(session, queue->beat[slot], session->clock[id]);
+		if (queue->status[slot] != -1 || offset <= -0.25f) {
+			continue;
+		}
+		if (queue->id[slot] != script->beat) {
+			script->beat = queue->id[slot];
+			script->offset = script->jitter * (2.0f * RandomFloat(script->rng) - 1.0f);
+		}
+		if (offset > script->offset) {
+			return false;
+		}
+		input->clock = session->clock[id];
+		input->direction = FollowWall(&script->heading, maze, session->x[id], session->y[id]);
+		return true;
+	}
+	return false;
+}
+
+static bool IsReplayFaithful(struct Replay* replay, const struct MatchSession* session) {
+	// Plays the replay back the same way -r does.
+	struct Maze* maze = CreateReplayMaze(replay);
+	struct MatchSession played;
+	bool same;
+	int p;
+	InitMatch(&played, maze, replay->players, replay->rate);
+	PlayReplay(replay, &played);
+	same = played.winner == session->winner;
+	for (p = 0; p < session->players; p++) {
+		same &= played.score[p] == session->score[p];
+	}
+	DestroyMaze(maze);
+	return same;
+}
+
+static double RunMatch(struct Options* options, uint32_t* seed, int* winner, int scores[MATCH_MAX_PLAYERS], uint32_t* length, bool* faithful) {
+	struct Maze* maze;
+	if (options->endless) {
+		maze = CreateEndlessMaze(MAZE_WIDTH, *seed);
+	} else if (options->fixed) {
+		maze = CreateMaze(MAZE_WIDTH, MAZE_HEIGHT, *seed);
+		maze->distance = CreateDistanceField(maze, maze->xGrass, maze->yGrass);
+	} else {
+		maze = CreateSolvableMaze(MAZE_WIDTH, MAZE_HEIGHT, *seed);
+	}
+	struct MatchSession session;
+	struct Rng rng;
+	struct Script scripts[MATCH_MAX_PLAYERS];
+	struct Bot bots[MATCH_MAX_PLAYERS];
+	struct MatchInput inputs[MATCH_MAX_PLAYERS];
+	// music playback is emulated by advancing each player's position
+	// according to the speed it would be played at
+	double music[MATCH_MAX_PLAYERS] = {0};
+	int64_t clocks[MATCH_MAX_PLAYERS];
+	double time = 0;
+	int i;
+
+	InitMatch(&session, maze, options->players, MATCH_SAMPLE_RATE);
+	struct Replay* replay = (options->record || options->check) ? CreateReplay(&session) : NULL;
+	int64_t lag = GetBeatClock(&session, 0, options->latency);
+	SeedRandom(&rng, maze->seed);
+	for (i = 0; i < session.players; i++) {
+		scripts[i].rng = &rng;
+		scripts[i].heading = down;
+		scripts[i].jitter = options->jitter[i];
+		scripts[i].beat = -1;
+		if (options->bots) {
+			struct BotConfig config = {.jitter = options->jitter[i], .mistakes = options->mistakes};
+			InitBot(&bots[i], i, &config, NextRandom(&rng));
+		}
+	}
+
+	while (!session.ended && time < options->timeout) {
+		int count = 0;
+		for (i = 0; i < session.players; i++) {
+			inputs[count].player = i;
+			bool pressed = options->bots ? RunBot(&bots[i], &session, session.clock[i], &inputs[count]) : RunScript(&scripts[i], &session, i, &inputs[count]);
+			if (pressed) {
+				inputs[count].clock = (inputs[count].clock > lag) ? inputs[count].clock - lag : 0;
+				if (replay) {
+					RecordReplayInput(replay, &session, &inputs[count]);
+				}
+				count++;
+			}
+			music[i] += TICK * GetMusicSpeed(&session, i);
+			clocks[i] = (int64_t)(music[i] * MATCH_SAMPLE_RATE);
+		}
+		StepMatch(&session, inputs, count, clocks, NULL);
+		time += TICK;
+	}
+
+	*faithful = true;
+	if (replay) {
+		char filename[4096];
+		FinishReplay(replay, &session);
+		snprintf(filename, sizeof(filename), "%s/%u" REPLAY_EXTENSION, options->record, maze->seed);
+		if (options->record && !SaveReplay(replay, filename)) {
+			fprintf(stderr, "Couldn't save %s\n", filename);
+		}
+		if (options->check) {
+			*faithful = IsReplayFaithful(replay, &session);
+		}
+		DestroyReplay(replay);
+	}
+
+	*seed = maze->seed;
+	// length of the shortest path, as a measure of the maze's difficulty
+	*length = maze->distance ? GetDistance(maze->distance, maze->xStart, maze->yStart) : 0;
+	*winner = session.winner;
+	for (i = 0; i < session.players; i++) {
+		scores[i] = session.score[i];
+	}
+	DestroyMaze(maze);
+	return time;
+}
+
+static void StepPeer(struct Peer* peer, double now) {
+	// A peer that has to wait doesn't advance, so its own player behaves the
+	// same as in the match played on one machine.
+	int id = peer->net->local;
+	if (!peer->stalled) {
+		struct MatchInput input = {.player = id};
+		if (RunBot(&peer->bot, &peer->session, peer->session.clock[id], &input)) {
+			QueueNetplayInput(peer->net, &input);
+		}
+		peer->music += TICK * GetMusicSpeed(&peer->session, id);
+	}
+	peer->stalled = !StepNetplay(peer->net, (int64_t)(peer->music * MATCH_SAMPLE_RATE), now, NULL);
+}
+
+static bool RunNetplayMatch(struct Options* options, uint32_t seed, int winner, const int scores[], struct NetplayStats* stats) {
+	// Plays the match again with each bot on its own peer, the guest getting
+	// the maze from the host, and checks that both end up with the result
+	// of the local match.
+	struct NetLink* links[2];
+	struct Peer peers[NETPLAY_PLAYERS] = {0};
+	struct NetplaySetup setup;
+	struct Rng rng;
+	uint32_t seeds[NETPLAY_PLAYERS];
+	double now = 0;
+	bool same = true;
+	int i;
+
+	CreateLoopbackLinks(links);
+	for (i = 0; i < NETPLAY_PLAYERS; i++) {
+		links[i] = CreateImpairedLink(links[i], &options->network, seed + i);
+	}
+	peers[0].maze = CreateMaze(MAZE_WIDTH, MAZE_HEIGHT, seed);
+	setup = (struct NetplaySetup){seed, MAZE_WIDTH, MAZE_HEIGHT, MATCH_SAMPLE_RATE};
+	while (true) {
+		SendNetplaySetup(links[1], NULL, now);
+		if (ReceiveNetplaySetup(links[0], NULL, now)) {
+			SendNetplaySetup(links[0], &setup, now);
+		}
+		if (ReceiveNetplaySetup(links[1], &setup, now)) {
+			break;
+		}
+		now += TICK;
+	}
+	peers[1].maze = CreateMaze(setup.width, setup.height, setup.seed);
+
+	SeedRandom(&rng, seed);
+	for (i = 0; i < NETPLAY_PLAYERS; i++) {
+		seeds[i] = NextRandom(&rng);
+	}
+	for (i = 0; i < NETPLAY_PLAYERS; i++) {
+		struct BotConfig config = {.jitter = options->jitter[i], .mistakes = options->mistakes};
+		peers[i].maze->distance = CreateDistanceField(peers[i].maze, peers[i].maze->xGrass, peers[i].maze->yGrass);
+		InitMatch(&peers[i].session, peers[i].maze, NETPLAY_PLAYERS, setup.rate);
+		InitBot(&peers[i].bot, i, &config, seeds[i]);
+		peers[i].net = CreateNetplay(links[i], &peers[i].session, i);
+	}
+
+	while ((!peers[0].net->over || !peers[1].net->over) && now < options->timeout * 2) {
+		for (i = 0; i < NETPLAY_PLAYERS; i++) {
+			if (peers[i].net->over) {
+				PollNetplay(peers[i].net, now);
+			} else {
+				StepPeer(&peers[i], now);
+			}
+		}
+		now += TICK;
+	}
+
+	for (i = 0; i < NETPLAY_PLAYERS; i++) {
+		int p;
+		same &= peers[i].net->over && peers[i].session.winner == winner;
+		for (p = 0; p < NETPLAY_PLAYERS; p++) {
+			same &= peers[i].session.score[p] == scores[p];
+		}
+		stats->rollbacks += peers[i].net->rollbacks;
+		stats->resimulated += peers[i].net->resimulated;
+		stats->stalls += peers[i].net->stalls;
+		if (options->verbose) {
+			printf("  peer %d: winner %d, scores %d %d, rollbacks %d, stalls %d\n", i, peers[i].session.winner,
+				peers[i].session.score[0], peers[i].session.score[1], peers[i].net->rollbacks, peers[i].net->stalls);
+		}
+		DestroyNetplay(peers[i].net);
+		DestroyMaze(peers[i].maze);
+	}
+	stats->mismatches += !same;
+	return same;
+}
+
+static void PrintPerPlayer(int players, const int values[]) {
+	int i;
+	for (i = 0; i < players; i++) {
+		printf(" %d", values[i]);
+	}
+}
+
+static int PlayReplays(int count, char** filenames, bool verbose) {
+	// Replays are played back as fast as possible, reporting whether the
+	// outcome still matches the recorded one with current rules.
+	int i, p, failed = 0, changed = 0;
+	double total = 0;
+	clock_t start = clock();
+	for (i = 0; i < count; i++) {
+		struct Replay* replay = LoadReplay(filenames[i]);
+		if (!replay) {
+			fprintf(stderr, "%s: not a valid replay\n", filenames[i]);
+			failed++;
+			continue;
+		}
+		struct Maze* maze = CreateReplayMaze(replay);
+		struct MatchSession session;
+		InitMatch(&session, maze, replay->players, replay->rate);
+		PlayReplay(replay, &session);
+
+		bool same = session.winner == replay->winner;
+		for (p = 0; p < session.players; p++) {
+			same &= session.score[p] == replay->scores[p];
+		}
+		changed += replay->finished && !same;
+		total += session.clock[0] / (double)replay->rate;
+		if (verbose || (replay->finished && !same)) {
+			printf("%s: seed %u, winner %d, scores", filenames[i], replay->seed, session.winner);
+			PrintPerPlayer(session.players, session.score);
+			if (replay->finished && !same) {
+				printf(" (recorded: winner %d, scores", replay->winner);
+				PrintPerPlayer(replay->players, replay->scores);
+				printf(")");
+			}
+			printf("\n");
+		}
+		DestroyMaze(maze);
+		DestroyReplay(replay);
+	}
+	double elapsed = (clock() - start) / (double)CLOCKS_PER_SEC;
+
+	printf("replays: %d (%.0fx realtime)\n", count - failed, elapsed > 0 ? total / elapsed : 0);
+	printf("different outcome: %d, invalid: %d\n", changed, failed);
+	return failed ? 1 : 0;
+}
+
+static void Usage(const char* name) {
+	fprintf(stderr, "Usage: %s [-n matches] [-s seed] [-m maze] [-t timeout] [-p players] [-j jitter1,jitter2,...] [-b] [-x mistakes] [-e] [-l latency] [-w dir] [-c] [-N latency,jitter,loss] [-v]\n", name);
+	fprintf(stderr, "       %s [-v] -r replay...\n", name);
+	fprintf(stderr, "  -n  number of matches to simulate (default 1000)\n");
+	fprintf(stderr, "  -s  random seed (default: current time)\n");
+	fprintf(stderr, "  -m  play every match on the maze with given seed, as shown on the end screen\n");
+	fprintf(stderr, "  -t  give up on a match after this many seconds of game time (default 300)\n");
+	fprintf(stderr, "  -p  number of players, up to %d (default 2)\n", MATCH_MAX_PLAYERS);
+	fprintf(stderr, "  -j  maximum timing error of each scripted player in beats, the last one repeated (default 0.1)\n");
+	fprintf(stderr, "  -b  use bots following the shortest path, with -j as the deviation of their timing\n");
+	fprintf(stderr, "  -x  chance of a bot pressing a wrong direction (default 0)\n");
+	fprintf(stderr, "  -e  endless race, lost by the player who falls behind\n");
+	fprintf(stderr, "  -l  how late in beats inputs reach the match, like without latency calibration (default 0)\n");
+	fprintf(stderr, "  -w  save a replay of every match to given directory\n");
+	fprintf(stderr, "  -c  play every match back from its replay, counting ones with a different outcome\n");
+	fprintf(stderr, "  -N  play every match again between two bots over a simulated network, with latency and\n");
+	fprintf(stderr, "      jitter in milliseconds and a chance of losing packets, comparing the outcome\n");
+	fprintf(stderr, "  -r  play back given replays, reporting ones with a different outcome\n");
+	fprintf(stderr, "  -v  print the result of every match\n");
+}
+
+int main(int argc, char** argv) {
+	struct Options options = {.matches = 1000, .seed = (uint32_t)time(NULL), .timeout = 300, .players = 2, .jitter = {0.1}};
+	int i, p, jitters = 1;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-v")) {
+			options.verbose = true;
+		} else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+			return PlayReplays(argc - i - 1, argv + i + 1, options.verbose);
+		} else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+			options.record = argv[++i];
+		} else if (!strcmp(argv[i], "-c")) {
+			options.check = true;
+		} else if (!strcmp(argv[i], "-l") && i + 1 < argc) {
+			options.latency = strtof(argv[++i], NULL);
+		} else if (!strcmp(argv[i], "-b")) {
+			options.bots = true;
+		} else if (!strcmp(argv[i], "-x") && i + 1 < argc) {
+			options.mistakes = strtof(argv[++i], NULL);
+		} else if (!strcmp(argv[i], "-N") && i + 1 < argc) {
+			char* end = argv[++i];
+			options.network.latency = strtod(end, &end) / 1000;
+			options.network.jitter = (*end == ',') ? strtod(end + 1, &end) / 1000 : 0;
+			options.network.loss = (*end == ',') ? strtof(end + 1, &end) : 0;
+			options.netplay = true;
+			options.bots = true;
+		} else if (!strcmp(argv[i], "-e")) {
+			options.endless = true;
+		} else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+			options.matches = strtol(argv[++i], NULL, 10);
+		} else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+			options.seed = strtoul(argv[++i], NULL, 10);
+		} else if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+			options.maze = strtoul(argv[++i], NULL, 10);
+			options.fixed = true;
+		} else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+			options.timeout = strtod(argv[++i], NULL);
+		} else if (!strcmp(argv[i], "-p") && i + 1 < argc) {
+			options.players = strtol(argv[++i], NULL, 10);
+			if (options.players < 1 || options.players > MATCH_MAX_PLAYERS) {
+				Usage(argv[0]);
+				return 1;
+			}
+		} else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+			char* end = argv[++i];
+			jitters = 0;
+			do {
+				options.jitter[jitters++] = strtof(end + (*end == ','), &end);
+			} while (*end == ',' && jitters < MATCH_MAX_PLAYERS);
+		} else {
+			Usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (options.netplay && (options.players != NETPLAY_PLAYERS || options.endless)) {
+		fprintf(stderr, "-N needs %d players on a fixed size maze\n", NETPLAY_PLAYERS);
+		return 1;
+	}
+
+	for (p = jitters; p < MATCH_MAX_PLAYERS; p++) {
+		options.jitter[p] = options.jitter[jitters - 1];
+	}
+
+	struct Rng rng;
+	SeedRandom(&rng, options.seed);
+
+	struct NetplayStats stats = {0};
+	int wins[MATCH_MAX_PLAYERS] = {0}, unfinished = 0, unfaithful = 0;
+	double total = 0, paths = 0;
+	clock_t start = clock();
+	for (i = 0; i < options.matches; i++) {
+		int winner, scores[MATCH_MAX_PLAYERS];
+		uint32_t length;
+		bool faithful;
+		uint32_t seed = options.fixed ? options.maze : NextRandom(&rng);
+		double duration = RunMatch(&options, &seed, &winner, scores, &length, &faithful);
+		unfaithful += !faithful;
+		total += duration;
+		paths += (length != DISTANCE_UNREACHABLE) ? length : 0;
+		if (winner >= 0) {
+			wins[winner]++;
+		} else {
+			unfinished++;
+		}
+		if (options.verbose) {
+			printf("match %d: seed %u, shortest path %u, winner %d, %.2f s, scores", i, seed, length, winner, duration);
+			PrintPerPlayer(options.players, scores);
+			printf("\n");
+		}
+		if (options.netplay && winner >= 0) {
+			RunNetplayMatch(&options, seed, winner, scores, &stats);
+		}
+	}
+	double elapsed = (clock() - start) / (double)CLOCKS_PER_SEC;
+
+	printf("seed: %u\n", options.seed);
+	printf("matches: %d (%.0f per second)\n", options.matches, elapsed > 0 ? options.matches / elapsed : 0);
+	printf("wins:");
+	PrintPerPlayer(options.players, wins);
+	printf(", unfinished: %d\n", unfinished);
+	printf("average duration: %.2f s\n", options.matches ? total / options.matches : 0);
+	printf("average shortest path: %.1f moves\n", options.matches ? paths / options.matches : 0);
+	if (options.netplay) {
+		printf("netplay: %d different outcomes, %d rollbacks (%d frames simulated again), %d stalls\n", stats.mismatches,
+			stats.rollbacks, stats.resimulated, stats.stalls);
+	}
+	if (options.check) {
+		printf("replays: %d different outcomes\n", unfaithful);
+		return unfaithful ? 1 : 0;
+	}
+	return 0;
+}
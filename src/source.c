@@ -0,0 +1,320 @@
+/*! \file source.c
+ *  \brief Music decoded on demand into a bounded cache of blocks, shared by the tracks playing it.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "source.h"
+#include "stretch.h"
+#include <allegro5/allegro.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_FLAC
+
+#include <FLAC/stream_decoder.h>
+
+struct SourceBlock {
+	int16_t* frames; // interleaved
+	size_t index; // of the block in the source
+	uint64_t used;
+	bool valid;
+};
+
+struct Source {
+	// Only the blocks around where the tracks are reading stay decoded, the
+	// least recently read ones making room for the rest, so the memory
+	// taken doesn't depend on the length of the music. The decoder only
+	// seeks when a block doesn't follow the one it decoded last.
+	ALLEGRO_MUTEX* mutex; // tracks read from their own threads
+	ALLEGRO_FILE* file;
+	FLAC__StreamDecoder* decoder;
+	size_t length; // in frames
+	unsigned int frequency;
+	int channels, bits;
+	struct SourceBlock blocks[SOURCE_BLOCKS];
+	uint64_t clock;
+
+	// What the decoder is decoding into. Frames of its last frame that run
+	// past the end of the block are kept for the one after.
+	size_t position; // of the next frame the decoder delivers, SIZE_MAX when unknown
+	int16_t* target;
+	size_t start, end;
+	int16_t* carry;
+	size_t carryStart, carryCount, carryCapacity;
+};
+
+static FLAC__StreamDecoderReadStatus ReadFile(const FLAC__StreamDecoder* decoder, FLAC__byte buffer[], size_t* bytes, void* data) {
+	struct Source* source = data;
+	if (!*bytes) {
+		return FLAC__STREAM_DECODER_READ_STATUS_ABORT;
+	}
+	*bytes = al_fread(source->file, buffer, *bytes);
+	if (!*bytes) {
+		return al_feof(source->file) ? FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM : FLAC__STREAM_DECODER_READ_STATUS_ABORT;
+	}
+	return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
+}
+
+static FLAC__StreamDecoderSeekStatus SeekFile(const FLAC__StreamDecoder* decoder, FLAC__uint64 offset, void* data) {
+	struct Source* source = data;
+	return al_fseek(source->file, offset, ALLEGRO_SEEK_SET) ? FLAC__STREAM_DECODER_SEEK_STATUS_OK : FLAC__STREAM_DECODER_SEEK_STATUS_ERROR;
+}
+
+static FLAC__StreamDecoderTellStatus TellFile(const FLAC__StreamDecoder* decoder, FLAC__uint64* offset, void* data) {
+	struct Source* source = data;
+	int64_t position = al_ftell(source->file);
+	if (position < 0) {
+		return FLAC__STREAM_DECODER_TELL_STATUS_ERROR;
+	}
+	*offset = position;
+	return FLAC__STREAM_DECODER_TELL_STATUS_OK;
+}
+
+static FLAC__StreamDecoderLengthStatus GetFileLength(const FLAC__StreamDecoder* decoder, FLAC__uint64* length, void* data) {
+	struct Source* source = data;
+	int64_t size = al_fsize(source->file);
+	if (size < 0) {
+		return FLAC__STREAM_DECODER_LENGTH_STATUS_UNSUPPORTED;
+	}
+	*length = size;
+	return FLAC__STREAM_DECODER_LENGTH_STATUS_OK;
+}
+
+static FLAC__bool IsFileEnd(const FLAC__StreamDecoder* decoder, void* data) {
+	struct Source* source = data;
+	return al_feof(source->file);
+}
+
+static int16_t* GetCarrySlot(struct Source* source) {
+	if (!source->carryCount) {
+		source->carryStart = source->position;
+	}
+	if (source->carryCount == source->carryCapacity) {
+		source->carryCapacity = source->carryCapacity ? source->carryCapacity * 2 : SOURCE_BLOCK;
+		source->carry = realloc(source->carry, source->carryCapacity * source->channels * sizeof(int16_t));
+	}
+	return source->carry + source->carryCount++ * source->channels;
+}
+
+static FLAC__StreamDecoderWriteStatus Write(const FLAC__StreamDecoder* decoder, const FLAC__Frame* frame, const FLAC__int32* const buffer[], void* data) {
+	// After a seek, the first frame starts right at the frame sought to.
+	struct Source* source = data;
+	int shift = source->bits - 16, c;
+	unsigned int i;
+	for (i = 0; i < frame->header.blocksize; i++, source->position++) {
+		int16_t* output;
+		if (source->position >= source->start && source->position < source->end) {
+			output = source->target + (source->position - source->start) * source->channels;
+		} else if (source->position >= source->end) {
+			output = GetCarrySlot(source);
+		} else {
+			continue;
+		}
+		for (c = 0; c < source->channels; c++) {
+			output[c] = (shift >= 0) ? (buffer[c][i] >> shift) : (buffer[c][i] * (1 << -shift));
+		}
+	}
+	return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+static void ReadMetadata(const FLAC__StreamDecoder* decoder, const FLAC__StreamMetadata* metadata, void* data) {
+	struct Source* source = data;
+	if (metadata->type == FLAC__METADATA_TYPE_STREAMINFO) {
+		source->length = metadata->data.stream_info.total_samples;
+		source->frequency = metadata->data.stream_info.sample_rate;
+		source->channels = metadata->data.stream_info.channels;
+		source->bits = metadata->data.stream_info.bits_per_sample;
+	}
+}
+
+static void ReportError(const FLAC__StreamDecoder* decoder, FLAC__StreamDecoderErrorStatus status, void* data) {
+	// Whatever can't be decoded ends up silent.
+}
+
+static void DecodeBlock(struct Source* source, struct SourceBlock* block, size_t index) {
+	size_t first = index * SOURCE_BLOCK, start = first, end = first + SOURCE_BLOCK, count;
+	bool ok = true;
+	if (end > source->length) {
+		end = source->length;
+	}
+	block->index = index;
+	block->valid = true;
+	source->target = block->frames;
+	source->start = first;
+	source->end = end;
+
+	// what the previous block ran over into
+	if (source->carryCount && source->carryStart <= start && start < source->carryStart + source->carryCount) {
+		size_t skip = start - source->carryStart;
+		count = source->carryCount - skip;
+		count = (count < end - start) ? count : end - start;
+		memcpy(block->frames, source->carry + skip * source->channels, count * source->channels * sizeof(int16_t));
+		source->carryStart += skip + count;
+		source->carryCount -= skip + count;
+		memmove(source->carry, source->carry + (skip + count) * source->channels, source->carryCount * source->channels * sizeof(int16_t));
+		start += count;
+	} else {
+		source->carryCount = 0;
+	}
+
+	if (start < end && source->position != start) {
+		source->carryCount = 0;
+		source->position = start;
+		ok = FLAC__stream_decoder_seek_absolute(source->decoder, start);
+		if (!ok) {
+			FLAC__stream_decoder_flush(source->decoder);
+		}
+	}
+	while (ok && source->position < end) {
+		ok = FLAC__stream_decoder_process_single(source->decoder) && FLAC__stream_decoder_get_state(source->decoder) != FLAC__STREAM_DECODER_END_OF_STREAM;
+	}
+	if (source->position < end) {
+		start = (source->position > start) ? source->position : start;
+		memset(block->frames + (start - first) * source->channels, 0, (end - start) * source->channels * sizeof(int16_t));
+		source->position = SIZE_MAX; // the next block has to seek
+		source->carryCount = 0;
+	}
+	source->target = NULL;
+	source->start = source->end = 0;
+}
+
+static struct SourceBlock* GetBlock(struct Source* source, size_t index) {
+	struct SourceBlock* oldest = &source->blocks[0];
+	int i;
+	for (i = 0; i < SOURCE_BLOCKS; i++) {
+		struct SourceBlock* block = &source->blocks[i];
+		if (block->valid && block->index == index) {
+			block->used = ++source->clock;
+			return block;
+		}
+		if (!block->valid || (oldest->valid && block->used < oldest->used)) {
+			oldest = block;
+		}
+	}
+	DecodeBlock(source, oldest, index);
+	oldest->used = ++source->clock;
+	return oldest;
+}
+
+struct Source* OpenSource(const char* filename) {
+	// Only FLAC, with at most STRETCH_MAX_CHANNELS channels and its length
+	// known up front.
+	struct Source* source = calloc(1, sizeof(struct Source));
+	int i;
+	source->file = al_fopen(filename, "rb");
+	source->decoder = FLAC__stream_decoder_new();
+	if (!source->file || !source->decoder ||
+		FLAC__stream_decoder_init_stream(source->decoder, ReadFile, SeekFile, TellFile, GetFileLength, IsFileEnd,
+			Write, ReadMetadata, ReportError, source) != FLAC__STREAM_DECODER_INIT_STATUS_OK ||
+		!FLAC__stream_decoder_process_until_end_of_metadata(source->decoder) ||
+		!source->length || source->channels < 1 || source->channels > STRETCH_MAX_CHANNELS) {
+		CloseSource(source);
+		return NULL;
+	}
+	for (i = 0; i < SOURCE_BLOCKS; i++) {
+		source->blocks[i].frames = malloc(SOURCE_BLOCK * source->channels * sizeof(int16_t));
+	}
+	source->position = 0;
+	source->mutex = al_create_mutex();
+	return source;
+}
+
+void CloseSource(struct Source* source) {
+	int i;
+	if (!source) {
+		return;
+	}
+	if (source->decoder) {
+		FLAC__stream_decoder_delete(source->decoder);
+	}
+	if (source->file) {
+		al_fclose(source->file);
+	}
+	if (source->mutex) {
+		al_destroy_mutex(source->mutex);
+	}
+	for (i = 0; i < SOURCE_BLOCKS; i++) {
+		free(source->blocks[i].frames);
+	}
+	free(source->carry);
+	free(source);
+}
+
+void ReadSource(struct Source* source, size_t start, int16_t* frames, int count) {
+	// Wraps around at the end, as the music loops.
+	al_lock_mutex(source->mutex);
+	start %= source->length;
+	while (count > 0) {
+		size_t index = start / SOURCE_BLOCK, offset = start % SOURCE_BLOCK, available;
+		struct SourceBlock* block = GetBlock(source, index);
+		available = ((index + 1) * SOURCE_BLOCK < source->length) ? SOURCE_BLOCK - offset : source->length - start;
+		if (available > (size_t)count) {
+			available = count;
+		}
+		memcpy(frames, block->frames + offset * source->channels, available * source->channels * sizeof(int16_t));
+		frames += available * source->channels;
+		count -= available;
+		start += available;
+		if (start == source->length) {
+			start = 0;
+		}
+	}
+	al_unlock_mutex(source->mutex);
+}
+
+size_t GetSourceLength(struct Source* source) {
+	return source->length;
+}
+
+unsigned int GetSourceFrequency(struct Source* source) {
+	return source->frequency;
+}
+
+int GetSourceChannels(struct Source* source) {
+	return source->channels;
+}
+
+#else
+
+// Without libFLAC there's nothing to decode blocks with, so tracks stream
+// the file through Allegro instead. Allegro's own decoders can't be used
+// for this, as loaded streams only ever feed a mixer. Only built like this
+// with ZJEDZTRAWKE2_REQUIRE_FLAC turned off.
+
+struct Source* OpenSource(const char* filename) {
+	return NULL;
+}
+
+void CloseSource(struct Source* source) {}
+
+void ReadSource(struct Source* source, size_t start, int16_t* frames, int count) {}
+
+size_t GetSourceLength(struct Source* source) {
+	return 0;
+}
+
+unsigned int GetSourceFrequency(struct Source* source) {
+	return 0;
+}
+
+int GetSourceChannels(struct Source* source) {
+	return 0;
+}
+
+#endif
@@ -0,0 +1,39 @@
+/*! \file source.h
+ *  \brief Music decoded on demand into a bounded cache of blocks, shared by the tracks playing it.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZJEDZTRAWKE2_SOURCE_H
+#define ZJEDZTRAWKE2_SOURCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SOURCE_BLOCK 4096 // frames
+#define SOURCE_BLOCKS 32 // kept decoded at most, enough for every player to have a few
+
+struct Source;
+
+struct Source* OpenSource(const char* filename);
+void CloseSource(struct Source* source);
+void ReadSource(struct Source* source, size_t start, int16_t* frames, int count);
+size_t GetSourceLength(struct Source* source);
+unsigned int GetSourceFrequency(struct Source* source);
+int GetSourceChannels(struct Source* source);
+
+#endif
@@ -0,0 +1,499 @@
+/*! \file speech.c
+ *  \brief Text read out loud by a speech synthesizer running in the background.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "speech.h"
+#include <ctype.h>
+#include <libsuperderpy.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(HAVE_ESPEAK)
+#define SPEECH_LIBRARY
+#include <espeak-ng/speak_lib.h>
+#elif defined(ALLEGRO_UNIX)
+#define SPEECH_COMMAND
+#endif
+
+#define SPEECH_MAX_TEXT 255
+
+struct SpeechClip {
+	char* text;
+	ALLEGRO_SAMPLE* sample; // once rendered, never changes
+	bool failed;
+};
+
+struct Speech {
+	// A single worker synthesizes whatever was asked for last and plays it
+	// on the mixer, cutting off what it was saying before. Requests that
+	// got replaced before their turn came are never synthesized at all.
+	// Texts known up front are rendered into clips while the worker has
+	// nothing else to do, kept on disk, and played right from Say().
+	// Without a worker, UpdateSpeech says what's asked for from the main
+	// thread, and clips only get rendered once they're asked for.
+	ALLEGRO_MIXER* mixer;
+	ALLEGRO_THREAD* thread;
+	ALLEGRO_MUTEX* mutex; // guards everything up to the worker's own fields
+	ALLEGRO_COND* cond;
+	ALLEGRO_SAMPLE_INSTANCE* instance;
+	ALLEGRO_SAMPLE* live; // synthesized for a text without a clip
+	char* pending; // newest text waiting to be said
+	unsigned int requests; // counts every request, so that stale ones can be cut short
+	bool stop;
+	struct SpeechClip* clips;
+	int count, capacity;
+
+	// only touched by the worker, or by UpdateSpeech without one
+	bool available, initialized; // synthesizer
+	char voice[32];
+	int rate; // in words per minute
+	ALLEGRO_PATH* cache; // NULL when there's nowhere to keep the clips
+	unsigned int request; // the one being synthesized
+	int16_t* pcm;
+	size_t length, pcmCapacity; // in samples
+	unsigned int frequency;
+};
+
+static bool IsStale(struct Speech* speech) {
+	bool stale;
+	al_lock_mutex(speech->mutex);
+	stale = speech->stop || speech->requests != speech->request;
+	al_unlock_mutex(speech->mutex);
+	return stale;
+}
+
+static void Append(struct Speech* speech, const int16_t* samples, size_t count) {
+	if (speech->length + count > speech->pcmCapacity) {
+		while (speech->length + count > speech->pcmCapacity) {
+			speech->pcmCapacity = speech->pcmCapacity ? speech->pcmCapacity * 2 : 16384;
+		}
+		// al_malloc'd, as the sample takes it over
+		speech->pcm = al_realloc(speech->pcm, speech->pcmCapacity * sizeof(int16_t));
+	}
+	memcpy(speech->pcm + speech->length, samples, count * sizeof(int16_t));
+	speech->length += count;
+}
+
+#if defined(SPEECH_LIBRARY)
+
+static int Synthesized(short* wav, int count, espeak_EVENT* events) {
+	struct Speech* speech = events->user_data;
+	if (wav && count > 0) {
+		Append(speech, wav, count);
+	}
+	return IsStale(speech) ? 1 : 0;
+}
+
+static bool InitSynthesizer(struct Speech* speech) {
+	// espeak isn't thread safe, so everything is done from the worker.
+	int frequency = espeak_Initialize(AUDIO_OUTPUT_SYNCHRONOUS, 0, NULL, 0);
+	if (frequency <= 0) {
+		return false;
+	}
+	speech->frequency = frequency;
+	espeak_SetSynthCallback(Synthesized);
+	espeak_SetVoiceByName(speech->voice);
+	espeak_SetParameter(espeakRATE, speech->rate, 0);
+	return true;
+}
+
+static bool Synthesize(struct Speech* speech, const char* text) {
+	return espeak_Synth(text, strlen(text) + 1, 0, POS_CHARACTER, 0, espeakCHARS_AUTO, NULL, speech) == EE_OK;
+}
+
+static void DestroySynthesizer(struct Speech* speech) {
+	espeak_Terminate();
+}
+
+#elif defined(SPEECH_COMMAND)
+
+static uint32_t ReadLittleEndian(const uint8_t* bytes, int size) {
+	uint32_t value = 0;
+	int i;
+	for (i = size - 1; i >= 0; i--) {
+		value = (value << 8) | bytes[i];
+	}
+	return value;
+}
+
+static bool ReadWaveHeader(struct Speech* speech, FILE* pipe) {
+	// Streamed, so chunks can only be skipped by reading them.
+	uint8_t header[12], chunk[8], skipped[64];
+	uint32_t size;
+	if (fread(header, 1, 12, pipe) != 12 || memcmp(header, "RIFF", 4) || memcmp(header + 8, "WAVE", 4)) {
+		return false;
+	}
+	while (fread(chunk, 1, 8, pipe) == 8) {
+		size = ReadLittleEndian(chunk + 4, 4);
+		if (!memcmp(chunk, "data", 4)) {
+			return speech->frequency != 0;
+		}
+		while (size) {
+			uint32_t count = (size < sizeof(skipped)) ? size : sizeof(skipped);
+			if (fread(skipped, 1, count, pipe) != count) {
+				return false;
+			}
+			if (!memcmp(chunk, "fmt ", 4) && size == ReadLittleEndian(chunk + 4, 4) && count >= 16) {
+				// 16 bit mono PCM is all espeak writes
+				if (ReadLittleEndian(skipped, 2) != 1 || ReadLittleEndian(skipped + 2, 2) != 1 || ReadLittleEndian(skipped + 14, 2) != 16) {
+					return false;
+				}
+				speech->frequency = ReadLittleEndian(skipped + 4, 4);
+			}
+			size -= count;
+		}
+	}
+	return false;
+}
+
+static bool InitSynthesizer(struct Speech* speech) {
+	// Without the library, espeak gets run by the worker for each request,
+	// writing the audio to a pipe.
+	return true;
+}
+
+static bool Synthesize(struct Speech* speech, const char* text) {
+	char command[SPEECH_MAX_TEXT * 4 + 128];
+	int16_t samples[1024];
+	size_t length, count;
+	FILE* pipe;
+	bool ok;
+
+	// the text goes in single quotes, with the ones inside it escaped
+	length = snprintf(command, sizeof(command), "espeak --stdout -v '%s' -s %d -- '", speech->voice, speech->rate);
+	for (; *text && length < sizeof(command) - 32; text++) {
+		if (*text == '\'') {
+			length += snprintf(command + length, sizeof(command) - length, "'\\''");
+		} else {
+			command[length++] = *text;
+		}
+	}
+	snprintf(command + length, sizeof(command) - length, "' 2>/dev/null");
+
+	pipe = popen(command, "r");
+	if (!pipe) {
+		return false;
+	}
+	ok = ReadWaveHeader(speech, pipe);
+	while (ok && !IsStale(speech) && (count = fread(samples, sizeof(int16_t), 1024, pipe))) {
+		Append(speech, samples, count);
+	}
+	// a stale one gets killed by the pipe closing
+	pclose(pipe);
+	return ok;
+}
+
+static void DestroySynthesizer(struct Speech* speech) {}
+
+#else
+
+static bool InitSynthesizer(struct Speech* speech) {
+	return false;
+}
+
+static bool Synthesize(struct Speech* speech, const char* text) {
+	return false;
+}
+
+static void DestroySynthesizer(struct Speech* speech) {}
+
+#endif
+
+static struct SpeechClip* FindClip(struct Speech* speech, const char* text) {
+	int i;
+	for (i = 0; i < speech->count; i++) {
+		if (!strcmp(speech->clips[i].text, text)) {
+			return &speech->clips[i];
+		}
+	}
+	return NULL;
+}
+
+static struct SpeechClip* NextClip(struct Speech* speech) {
+	int i;
+	for (i = 0; i < speech->count; i++) {
+		if (!speech->clips[i].sample && !speech->clips[i].failed) {
+			return &speech->clips[i];
+		}
+	}
+	return NULL;
+}
+
+static ALLEGRO_PATH* GetClipPath(struct Speech* speech, const char* text) {
+	// Keyed by everything that changes how the text sounds.
+	uint64_t hash = 14695981039346656037ULL; // FNV-1a
+	char key[SPEECH_MAX_TEXT + 64], filename[32];
+	const char* c;
+	ALLEGRO_PATH* path;
+	snprintf(key, sizeof(key), "%s\n%d\n%s", speech->voice, speech->rate, text);
+	for (c = key; *c; c++) {
+		hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+	}
+	snprintf(filename, sizeof(filename), "%016llx.wav", (unsigned long long)hash);
+	path = al_clone_path(speech->cache);
+	al_set_path_filename(path, filename);
+	return path;
+}
+
+static ALLEGRO_SAMPLE* LoadClip(struct Speech* speech, const char* text) {
+	ALLEGRO_PATH* path;
+	ALLEGRO_SAMPLE* sample;
+	if (!speech->cache) {
+		return NULL;
+	}
+	path = GetClipPath(speech, text);
+	sample = al_load_sample(al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP));
+	al_destroy_path(path);
+	return sample;
+}
+
+static void SaveClip(struct Speech* speech, const char* text, ALLEGRO_SAMPLE* sample) {
+	ALLEGRO_PATH* path;
+	if (!speech->cache) {
+		return;
+	}
+	path = GetClipPath(speech, text);
+	al_save_sample(al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP), sample);
+	al_destroy_path(path);
+}
+
+static ALLEGRO_SAMPLE* TakeSample(struct Speech* speech) {
+	ALLEGRO_SAMPLE* sample = al_create_sample(speech->pcm, speech->length, speech->frequency, ALLEGRO_AUDIO_DEPTH_INT16, ALLEGRO_CHANNEL_CONF_1, true);
+	if (!sample) {
+		al_free(speech->pcm);
+	}
+	speech->pcm = NULL;
+	speech->length = 0;
+	speech->pcmCapacity = 0;
+	return sample;
+}
+
+static void Play(struct Speech* speech, ALLEGRO_SAMPLE* sample, bool live) {
+	// With the mutex locked.
+	al_set_sample(speech->instance, sample);
+	if (!al_get_sample_instance_attached(speech->instance)) {
+		al_attach_sample_instance_to_mixer(speech->instance, speech->mixer);
+	}
+	al_play_sample_instance(speech->instance);
+	// only now the previous live one isn't used anymore
+	if (speech->live) {
+		al_destroy_sample(speech->live);
+	}
+	speech->live = live ? sample : NULL;
+}
+
+static void Serve(struct Speech* speech) {
+	// Takes the mutex locked, with something to do, and leaves it locked.
+	bool prerender, clipped, cut;
+	struct SpeechClip* clip;
+	ALLEGRO_SAMPLE* sample;
+	char* text;
+
+	// what's asked for goes before the clips
+	prerender = !speech->pending;
+	if (prerender) {
+		text = strdup(NextClip(speech)->text);
+	} else {
+		text = speech->pending;
+		speech->pending = NULL;
+	}
+	clipped = FindClip(speech, text) != NULL;
+	speech->request = speech->requests;
+	al_unlock_mutex(speech->mutex);
+
+	sample = clipped ? LoadClip(speech, text) : NULL;
+	cut = false;
+	if (!sample && speech->available) {
+		// after failing once, it's not going to work the next time either
+		speech->available = Synthesize(speech, text);
+		cut = IsStale(speech);
+		if (speech->available && speech->length && !cut) {
+			sample = TakeSample(speech);
+			if (sample && clipped) {
+				SaveClip(speech, text, sample);
+			}
+		}
+		speech->length = 0;
+	}
+
+	al_lock_mutex(speech->mutex);
+	// the clips may have moved, but never go away
+	clip = FindClip(speech, text);
+	if (clip && !clip->sample) {
+		clip->sample = sample;
+		// cut short ones get another go later
+		clip->failed = !sample && !cut;
+	}
+	if (!prerender && sample && speech->request == speech->requests) {
+		Play(speech, sample, !clip);
+	} else if (sample && !clip) {
+		al_destroy_sample(sample);
+	}
+	free(text);
+}
+
+static void* Work(ALLEGRO_THREAD* thread, void* arg) {
+	struct Speech* speech = arg;
+	speech->available = InitSynthesizer(speech);
+	speech->initialized = true;
+
+	al_lock_mutex(speech->mutex);
+	while (true) {
+		while (!speech->pending && !speech->stop && !NextClip(speech)) {
+			al_wait_cond(speech->cond, speech->mutex);
+		}
+		if (speech->stop) {
+			break;
+		}
+		Serve(speech);
+	}
+	al_unlock_mutex(speech->mutex);
+
+	if (speech->available) {
+		DestroySynthesizer(speech);
+	}
+	return NULL;
+}
+
+static char* CopyText(const char* text) {
+	char* copy = calloc(SPEECH_MAX_TEXT + 1, 1);
+	strncpy(copy, text, SPEECH_MAX_TEXT);
+	return copy;
+}
+
+struct Speech* CreateSpeech(struct Game* game, ALLEGRO_MIXER* mixer) {
+	struct Speech* speech = calloc(1, sizeof(struct Speech));
+	const char* voice = GetConfigOptionDefault(game, "ZjedzTrawke2", "speechvoice", "en");
+	size_t i;
+	speech->mixer = mixer;
+	speech->rate = strtol(GetConfigOptionDefault(game, "ZjedzTrawke2", "speechrate", "175"), NULL, 10);
+	// only what voice names are made of, as it ends up in a command line
+	for (i = 0; voice[i] && i < sizeof(speech->voice) - 1; i++) {
+		speech->voice[i] = (isalnum((unsigned char)voice[i]) || strchr("+-_", voice[i])) ? voice[i] : '_';
+	}
+	speech->cache = al_get_standard_path(ALLEGRO_USER_DATA_PATH);
+	if (speech->cache) {
+		al_append_path_component(speech->cache, "speech");
+		if (!al_make_directory(al_path_cstr(speech->cache, ALLEGRO_NATIVE_PATH_SEP))) {
+			al_destroy_path(speech->cache);
+			speech->cache = NULL;
+		}
+	}
+	speech->instance = al_create_sample_instance(NULL); // attached once it gets something to play
+	speech->mutex = al_create_mutex();
+	speech->cond = al_create_cond();
+	speech->thread = al_create_thread(Work, speech);
+	if (speech->thread) {
+		al_start_thread(speech->thread);
+	}
+	return speech;
+}
+
+void DestroySpeech(struct Speech* speech) {
+	int i;
+	if (speech->thread) {
+		al_lock_mutex(speech->mutex);
+		speech->stop = true;
+		al_signal_cond(speech->cond);
+		al_unlock_mutex(speech->mutex);
+		al_destroy_thread(speech->thread);
+	} else if (speech->initialized && speech->available) {
+		DestroySynthesizer(speech);
+	}
+	al_destroy_sample_instance(speech->instance);
+	if (speech->live) {
+		al_destroy_sample(speech->live);
+	}
+	for (i = 0; i < speech->count; i++) {
+		if (speech->clips[i].sample) {
+			al_destroy_sample(speech->clips[i].sample);
+		}
+		free(speech->clips[i].text);
+	}
+	free(speech->clips);
+	if (speech->cache) {
+		al_destroy_path(speech->cache);
+	}
+	al_destroy_cond(speech->cond);
+	al_destroy_mutex(speech->mutex);
+	free(speech->pending);
+	al_free(speech->pcm);
+	free(speech);
+}
+
+void PrerenderSpeech(struct Speech* speech, char** texts, int count) {
+	// Makes the texts play without delay from then on. Rendered in the
+	// background on the first launch, loaded from disk on later ones.
+	int i;
+	al_lock_mutex(speech->mutex);
+	for (i = 0; i < count; i++) {
+		char* text = CopyText(texts[i]);
+		if (FindClip(speech, text)) {
+			free(text);
+			continue;
+		}
+		if (speech->count == speech->capacity) {
+			speech->capacity = speech->capacity ? speech->capacity * 2 : 32;
+			speech->clips = realloc(speech->clips, speech->capacity * sizeof(struct SpeechClip));
+		}
+		speech->clips[speech->count++] = (struct SpeechClip){.text = text};
+	}
+	al_signal_cond(speech->cond);
+	al_unlock_mutex(speech->mutex);
+}
+
+void Say(struct Speech* speech, const char* text) {
+	// Returns right away. Whatever was being said gets cut off.
+	char* copy = CopyText(text);
+	struct SpeechClip* clip;
+	al_lock_mutex(speech->mutex);
+	free(speech->pending);
+	speech->pending = NULL;
+	speech->requests++;
+	clip = FindClip(speech, copy);
+	if (clip && clip->sample) {
+		Play(speech, clip->sample, false);
+		free(copy);
+	} else {
+		al_stop_sample_instance(speech->instance);
+		speech->pending = copy;
+		al_signal_cond(speech->cond);
+	}
+	al_unlock_mutex(speech->mutex);
+}
+
+void UpdateSpeech(struct Speech* speech) {
+	// To be called every frame; does anything only without a worker, in
+	// which case saying something that isn't rendered yet takes as long as
+	// synthesizing it.
+	if (speech->thread) {
+		return;
+	}
+	al_lock_mutex(speech->mutex);
+	if (speech->pending) {
+		if (!speech->initialized) {
+			speech->available = InitSynthesizer(speech);
+			speech->initialized = true;
+		}
+		Serve(speech);
+	}
+	al_unlock_mutex(speech->mutex);
+}
@@ -0,0 +1,36 @@
+/*! \file speech.h
+ *  \brief Text read out loud by a speech synthesizer running in the background.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZJEDZTRAWKE2_SPEECH_H
+#define ZJEDZTRAWKE2_SPEECH_H
+
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_audio.h>
+
+struct Game;
+struct Speech;
+
+struct Speech* CreateSpeech(struct Game* game, ALLEGRO_MIXER* mixer);
+void DestroySpeech(struct Speech* speech);
+void PrerenderSpeech(struct Speech* speech, char** texts, int count);
+void Say(struct Speech* speech, const char* text);
+void UpdateSpeech(struct Speech* speech);
+
+#endif
@@ -0,0 +1,197 @@
+/*! \file stretch.c
+ *  \brief Changing the tempo of audio without changing its pitch, independent from Allegro.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "stretch.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE__) || defined(_M_X64)
+#define STRETCH_SSE
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#define STRETCH_NEON
+#include <arm_neon.h>
+#endif
+
+static float Dot(const float* a, const float* b, int n) {
+	// Nearly all of the time goes here. n has to be a multiple of 8.
+	int i;
+#if defined(STRETCH_SSE)
+	__m128 sum0 = _mm_setzero_ps(), sum1 = _mm_setzero_ps();
+	float sums[4];
+	for (i = 0; i < n; i += 8) {
+		sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+		sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+	}
+	_mm_storeu_ps(sums, _mm_add_ps(sum0, sum1));
+	return sums[0] + sums[1] + sums[2] + sums[3];
+#elif defined(STRETCH_NEON)
+	float32x4_t sum0 = vdupq_n_f32(0), sum1 = vdupq_n_f32(0);
+	float sums[4];
+	for (i = 0; i < n; i += 8) {
+		sum0 = vmlaq_f32(sum0, vld1q_f32(a + i), vld1q_f32(b + i));
+		sum1 = vmlaq_f32(sum1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+	}
+	vst1q_f32(sums, vaddq_f32(sum0, sum1));
+	return sums[0] + sums[1] + sums[2] + sums[3];
+#else
+	float sums[8] = {0};
+	int j;
+	for (i = 0; i < n; i += 8) {
+		for (j = 0; j < 8; j++) {
+			sums[j] += a[i + j] * b[i + j];
+		}
+	}
+	return (sums[0] + sums[1]) + (sums[2] + sums[3]) + (sums[4] + sums[5]) + (sums[6] + sums[7]);
+#endif
+}
+
+static size_t Wrap(const struct Stretch* stretch, int64_t position) {
+	int64_t length = stretch->length;
+	return ((position % length) + length) % length;
+}
+
+static void Downmix(const struct Stretch* stretch, const int16_t* frames, float* output, int count) {
+	// Segments are lined up by their mono mix.
+	const float scale = 1.0f / (32768.0f * stretch->channels);
+	int i, c;
+	for (i = 0; i < count; i++) {
+		int sum = 0;
+		for (c = 0; c < stretch->channels; c++) {
+			sum += frames[i * stretch->channels + c];
+		}
+		output[i] = sum * scale;
+	}
+}
+
+static int FindSegment(struct Stretch* stretch) {
+	// Picks the offset into what's around the ideal position with the
+	// highest normalized cross-correlation with what would have followed
+	// the previous segment.
+	double energy;
+	float score, bestScore = -INFINITY;
+	int offset, best = STRETCH_SEEK;
+	Downmix(stretch, stretch->ahead, stretch->reference, STRETCH_HOP);
+	Downmix(stretch, stretch->around, stretch->candidates, STRETCH_HOP + 2 * STRETCH_SEEK);
+	energy = Dot(stretch->candidates, stretch->candidates, STRETCH_HOP);
+	for (offset = 0; offset <= 2 * STRETCH_SEEK; offset++) {
+		float correlation = Dot(stretch->reference, stretch->candidates + offset, STRETCH_HOP);
+		score = correlation * fabsf(correlation) / (float)(energy + 1e-6);
+		if (score > bestScore) {
+			bestScore = score;
+			best = offset;
+		}
+		if (offset < 2 * STRETCH_SEEK) {
+			float in = stretch->candidates[offset + STRETCH_HOP], out = stretch->candidates[offset];
+			energy += in * in - out * out;
+		}
+	}
+	return best;
+}
+
+static void Step(struct Stretch* stretch) {
+	size_t continuation = Wrap(stretch, (int64_t)stretch->previous + STRETCH_HOP);
+	int64_t target = (int64_t)(stretch->next + 0.5);
+	const int16_t* segment = stretch->ahead;
+	size_t start = continuation;
+	int i, c, channels = stretch->channels, best;
+
+	stretch->read(stretch->user, continuation, stretch->ahead, STRETCH_HOP);
+	// At the normal speed, the source simply gets copied.
+	if (Wrap(stretch, target) != continuation) {
+		stretch->read(stretch->user, Wrap(stretch, target - STRETCH_SEEK), stretch->around, STRETCH_HOP + 2 * STRETCH_SEEK);
+		best = FindSegment(stretch);
+		segment = stretch->around + best * channels;
+		start = Wrap(stretch, target - STRETCH_SEEK + best);
+	}
+
+	for (i = 0; i < STRETCH_HOP; i++) {
+		float in = stretch->window[i] * (1.0f / 32768.0f), out = (1.0f / 32768.0f) - in;
+		for (c = 0; c < channels; c++) {
+			stretch->output[i * channels + c] = stretch->ahead[i * channels + c] * out + segment[i * channels + c] * in;
+		}
+	}
+
+	stretch->previous = start;
+	stretch->position = stretch->next;
+	stretch->stepSpeed = stretch->speed;
+	stretch->next = fmod(stretch->next + STRETCH_HOP * stretch->speed, stretch->length);
+	stretch->outputPosition = 0;
+}
+
+void InitStretch(struct Stretch* stretch, StretchReader read, void* user, size_t length, int channels) {
+	// The source has to have at most STRETCH_MAX_CHANNELS channels.
+	int i;
+	memset(stretch, 0, sizeof(struct Stretch));
+	stretch->read = read;
+	stretch->user = user;
+	stretch->length = length;
+	stretch->channels = channels;
+	stretch->speed = 1.0;
+	for (i = 0; i < STRETCH_HOP; i++) {
+		// raised cosine, so that fading in and out always sums up to one
+		stretch->window[i] = 0.5 - 0.5 * cos(M_PI * (i + 0.5) / STRETCH_HOP);
+	}
+	SeekStretch(stretch, 0);
+}
+
+void SeekStretch(struct Stretch* stretch, size_t position) {
+	// Whatever the step being output has left is thrown away.
+	position %= stretch->length;
+	stretch->previous = Wrap(stretch, (int64_t)position - STRETCH_HOP);
+	stretch->next = position;
+	stretch->position = position;
+	stretch->stepSpeed = 0;
+	stretch->outputPosition = STRETCH_HOP;
+}
+
+void SetStretchSpeed(struct Stretch* stretch, double speed) {
+	// Takes effect from the next step on.
+	if (speed < STRETCH_MIN_SPEED) {
+		speed = STRETCH_MIN_SPEED;
+	}
+	if (speed > STRETCH_MAX_SPEED) {
+		speed = STRETCH_MAX_SPEED;
+	}
+	stretch->speed = speed;
+}
+
+void RenderStretch(struct Stretch* stretch, float* output, int frames) {
+	// Interleaved, with as many channels as the source has.
+	while (frames > 0) {
+		int count;
+		if (stretch->outputPosition == STRETCH_HOP) {
+			Step(stretch);
+		}
+		count = STRETCH_HOP - stretch->outputPosition;
+		if (count > frames) {
+			count = frames;
+		}
+		memcpy(output, stretch->output + stretch->outputPosition * stretch->channels, count * stretch->channels * sizeof(float));
+		output += count * stretch->channels;
+		stretch->outputPosition += count;
+		frames -= count;
+	}
+}
+
+size_t GetStretchPosition(const struct Stretch* stretch) {
+	// Where in the source the next frame returned is, in tempo.
+	return Wrap(stretch, (int64_t)(stretch->position + stretch->outputPosition * stretch->stepSpeed));
+}
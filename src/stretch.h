@@ -0,0 +1,73 @@
+/*! \file stretch.h
+ *  \brief Changing the tempo of audio without changing its pitch, independent from Allegro.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZJEDZTRAWKE2_STRETCH_H
+#define ZJEDZTRAWKE2_STRETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define STRETCH_HOP 512 // output frames per step, as well as the length of crossfades
+#define STRETCH_SEEK 256 // how far from the ideal position a segment can be taken from, in frames
+#define STRETCH_MAX_CHANNELS 2
+#define STRETCH_MIN_SPEED 0.25
+#define STRETCH_MAX_SPEED 4.0
+
+// Fills frames with count interleaved frames of the source from start on,
+// wrapping around at its end.
+typedef void (*StretchReader)(void* user, size_t start, int16_t* frames, int count);
+
+struct Stretch {
+	// WSOLA: the output is made of segments of the source crossfaded into
+	// each other, each one taken from around where the tempo says the
+	// source should be by now, at the offset that lines its waveform up
+	// best with the segment before. Every step costs the same, whatever
+	// the speed is.
+	//
+	// The source is only ever read a step's worth at a time, so it doesn't
+	// have to be decoded whole.
+	StretchReader read; // of the source, played in a loop
+	void* user;
+	size_t length; // in frames
+	int channels;
+
+	double speed;
+	double next; // ideal source position of the next step
+	double position; // ideal source position of the step being output
+	double stepSpeed; // speed the step being output was made with
+	size_t previous; // where the last segment started in the source
+
+	float output[STRETCH_HOP * STRETCH_MAX_CHANNELS];
+	int outputPosition; // frames of the step already returned
+
+	int16_t ahead[STRETCH_HOP * STRETCH_MAX_CHANNELS]; // what would naturally follow the last segment
+	int16_t around[(STRETCH_HOP + 2 * STRETCH_SEEK) * STRETCH_MAX_CHANNELS]; // source around the ideal position
+	float window[STRETCH_HOP]; // fade in, its complement fades out
+	float reference[STRETCH_HOP]; // what would naturally follow, downmixed
+	float candidates[STRETCH_HOP + 2 * STRETCH_SEEK]; // around the ideal position, downmixed
+};
+
+void InitStretch(struct Stretch* stretch, StretchReader read, void* user, size_t length, int channels);
+void SeekStretch(struct Stretch* stretch, size_t position);
+void SetStretchSpeed(struct Stretch* stretch, double speed);
+void RenderStretch(struct Stretch* stretch, float* output, int frames);
+size_t GetStretchPosition(const struct Stretch* stretch);
+
+#endif
@@ -0,0 +1,229 @@
+/*! \file track.c
+ *  \brief Music played in a loop, at a tempo that can change without changing its pitch.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "track.h"
+#include "source.h"
+#include "stretch.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+#define TRACK_WAKE_EVENT ALLEGRO_GET_EVENT_TYPE('Z', 'T', '2', 'T')
+
+struct Track {
+	// Every track has a thread of its own, filling the fragments of its
+	// stream as the mixer releases them, so that frames taking long don't
+	// make the music skip. If the thread can't be created, UpdateTrack
+	// fills them from the main thread instead. The source is shared, only read from, with the
+	// position of the stretch as the track's read cursor into it.
+	//
+	// Without a source, the stream plays the file as it is instead; speeding
+	// it up raises its pitch then.
+	ALLEGRO_AUDIO_STREAM* stream;
+	struct Source* source;
+	ALLEGRO_EVENT_QUEUE* queue; // only with a thread
+	ALLEGRO_EVENT_SOURCE wake;
+	ALLEGRO_THREAD* thread;
+	ALLEGRO_MUTEX* mutex; // guards everything below
+	struct Stretch stretch;
+	unsigned int frequency;
+	// The fragment being played is the oldest one queued, so its position
+	// is what the next one filled takes the place of.
+	unsigned int starts[TRACK_BUFFERS];
+	unsigned int filled;
+};
+
+static void Fill(struct Track* track) {
+	float* fragment;
+	while ((fragment = al_get_audio_stream_fragment(track->stream))) {
+		track->starts[track->filled++ % TRACK_BUFFERS] = GetStretchPosition(&track->stretch);
+		RenderStretch(&track->stretch, fragment, TRACK_FRAGMENT);
+		al_set_audio_stream_fragment(track->stream, fragment);
+	}
+}
+
+static void* Feed(ALLEGRO_THREAD* thread, void* arg) {
+	struct Track* track = arg;
+	ALLEGRO_EVENT event;
+	while (!al_get_thread_should_stop(thread)) {
+		al_wait_for_event(track->queue, &event);
+		if (event.type != ALLEGRO_EVENT_AUDIO_STREAM_FRAGMENT) {
+			continue;
+		}
+		al_lock_mutex(track->mutex);
+		// fragments released by stopping aren't refilled until a seek
+		if (al_get_audio_stream_playing(track->stream)) {
+			Fill(track);
+		}
+		al_unlock_mutex(track->mutex);
+	}
+	return NULL;
+}
+
+static void Read(void* user, size_t start, int16_t* frames, int count) {
+	ReadSource(user, start, frames, count);
+}
+
+struct Track* CreateTrack(struct Source* source, const char* filename, ALLEGRO_MIXER* mixer) {
+	// The source, if given, has to outlive the track.
+	struct Track* track = calloc(1, sizeof(struct Track));
+	if (!source) {
+		track->stream = al_load_audio_stream(filename, TRACK_BUFFERS, TRACK_FRAGMENT);
+		if (!track->stream) {
+			free(track);
+			return NULL;
+		}
+		track->frequency = al_get_audio_stream_frequency(track->stream);
+		al_set_audio_stream_playing(track->stream, false);
+		al_set_audio_stream_playmode(track->stream, ALLEGRO_PLAYMODE_LOOP);
+		al_attach_audio_stream_to_mixer(track->stream, mixer);
+		return track;
+	}
+	track->source = source;
+	InitStretch(&track->stretch, Read, source, GetSourceLength(source), GetSourceChannels(source));
+	track->frequency = GetSourceFrequency(source);
+	track->stream = al_create_audio_stream(TRACK_BUFFERS, TRACK_FRAGMENT, track->frequency, ALLEGRO_AUDIO_DEPTH_FLOAT32,
+		(GetSourceChannels(source) == 2) ? ALLEGRO_CHANNEL_CONF_2 : ALLEGRO_CHANNEL_CONF_1);
+	al_set_audio_stream_playing(track->stream, false);
+	al_attach_audio_stream_to_mixer(track->stream, mixer);
+	track->mutex = al_create_mutex();
+	track->thread = al_create_thread(Feed, track);
+	if (track->thread) {
+		track->queue = al_create_event_queue();
+		al_init_user_event_source(&track->wake);
+		al_register_event_source(track->queue, &track->wake);
+		al_register_event_source(track->queue, al_get_audio_stream_event_source(track->stream));
+	}
+	SeekTrack(track, 0);
+	if (track->thread) {
+		al_start_thread(track->thread);
+	}
+	return track;
+}
+
+void DestroyTrack(struct Track* track) {
+	ALLEGRO_EVENT event = {0};
+	if (!track) {
+		return;
+	}
+	if (!track->source) {
+		al_destroy_audio_stream(track->stream);
+		free(track);
+		return;
+	}
+	if (track->thread) {
+		al_set_thread_should_stop(track->thread);
+		event.user.type = TRACK_WAKE_EVENT;
+		al_emit_user_event(&track->wake, &event, NULL);
+		al_destroy_thread(track->thread);
+	}
+	al_destroy_audio_stream(track->stream);
+	if (track->queue) {
+		al_destroy_event_queue(track->queue);
+		al_destroy_user_event_source(&track->wake);
+	}
+	al_destroy_mutex(track->mutex);
+	free(track);
+}
+
+void UpdateTrack(struct Track* track) {
+	// To be called every frame; does anything only for a track left
+	// without its thread.
+	if (!track || !track->source || track->thread) {
+		return;
+	}
+	al_lock_mutex(track->mutex);
+	if (al_get_audio_stream_playing(track->stream)) {
+		Fill(track);
+	}
+	al_unlock_mutex(track->mutex);
+}
+
+void SetTrackPlaying(struct Track* track, bool playing) {
+	al_set_audio_stream_playing(track->stream, playing);
+}
+
+void SetTrackSpeed(struct Track* track, float speed) {
+	// Makes the tempo faster or slower, the pitch stays the same.
+	if (!track->source) {
+		al_set_audio_stream_speed(track->stream, speed);
+		return;
+	}
+	al_lock_mutex(track->mutex);
+	SetStretchSpeed(&track->stretch, speed);
+	al_unlock_mutex(track->mutex);
+}
+
+void SetTrackPan(struct Track* track, float pan) {
+	al_set_audio_stream_pan(track->stream, pan);
+}
+
+void SeekTrack(struct Track* track, unsigned int position) {
+	// Meant to be done while the track is stopped; while it plays, what's
+	// queued already plays out first.
+	int i;
+	if (!track->source) {
+		al_seek_audio_stream_secs(track->stream, position / (double)track->frequency);
+		return;
+	}
+	al_lock_mutex(track->mutex);
+	SeekStretch(&track->stretch, position);
+	for (i = 0; i < TRACK_BUFFERS; i++) {
+		track->starts[i] = GetStretchPosition(&track->stretch);
+	}
+	Fill(track);
+	al_unlock_mutex(track->mutex);
+}
+
+static unsigned int GetStreamPosition(struct Track* track) {
+	// A stream played as it is reports where its decoder is, which is ahead
+	// of what's heard by the fragments queued. Those are taken off, so that
+	// it's the start of the fragment being played, as with a source.
+	double length = al_get_audio_stream_length_secs(track->stream) * track->frequency;
+	double queued = (double)(TRACK_BUFFERS - (int)al_get_available_audio_stream_fragments(track->stream)) * TRACK_FRAGMENT;
+	double position = al_get_audio_stream_position_secs(track->stream) * track->frequency - queued;
+	if (position < 0) {
+		// looped around since
+		position = (position + length > 0) ? position + length : 0;
+	}
+	return position + 0.5;
+}
+
+unsigned int GetTrackPosition(struct Track* track) {
+	// In frames of the source. Changes only once per fragment.
+	unsigned int position;
+	if (!track->source) {
+		return GetStreamPosition(track);
+	}
+	al_lock_mutex(track->mutex);
+	position = track->starts[track->filled % TRACK_BUFFERS];
+	al_unlock_mutex(track->mutex);
+	return position;
+}
+
+unsigned int GetTrackLength(struct Track* track) {
+	if (!track->source) {
+		return al_get_audio_stream_length_secs(track->stream) * track->frequency + 0.5;
+	}
+	return track->stretch.length;
+}
+
+unsigned int GetTrackFrequency(struct Track* track) {
+	return track->frequency;
+}
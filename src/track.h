@@ -0,0 +1,45 @@
+/*! \file track.h
+ *  \brief Music played in a loop, at a tempo that can change without changing its pitch.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ZJEDZTRAWKE2_TRACK_H
+#define ZJEDZTRAWKE2_TRACK_H
+
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_audio.h>
+#include <stdbool.h>
+
+#define TRACK_BUFFERS 4
+#define TRACK_FRAGMENT 1024 // frames
+
+struct Source;
+struct Track;
+
+struct Track* CreateTrack(struct Source* source, const char* filename, ALLEGRO_MIXER* mixer);
+void DestroyTrack(struct Track* track);
+void UpdateTrack(struct Track* track);
+void SetTrackPlaying(struct Track* track, bool playing);
+void SetTrackSpeed(struct Track* track, float speed);
+void SetTrackPan(struct Track* track, float pan);
+void SeekTrack(struct Track* track, unsigned int position);
+unsigned int GetTrackPosition(struct Track* track);
+unsigned int GetTrackLength(struct Track* track);
+unsigned int GetTrackFrequency(struct Track* track);
+
+#endif